@@ -170,6 +170,25 @@ long compareTimes( struct timeval * tm1, struct timeval * tm2 ) {
     return( retval );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : stringHash
+// Description  : Hash a NUL terminated string (32-bit FNV-1a), for use in
+//                in-memory hash tables
+//
+// Inputs       : str - the string to hash
+// Outputs      : the hash value
+
+uint32_t stringHash( const char *str ) {
+
+    uint32_t hash = 2166136261u;
+    while ( *str != '\0' ) {
+	hash ^= (unsigned char)*str++;
+	hash *= 16777619u;
+    }
+    return( hash );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : htonll64
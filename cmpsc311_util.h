@@ -39,6 +39,9 @@ uint32_t getRandomValue( uint32_t min, uint32_t max );
 long compareTimes(struct timeval * tm1, struct timeval * tm2);
     // Compare two timer values 
 
+uint32_t stringHash( const char *str );
+    // Hash a string for in-memory hash tables
+
 uint64_t htonll64(uint64_t val);
 	// Create a 64-byte host-to-network conversion
 
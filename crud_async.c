@@ -0,0 +1,581 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_async.c
+//  Description   : This is the implementation of the asynchronous CRUD
+//                  file interface.  Each worker thread has its own queue,
+//                  and every operation on a file handle goes to the same
+//                  worker, so they run in the order submitted while
+//                  operations on other files proceed alongside them.  The
+//                  workers make the ordinary (thread-safe) blocking calls.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 14:21:09 EDT 2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_async.h>
+#include <crud_file_io.h>
+#include <crud_buffer.h>
+#include <crud_network.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_ASYNC_UNIT_TEST_FILES 4
+#define CRUD_ASYNC_UNIT_TEST_SIZE 0x30000
+#define CRUD_ASYNC_UNIT_TEST_OPS 4096
+#define CRUD_ASYNC_UNIT_TEST_WINDOW 8 // Pipeline depth used by the test if none was set
+#define CRUD_ASYNC_UNIT_TEST_INIT_EVERY 32 // Writes queued between each CRUD_INIT sent mid-flight
+
+// Type definitions
+
+// This is a worker's queue of operations
+typedef struct {
+	CrudAsyncOp   *head;  // Next operation to run
+	CrudAsyncOp   *tail;  // Last operation queued
+	pthread_cond_t ready; // Signalled when an operation is queued
+} AsyncQueue;
+
+// Module local data
+static uint32_t        async_workers = CRUD_ASYNC_DEFAULT_WORKERS; // Workers to run
+static uint32_t        async_started = 0;     // Workers currently running
+static pthread_t      *async_threads = NULL;  // The worker threads
+static AsyncQueue     *async_queues = NULL;   // The queue of each worker
+static CrudAsyncOp    *async_done_head = NULL; // Completed operations, oldest first
+static CrudAsyncOp    *async_done_tail = NULL; // Most recently completed operation
+static uint32_t        async_running = 0;     // Operations queued or running
+static uint32_t        async_pending = 0;     // Operations whose callbacks have not run
+static int             async_stopping = 0;    // Set to tell the workers to exit
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything above
+static pthread_cond_t  async_done = PTHREAD_COND_INITIALIZER;   // Signalled as operations complete
+
+//
+// Module local functions
+
+static int async_submit(CrudAsyncType type, int32_t fd, void *buf, int32_t count, uint32_t loc,
+		CrudAsyncCallback cb, void *ctx);
+static int async_start(void);
+static void async_stop(void);
+static void *async_worker(void *arg);
+static void async_perform(CrudAsyncOp *op);
+static void async_complete(CrudAsyncOp *op);
+static void async_test_callback(int32_t result, void *context);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_async_init
+// Description  : Set the number of worker threads, waiting for the queued
+//                operations to finish and stopping the old workers first.
+//                The new workers start when the next operation is queued.
+//
+// Inputs       : workers - the number of workers (0 runs each operation as
+//                          it is queued, completing it at once)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_async_init(uint32_t workers) {
+	async_stop();
+	pthread_mutex_lock(&async_mutex);
+	async_workers = workers;
+	pthread_mutex_unlock(&async_mutex);
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD async interface set to %u workers.", workers);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_async
+// Description  : Queue a read of the file
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+//                cb - called with the bytes read (or -1) when complete
+//                ctx - passed to the callback
+// Outputs      : 0 if queued, -1 if failure
+
+int crud_read_async(int32_t fd, void *buf, int32_t count, CrudAsyncCallback cb, void *ctx) {
+	return(async_submit(CRUD_ASYNC_READ, fd, buf, count, 0, cb, ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_async
+// Description  : Queue a write to the file
+//
+// Inputs       : fd - the file descriptor for the write
+//                buf - the buffer to write
+//                count - the number of bytes to write
+//                cb - called with the bytes written (or -1) when complete
+//                ctx - passed to the callback
+// Outputs      : 0 if queued, -1 if failure
+
+int crud_write_async(int32_t fd, void *buf, int32_t count, CrudAsyncCallback cb, void *ctx) {
+	return(async_submit(CRUD_ASYNC_WRITE, fd, buf, count, 0, cb, ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_seek_async
+// Description  : Queue a seek, which takes effect after the operations
+//                already queued on the file
+//
+// Inputs       : fd - the file descriptor for the seek
+//                loc - offset from beginning of file to seek to
+//                cb - called with 0 (or -1) when complete
+//                ctx - passed to the callback
+// Outputs      : 0 if queued, -1 if failure
+
+int crud_seek_async(int32_t fd, uint32_t loc, CrudAsyncCallback cb, void *ctx) {
+	return(async_submit(CRUD_ASYNC_SEEK, fd, NULL, 0, loc, cb, ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_close_async
+// Description  : Queue a close of the file, after the operations already
+//                queued on it
+//
+// Inputs       : fd - the file descriptor to close
+//                cb - called with 0 (or -1) when complete
+//                ctx - passed to the callback
+// Outputs      : 0 if queued, -1 if failure
+
+int crud_close_async(int32_t fd, CrudAsyncCallback cb, void *ctx) {
+	return(async_submit(CRUD_ASYNC_CLOSE, fd, NULL, 0, 0, cb, ctx));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_async_poll
+// Description  : Run the callbacks of the operations completed so far, in
+//                the order they completed, on the calling thread
+//
+// Inputs       : wait - if set, block until at least one operation has
+//                       completed (unless nothing is outstanding)
+// Outputs      : the number of operations whose callbacks were run
+
+int crud_async_poll(int wait) {
+	CrudAsyncOp *op, *next;
+	int completed = 0;
+
+	// Take everything completed, waiting for something if asked
+	pthread_mutex_lock(&async_mutex);
+	while( wait && (async_done_head == NULL) && (async_running > 0) ) {
+		pthread_cond_wait(&async_done, &async_mutex);
+	}
+	op = async_done_head;
+	async_done_head = async_done_tail = NULL;
+	pthread_mutex_unlock(&async_mutex);
+
+	// Call back outside the lock, so the callbacks may queue more operations
+	for( ; op != NULL; op = next ) {
+		next = op->next;
+		if( op->callback != NULL ) {
+			op->callback(op->result, op->context);
+		}
+		crud_buffer_free(op);
+		completed++;
+	}
+	pthread_mutex_lock(&async_mutex);
+	async_pending -= completed;
+	pthread_mutex_unlock(&async_mutex);
+	return(completed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_async_pending
+// Description  : Count the operations submitted whose callbacks have not
+//                run yet
+//
+// Inputs       : none
+// Outputs      : the number of operations outstanding
+
+uint32_t crud_async_pending(void) {
+	uint32_t pending;
+
+	pthread_mutex_lock(&async_mutex);
+	pending = async_pending;
+	pthread_mutex_unlock(&async_mutex);
+	return(pending);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_submit
+// Description  : Queue an operation to the worker for its file, starting
+//                the workers if they are not running
+//
+// Inputs       : type - the operation
+//                fd - the file descriptor
+//                buf - the buffer (read/write)
+//                count - the number of bytes (read/write)
+//                loc - the position (seek)
+//                cb - the completion callback
+//                ctx - passed to the callback
+// Outputs      : 0 if queued, -1 if failure
+
+static int async_submit(CrudAsyncType type, int32_t fd, void *buf, int32_t count, uint32_t loc,
+		CrudAsyncCallback cb, void *ctx) {
+	AsyncQueue *queue;
+	CrudAsyncOp *op;
+
+	// Build the operation
+	if( (op = crud_buffer_alloc(sizeof(CrudAsyncOp))) == NULL ) {
+		return(-1);
+	}
+	op->type = type;
+	op->fd = fd;
+	op->buf = buf;
+	op->count = count;
+	op->loc = loc;
+	op->result = -1;
+	op->callback = cb;
+	op->context = ctx;
+	op->next = NULL;
+
+	// Start the workers if needed, run it here if there are none
+	pthread_mutex_lock(&async_mutex);
+	if( (async_started == 0) && (async_workers > 0) && async_start() ) {
+		pthread_mutex_unlock(&async_mutex);
+		crud_buffer_free(op);
+		return(-1);
+	}
+	async_pending++;
+	async_running++;
+	if( async_started == 0 ) {
+		pthread_mutex_unlock(&async_mutex);
+		async_perform(op);
+		async_complete(op);
+		return(0);
+	}
+
+	// Add it to the end of the queue for the file
+	queue = &async_queues[(fd < 0) ? 0 : fd % async_started];
+	if( queue->tail == NULL ) {
+		queue->head = op;
+	} else {
+		queue->tail->next = op;
+	}
+	queue->tail = op;
+	pthread_cond_signal(&queue->ready);
+	pthread_mutex_unlock(&async_mutex);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_start
+// Description  : Start the worker threads (the caller holds async_mutex)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int async_start(void) {
+	uint32_t i;
+
+	// Make the queues and threads
+	async_queues = calloc(async_workers, sizeof(AsyncQueue));
+	async_threads = calloc(async_workers, sizeof(pthread_t));
+	if( (async_queues == NULL) || (async_threads == NULL) ) {
+		free(async_queues);
+		free(async_threads);
+		async_queues = NULL;
+		async_threads = NULL;
+		return(-1);
+	}
+	async_stopping = 0;
+	for( i=0; i<async_workers; i++ ) {
+		pthread_cond_init(&async_queues[i].ready, NULL);
+		if( pthread_create(&async_threads[i], NULL, async_worker, &async_queues[i]) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD async : failed to start worker %u.", i);
+			break;
+		}
+		async_started++;
+	}
+
+	// Make do with however many started
+	if( async_started == 0 ) {
+		free(async_queues);
+		free(async_threads);
+		async_queues = NULL;
+		async_threads = NULL;
+		return(-1);
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_stop
+// Description  : Wait for the queued operations to finish, then stop the
+//                worker threads (completed callbacks are left to be polled)
+//
+// Inputs       : none
+// Outputs      : none
+
+static void async_stop(void) {
+	uint32_t i, started;
+
+	// Let the queues empty, then tell the workers to go
+	pthread_mutex_lock(&async_mutex);
+	while( async_running > 0 ) {
+		pthread_cond_wait(&async_done, &async_mutex);
+	}
+	async_stopping = 1;
+	started = async_started;
+	for( i=0; i<started; i++ ) {
+		pthread_cond_signal(&async_queues[i].ready);
+	}
+	pthread_mutex_unlock(&async_mutex);
+
+	// Wait for them and release everything
+	for( i=0; i<started; i++ ) {
+		pthread_join(async_threads[i], NULL);
+		pthread_cond_destroy(&async_queues[i].ready);
+	}
+	pthread_mutex_lock(&async_mutex);
+	free(async_queues);
+	free(async_threads);
+	async_queues = NULL;
+	async_threads = NULL;
+	async_started = 0;
+	async_stopping = 0;
+	pthread_mutex_unlock(&async_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_worker
+// Description  : Run the operations on a queue until told to stop
+//
+// Inputs       : arg - the queue to serve
+// Outputs      : NULL
+
+static void *async_worker(void *arg) {
+	AsyncQueue *queue = arg;
+	CrudAsyncOp *op;
+
+	pthread_mutex_lock(&async_mutex);
+	while( 1 ) {
+		// Wait for something to do
+		while( (queue->head == NULL) && !async_stopping ) {
+			pthread_cond_wait(&queue->ready, &async_mutex);
+		}
+		if( (op = queue->head) == NULL ) {
+			break;
+		}
+		if( (queue->head = op->next) == NULL ) {
+			queue->tail = NULL;
+		}
+		pthread_mutex_unlock(&async_mutex);
+
+		// Do it without the lock held
+		async_perform(op);
+		async_complete(op);
+		pthread_mutex_lock(&async_mutex);
+	}
+	pthread_mutex_unlock(&async_mutex);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_perform
+// Description  : Make the blocking call for an operation
+//
+// Inputs       : op - the operation
+// Outputs      : none
+
+static void async_perform(CrudAsyncOp *op) {
+	switch( op->type ) {
+	case CRUD_ASYNC_READ:
+		op->result = crud_read(op->fd, op->buf, op->count);
+		break;
+
+	case CRUD_ASYNC_WRITE:
+		op->result = crud_write(op->fd, op->buf, op->count);
+		break;
+
+	case CRUD_ASYNC_SEEK:
+		op->result = crud_seek(op->fd, op->loc);
+		break;
+
+	case CRUD_ASYNC_CLOSE:
+		op->result = crud_close(op->fd);
+		break;
+
+	default: // Unknown operation
+		op->result = -1;
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_complete
+// Description  : Put a finished operation on the completed list
+//
+// Inputs       : op - the operation
+// Outputs      : none
+
+static void async_complete(CrudAsyncOp *op) {
+	pthread_mutex_lock(&async_mutex);
+	op->next = NULL;
+	if( async_done_tail == NULL ) {
+		async_done_head = op;
+	} else {
+		async_done_tail->next = op;
+	}
+	async_done_tail = op;
+	async_running--;
+	pthread_cond_broadcast(&async_done);
+	pthread_mutex_unlock(&async_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudAsyncUnitTest
+// Description  : Perform a test of the asynchronous interface: random
+//                writes and then reads spread over several files, all in
+//                flight together, checked against a copy of the contents.
+//                The requests are pipelined (tagged) if the server allows,
+//                and CRUD_INIT is sent every so often while they are.
+//
+// Inputs       : None
+// Outputs      : 0 if successful or -1 if failure
+
+int crudAsyncUnitTest(void) {
+
+	// Local variables
+	int32_t fh[CRUD_ASYNC_UNIT_TEST_FILES], expected[CRUD_ASYNC_UNIT_TEST_OPS], results[CRUD_ASYNC_UNIT_TEST_OPS];
+	uint32_t length[CRUD_ASYNC_UNIT_TEST_FILES], i, f, ops = 0, count, window = crud_pipeline_window;
+	char *contents, *readback, name[32];
+
+	// Setup the buffers, format and mount the file system
+	contents = malloc(CRUD_ASYNC_UNIT_TEST_FILES*CRUD_ASYNC_UNIT_TEST_SIZE);
+	readback = malloc(CRUD_ASYNC_UNIT_TEST_FILES*CRUD_ASYNC_UNIT_TEST_SIZE);
+	for (i=0; i<CRUD_ASYNC_UNIT_TEST_FILES*CRUD_ASYNC_UNIT_TEST_SIZE; i++) {
+		contents[i] = getRandomValue(0, 255);
+	}
+	for (i=0; i<CRUD_ASYNC_UNIT_TEST_OPS; i++) {
+		results[i] = -2;
+	}
+	crud_pipeline_window = (window == 0) ? CRUD_ASYNC_UNIT_TEST_WINDOW : window;
+	if (crud_format() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : Failure on format/mount.");
+		return(-1);
+	}
+	for (f=0; f<CRUD_ASYNC_UNIT_TEST_FILES; f++) {
+		snprintf(name, sizeof(name), "async_utest_%u", f);
+		if ((fh[f] = crud_open(name)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : Failure open operation.");
+			return(-1);
+		}
+		length[f] = 0;
+	}
+
+	// Queue writes of random sizes to random files, collecting some as we go
+	while (ops < CRUD_ASYNC_UNIT_TEST_OPS/2) {
+		f = getRandomValue(0, CRUD_ASYNC_UNIT_TEST_FILES-1);
+		count = getRandomValue(1, 4096);
+		if (length[f] + count > CRUD_ASYNC_UNIT_TEST_SIZE) {
+			break;
+		}
+		expected[ops] = count;
+		if (crud_write_async(fh[f], &contents[f*CRUD_ASYNC_UNIT_TEST_SIZE + length[f]], count,
+				async_test_callback, &results[ops])) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : Failure queueing write.");
+			return(-1);
+		}
+		length[f] += count;
+		ops++;
+		if ((ops % 16) == 0) {
+			crud_async_poll(0);
+		}
+
+		// Re-initialize now and then, the pool has to drain around it with writes in flight
+		if (((ops % CRUD_ASYNC_UNIT_TEST_INIT_EVERY) == 0) &&
+				(crud_client_operation(construct_crud_request(0, CRUD_INIT, 0, 0, 0), NULL) & 1)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : Failure on CRUD_INIT with requests in flight.");
+			return(-1);
+		}
+	}
+
+	// Rewind each file and queue reads of it in random pieces
+	for (f=0; f<CRUD_ASYNC_UNIT_TEST_FILES; f++) {
+		expected[ops] = 0;
+		crud_seek_async(fh[f], 0, async_test_callback, &results[ops++]);
+		for (i=0; (i<length[f]) && (ops<CRUD_ASYNC_UNIT_TEST_OPS-CRUD_ASYNC_UNIT_TEST_FILES); i+=count) {
+			count = getRandomValue(1, 8192);
+			expected[ops] = (i + count > length[f]) ? length[f] - i : count;
+			crud_read_async(fh[f], &readback[f*CRUD_ASYNC_UNIT_TEST_SIZE + i], count,
+					async_test_callback, &results[ops++]);
+		}
+		if (i < length[f]) {
+			length[f] = i;
+		}
+	}
+
+	// Close everything and wait for it all to come back
+	for (f=0; f<CRUD_ASYNC_UNIT_TEST_FILES; f++) {
+		expected[ops] = 0;
+		crud_close_async(fh[f], async_test_callback, &results[ops++]);
+	}
+	while (crud_async_pending() > 0) {
+		crud_async_poll(1);
+	}
+
+	// Check every result and the bytes read back
+	for (i=0; i<ops; i++) {
+		if (results[i] != expected[i]) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : operation %u returned %d, expected %d.",
+					i, results[i], expected[i]);
+			return(-1);
+		}
+	}
+	for (f=0; f<CRUD_ASYNC_UNIT_TEST_FILES; f++) {
+		if (memcmp(&contents[f*CRUD_ASYNC_UNIT_TEST_SIZE], &readback[f*CRUD_ASYNC_UNIT_TEST_SIZE], length[f])) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : read data mismatch in file %u.", f);
+			return(-1);
+		}
+	}
+	free(contents);
+	free(readback);
+
+	// Unmount the file system
+	if (crud_unmount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_ASYNC_UNIT_TEST : Failure on unmount operation.");
+		return(-1);
+	}
+	crud_pipeline_window = window;
+
+	// Return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_ASYNC_UNIT_TEST : %u operations completed successfully%s.", ops,
+			(crud_server_capabilities & CRUD_CAP_PIPELINE) ? " (pipelined)" : "");
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : async_test_callback
+// Description  : Record the result of a unit test operation
+//
+// Inputs       : result - the result of the operation
+//                context - where to record it
+// Outputs      : none
+
+static void async_test_callback(int32_t result, void *context) {
+	*(int32_t *)context = result;
+}
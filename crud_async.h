@@ -0,0 +1,82 @@
+#ifndef CRUD_ASYNC_INCLUDED
+#define CRUD_ASYNC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_async.h
+//  Description   : This is the asynchronous interface to the CRUD file
+//                  functions.  Operations are queued to a set of worker
+//                  threads and return at once; the caller collects the
+//                  results later with crud_async_poll(), which runs each
+//                  completed operation's callback on the caller's thread.
+//                  Operations on the same file handle complete in the order
+//                  they were submitted.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 14:21:09 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define CRUD_ASYNC_DEFAULT_WORKERS 4 // Worker threads started on first use
+
+// Type definitions
+
+// This is called when an operation completes, with what the blocking call
+// would have returned (bytes read/written, or 0/-1 for seek and close)
+typedef void (*CrudAsyncCallback)(int32_t result, void *context);
+
+// These are the operations that can be queued
+typedef enum {
+	CRUD_ASYNC_READ  = 0,
+	CRUD_ASYNC_WRITE = 1,
+	CRUD_ASYNC_SEEK  = 2,
+	CRUD_ASYNC_CLOSE = 3,
+} CrudAsyncType;
+
+// This is a single queued operation
+typedef struct CrudAsyncOp {
+	CrudAsyncType       type;     // The operation
+	int32_t             fd;       // The file handle
+	void               *buf;      // The buffer to read into/write from
+	int32_t             count;    // The bytes to read/write
+	uint32_t            loc;      // The position to seek to
+	int32_t             result;   // The result, once complete
+	CrudAsyncCallback   callback; // Called from crud_async_poll (may be NULL)
+	void               *context;  // Passed to the callback
+	struct CrudAsyncOp *next;     // Next operation in the queue
+} CrudAsyncOp;
+
+//
+// Functional Prototypes
+
+int crud_async_init(uint32_t workers);
+	// Set the number of worker threads (waits for queued operations first)
+
+int crud_read_async(int32_t fd, void *buf, int32_t count, CrudAsyncCallback cb, void *ctx);
+	// Queue a crud_read, the buffer must stay valid until it completes
+
+int crud_write_async(int32_t fd, void *buf, int32_t count, CrudAsyncCallback cb, void *ctx);
+	// Queue a crud_write, the buffer must stay valid until it completes
+
+int crud_seek_async(int32_t fd, uint32_t loc, CrudAsyncCallback cb, void *ctx);
+	// Queue a crud_seek
+
+int crud_close_async(int32_t fd, CrudAsyncCallback cb, void *ctx);
+	// Queue a crud_close
+
+int crud_async_poll(int wait);
+	// Run the callbacks of completed operations, returns how many (wait for one if asked)
+
+uint32_t crud_async_pending(void);
+	// The number of operations submitted whose callbacks have not yet run
+
+//
+// Unit testing for the module
+
+int crudAsyncUnitTest(void);
+	// Test the asynchronous interface
+
+#endif
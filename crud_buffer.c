@@ -0,0 +1,201 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_buffer.c
+//  Description   : This is the implementation of the CRUD client buffer
+//                  pool.  Each buffer carries a small header recording its
+//                  size class; released buffers go on the free list for
+//                  their class until the idle limit is reached.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 11:02:17 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_buffer.h>
+#include <cmpsc311_log.h>
+
+// Type definitions
+
+// This sits in front of every buffer (sized to keep the data aligned)
+typedef union BufferHeader {
+	struct {
+		union BufferHeader *next;   // Next idle buffer in the class
+		uint32_t            sclass; // The size class (CRUD_BUFFER_CLASSES if oversize)
+	} h;
+	max_align_t align;
+} BufferHeader;
+
+//
+// Global Data
+
+CrudBufferStats crud_buffer_stats; // The buffer pool statistics
+
+// Module local data
+static BufferHeader   *buffer_free[CRUD_BUFFER_CLASSES]; // The idle buffers of each class
+static uint64_t        buffer_idle = 0;                    // Bytes sitting on the free lists
+static pthread_mutex_t buffer_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything above
+
+//
+// Module local functions
+
+static uint32_t buffer_class(uint32_t size);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_buffer_alloc
+// Description  : Get a buffer of at least the requested size, reusing an
+//                idle one of the same class if there is one.
+//
+// Inputs       : size - the number of bytes needed
+// Outputs      : the buffer, or NULL if memory could not be allocated
+
+void *crud_buffer_alloc(uint32_t size) {
+	uint32_t sclass = buffer_class(size);
+	BufferHeader *hdr = NULL;
+	size_t bytes;
+
+	// Take an idle buffer of the right class if we have one
+	pthread_mutex_lock(&buffer_mutex);
+	crud_buffer_stats.allocations++;
+	if (sclass == CRUD_BUFFER_CLASSES) {
+		crud_buffer_stats.oversize++;
+	} else if ((hdr = buffer_free[sclass]) != NULL) {
+		buffer_free[sclass] = hdr->h.next;
+		buffer_idle -= (1 << (sclass + CRUD_BUFFER_MIN_SHIFT));
+		crud_buffer_stats.reused++;
+	}
+	pthread_mutex_unlock(&buffer_mutex);
+	if (hdr != NULL) {
+		return(hdr + 1);
+	}
+
+	// Otherwise go to malloc for a new one
+	bytes = (sclass == CRUD_BUFFER_CLASSES) ? size : (1 << (sclass + CRUD_BUFFER_MIN_SHIFT));
+	if ((hdr = malloc(sizeof(BufferHeader) + bytes)) == NULL) {
+		return(NULL);
+	}
+	hdr->h.sclass = sclass;
+	if (sclass != CRUD_BUFFER_CLASSES) {
+		pthread_mutex_lock(&buffer_mutex);
+		crud_buffer_stats.held += bytes;
+		if (crud_buffer_stats.held > crud_buffer_stats.peak_held) {
+			crud_buffer_stats.peak_held = crud_buffer_stats.held;
+		}
+		pthread_mutex_unlock(&buffer_mutex);
+	}
+	return(hdr + 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_buffer_free
+// Description  : Return a buffer to the pool, keeping it for reuse unless
+//                it is oversize or the free lists are already full.
+//
+// Inputs       : buf - the buffer (from crud_buffer_alloc, or NULL)
+// Outputs      : none
+
+void crud_buffer_free(void *buf) {
+	BufferHeader *hdr;
+	uint32_t bytes;
+
+	// Check the buffer
+	if (buf == NULL) {
+		return;
+	}
+	hdr = (BufferHeader *)buf - 1;
+	if (hdr->h.sclass == CRUD_BUFFER_CLASSES) {
+		free(hdr);
+		return;
+	}
+
+	// Keep it idle if there is room, otherwise let it go
+	bytes = 1 << (hdr->h.sclass + CRUD_BUFFER_MIN_SHIFT);
+	pthread_mutex_lock(&buffer_mutex);
+	if (buffer_idle + bytes <= CRUD_BUFFER_IDLE_MAX) {
+		hdr->h.next = buffer_free[hdr->h.sclass];
+		buffer_free[hdr->h.sclass] = hdr;
+		buffer_idle += bytes;
+		hdr = NULL;
+	} else {
+		crud_buffer_stats.held -= bytes;
+		crud_buffer_stats.released++;
+	}
+	pthread_mutex_unlock(&buffer_mutex);
+	free(hdr);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_buffer_trim
+// Description  : Release every idle buffer back to malloc
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_buffer_trim(void) {
+	BufferHeader *hdr;
+	uint32_t i;
+
+	pthread_mutex_lock(&buffer_mutex);
+	for (i=0; i<CRUD_BUFFER_CLASSES; i++) {
+		while ((hdr = buffer_free[i]) != NULL) {
+			buffer_free[i] = hdr->h.next;
+			crud_buffer_stats.held -= (1 << (i + CRUD_BUFFER_MIN_SHIFT));
+			free(hdr);
+		}
+	}
+	buffer_idle = 0;
+	pthread_mutex_unlock(&buffer_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_buffer_log_stats
+// Description  : Log the buffer pool counters
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_buffer_log_stats(void) {
+	CrudBufferStats stats;
+
+	pthread_mutex_lock(&buffer_mutex);
+	stats = crud_buffer_stats;
+	pthread_mutex_unlock(&buffer_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD buffers : %llu allocations, %llu reused (%.1f%% malloc avoided), "
+			"%llu oversize, %llu released, %llu bytes held (peak %llu)",
+			(unsigned long long)stats.allocations, (unsigned long long)stats.reused,
+			(stats.allocations == 0) ? 0.0 : (100.0 * stats.reused) / stats.allocations,
+			(unsigned long long)stats.oversize, (unsigned long long)stats.released,
+			(unsigned long long)stats.held, (unsigned long long)stats.peak_held);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buffer_class
+// Description  : Find the smallest size class that holds a buffer
+//
+// Inputs       : size - the number of bytes needed
+// Outputs      : the class, or CRUD_BUFFER_CLASSES if too large for any
+
+static uint32_t buffer_class(uint32_t size) {
+	uint32_t sclass = 0;
+
+	if (size > (1 << CRUD_BUFFER_MAX_SHIFT)) {
+		return(CRUD_BUFFER_CLASSES);
+	}
+	while ((1 << (sclass + CRUD_BUFFER_MIN_SHIFT)) < size) {
+		sclass++;
+	}
+	return(sclass);
+}
@@ -0,0 +1,59 @@
+#ifndef CRUD_BUFFER_INCLUDED
+#define CRUD_BUFFER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_buffer.h
+//  Description   : This is the buffer pool for the CRUD client.  Buffers
+//                  are handed out in power-of-two size classes and kept on
+//                  a free list when released, so the object sized buffers
+//                  used on every read and write are recycled rather than
+//                  going back to malloc.  The pool may be used from several
+//                  threads at once.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 11:02:17 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define CRUD_BUFFER_MIN_SHIFT 6         // Smallest class is 64 bytes
+#define CRUD_BUFFER_MAX_SHIFT 20        // Largest class is 1 MB (bigger go to malloc)
+#define CRUD_BUFFER_CLASSES (CRUD_BUFFER_MAX_SHIFT-CRUD_BUFFER_MIN_SHIFT+1)
+#define CRUD_BUFFER_IDLE_MAX (4*1024*1024) // Most bytes kept idle on the free lists
+
+// Type definitions
+
+// These are the buffer pool statistics
+typedef struct {
+	uint64_t allocations; // Buffers asked for
+	uint64_t reused;      // Served from a free list (malloc avoided)
+	uint64_t oversize;    // Too large for any class, sent to malloc
+	uint64_t released;    // Returned to malloc because the free lists were full
+	uint64_t held;        // Bytes held by the pool (in use and idle)
+	uint64_t peak_held;   // Most bytes ever held at once
+} CrudBufferStats;
+
+//
+// Functional Prototypes
+
+void *crud_buffer_alloc(uint32_t size);
+	// Get a buffer of at least size bytes (contents undefined)
+
+void crud_buffer_free(void *buf);
+	// Return a buffer to the pool (NULL is ignored)
+
+void crud_buffer_trim(void);
+	// Release every idle buffer back to malloc
+
+void crud_buffer_log_stats(void);
+	// Log the allocation/reuse counters
+
+//
+// Buffer Pool Global Data
+
+extern CrudBufferStats crud_buffer_stats; // The buffer pool statistics
+
+#endif
@@ -0,0 +1,510 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_cache.c
+//  Description   : This is the implementation of the client-side object
+//                  cache for the CRUD storage system.  Each line holds one
+//                  whole object, lines are found through a hash on the OID
+//                  and replaced in least-recently-used order.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 09:12:44 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_cache.h>
+#include <crud_network.h>
+#include <crud_buffer.h>
+#include <cmpsc311_log.h>
+
+//
+// Global Data
+
+CrudCacheStats crud_cache_stats; // The cache statistics
+
+// Module local data
+static uint32_t        cache_max_lines = CRUD_CACHE_DEFAULT_LINES; // Capacity of the cache
+static uint32_t        cache_used_lines = 0;  // Lines currently in use
+static CrudCacheLine **cache_buckets = NULL;  // The hash buckets
+static uint32_t        cache_bucket_mask = 0; // Mask used to pick a bucket
+static CrudCacheLine  *cache_mru = NULL;      // Most recently used line
+static CrudCacheLine  *cache_lru = NULL;      // Least recently used line
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything above (not held over the network)
+
+//
+// Module local functions
+
+static int cache_setup(void);
+static CrudCacheLine *cache_find(CrudOID oid);
+static void cache_unlink(CrudCacheLine *line);
+static void cache_push_front(CrudCacheLine *line);
+static void cache_remove(CrudCacheLine *line);
+static void cache_insert(CrudOID oid, void *buf, uint32_t length);
+static void cache_update(CrudRequest op, uint32_t offset, CrudResponse response, void *buf);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_init
+// Description  : Set the number of lines in the cache, dropping anything
+//                currently cached.
+//
+// Inputs       : lines - the number of cache lines (0 disables the cache)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_cache_init(uint32_t lines) {
+	// Drop the old cache, set the new size
+	pthread_mutex_lock(&cache_mutex);
+	while (cache_lru != NULL) {
+		cache_remove(cache_lru);
+	}
+	free(cache_buckets);
+	cache_buckets = NULL;
+	cache_max_lines = lines;
+	pthread_mutex_unlock(&cache_mutex);
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD cache sized to %u lines.", lines);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_operation
+// Description  : Perform a CRUD operation through the cache.  Reads of a
+//                cached object are answered locally, everything else is sent
+//                to the server and the cache is updated to match the result.
+//
+// Inputs       : op - the request opcode for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+CrudResponse crud_cache_operation(CrudRequest op, void *buf) {
+	// Local variables
+	CrudCacheLine *line;
+	CrudResponse response;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+
+	// Pull apart the request, pass through anything the cache does not hold
+	deconstruct_crud_request(op, &oid, &req, &length, &flags, &res);
+	if ((req == CRUD_INIT) || (req == CRUD_FORMAT) || (req == CRUD_CLOSE)) {
+		crud_cache_flush();
+	}
+	pthread_mutex_lock(&cache_mutex);
+	if ((cache_max_lines == 0) || (flags & CRUD_PRIORITY_OBJECT) || cache_setup()) {
+		pthread_mutex_unlock(&cache_mutex);
+		return(crud_client_operation(op, buf));
+	}
+
+	// Serve reads from the cache if we have the whole object
+	if (req == CRUD_READ) {
+		line = cache_find(oid);
+		if ((line != NULL) && (line->length <= length)) {
+			memcpy(buf, line->data, line->length);
+			cache_unlink(line);
+			cache_push_front(line);
+			crud_cache_stats.hits++;
+			response = construct_crud_request(oid, CRUD_READ, line->length, flags, 0);
+			pthread_mutex_unlock(&cache_mutex);
+			return(response);
+		}
+		crud_cache_stats.misses++;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	// Send the request to the server, keep the cache in step with the result
+	response = crud_client_operation(op, buf);
+	pthread_mutex_lock(&cache_mutex);
+	cache_update(op, 0, response, buf);
+	pthread_mutex_unlock(&cache_mutex);
+
+	// Return the server response
+	return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_batch
+// Description  : Send a batch of requests to the server in one exchange,
+//                then bring the cache in line with each result.  Reads in a
+//                batch always go to the server.
+//
+// Inputs       : ops - the requests (responses filled in on return)
+//                count - the number of requests
+// Outputs      : 0 if the responses were collected, -1 if failure
+
+int crud_cache_batch(CrudBatchOp *ops, uint32_t count) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, i;
+	uint8_t flags, res;
+	int ret;
+
+	// Send the batch, then update the lines it touched
+	ret = crud_client_batch(ops, count);
+	pthread_mutex_lock(&cache_mutex);
+	if ((cache_max_lines != 0) && (cache_setup() == 0)) {
+		for (i=0; i<count; i++) {
+			deconstruct_crud_request(ops[i].request, &oid, &req, &length, &flags, &res);
+			if (!(flags & CRUD_PRIORITY_OBJECT)) {
+				cache_update(ops[i].request, ops[i].offset, ops[i].response, ops[i].buf);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_update
+// Description  : Bring the cache in line with the result of a request sent
+//                to the server (the caller holds cache_mutex)
+//
+// Inputs       : op - the request sent
+//                offset - the offset of a CRUD_WRITE_RANGE
+//                response - the response from the server
+//                buf - the request/response bytes
+// Outputs      : none
+
+static void cache_update(CrudRequest op, uint32_t offset, CrudResponse response, void *buf) {
+	// Local variables
+	CrudCacheLine *line;
+	CrudOID oid, roid;
+	CRUD_REQUEST_TYPES req, rreq;
+	uint32_t length, rlength;
+	uint8_t flags, res, rflags, rres;
+
+	deconstruct_crud_request(op, &oid, &req, &length, &flags, &res);
+	deconstruct_crud_request(response, &roid, &rreq, &rlength, &rflags, &rres);
+	switch (req) {
+
+	case CRUD_READ: // Fill the line with what came back
+		if ((rres == 0) && (rlength <= length)) {
+			cache_insert(oid, buf, rlength);
+		}
+		break;
+
+	case CRUD_CREATE: // New object, the server picked the OID
+		if (rres == 0) {
+			cache_insert(roid, buf, length);
+		}
+		break;
+
+	case CRUD_UPDATE: // Write through, then replace the line contents
+		if (rres == 0) {
+			cache_insert(oid, buf, length);
+		} else if ((line = cache_find(oid)) != NULL) {
+			cache_remove(line);
+		}
+		break;
+
+	case CRUD_WRITE_RANGE: // Patch the bytes written into the line
+		if ((line = cache_find(oid)) != NULL) {
+			if ((rres == 0) && (offset <= line->length) && (length <= line->length - offset)) {
+				memcpy(&line->data[offset], buf, length);
+			} else {
+				cache_remove(line);
+			}
+		}
+		break;
+
+	case CRUD_DELETE: // Object is gone
+		if ((line = cache_find(oid)) != NULL) {
+			cache_remove(line);
+		}
+		break;
+
+	default: // Nothing cached for the other requests
+		break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_read_range
+// Description  : Read part of an object.  If the whole object is cached the
+//                range is copied out of the line, otherwise only the range is
+//                fetched from the server (partial objects are not cached).
+//
+// Inputs       : op - the CRUD_READ_RANGE request (length is bytes wanted)
+//                offset - the offset in the object to start reading at
+//                buf - the buffer to place the bytes into
+// Outputs      : the response (length is the number of bytes returned)
+
+CrudResponse crud_cache_read_range(CrudRequest op, uint32_t offset, void *buf) {
+	// Local variables
+	CrudCacheLine *line;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+
+	// Copy the range out of the line if we have the object
+	deconstruct_crud_request(op, &oid, &req, &length, &flags, &res);
+	pthread_mutex_lock(&cache_mutex);
+	if ((cache_max_lines != 0) && !(flags & CRUD_PRIORITY_OBJECT)) {
+		line = cache_find(oid);
+		if ((line != NULL) && (offset <= line->length)) {
+			if (length > line->length - offset) {
+				length = line->length - offset;
+			}
+			memcpy(buf, &line->data[offset], length);
+			cache_unlink(line);
+			cache_push_front(line);
+			crud_cache_stats.hits++;
+			pthread_mutex_unlock(&cache_mutex);
+			return(construct_crud_request(oid, CRUD_READ_RANGE, length, flags, 0));
+		}
+		crud_cache_stats.misses++;
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	// Fetch just the range from the server
+	return(crud_client_read_range(op, offset, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_write_range
+// Description  : Write part of an object through to the server, then patch
+//                the range into the line if the object is cached.
+//
+// Inputs       : op - the CRUD_WRITE_RANGE request (length is bytes sent)
+//                offset - the offset in the object to start writing at
+//                buf - the bytes to write
+// Outputs      : the response (length is the number of bytes written)
+
+CrudResponse crud_cache_write_range(CrudRequest op, uint32_t offset, void *buf) {
+	// Local variables
+	CrudResponse response;
+
+	// Send the range to the server, keep the cache in step with the result
+	response = crud_client_write_range(op, offset, buf);
+	pthread_mutex_lock(&cache_mutex);
+	if ((cache_max_lines != 0) && (cache_setup() == 0)) {
+		cache_update(op, offset, response, buf);
+	}
+	pthread_mutex_unlock(&cache_mutex);
+	return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_flush
+// Description  : Remove every line from the cache
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_cache_flush(void) {
+	pthread_mutex_lock(&cache_mutex);
+	while (cache_lru != NULL) {
+		cache_remove(cache_lru);
+	}
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_cache_log_stats
+// Description  : Log the hit/miss/eviction counters
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_cache_log_stats(void) {
+	CrudCacheStats stats;
+	uint32_t used;
+
+	pthread_mutex_lock(&cache_mutex);
+	stats = crud_cache_stats;
+	used = cache_used_lines;
+	pthread_mutex_unlock(&cache_mutex);
+
+	uint64_t lookups = stats.hits + stats.misses;
+	logMessage(LOG_INFO_LEVEL, "CRUD cache : %u/%u lines, %llu hits, %llu misses (%.1f%% hit), "
+			"%llu inserts, %llu evictions", used, cache_max_lines,
+			(unsigned long long)stats.hits, (unsigned long long)stats.misses,
+			(lookups == 0) ? 0.0 : (100.0 * stats.hits) / lookups,
+			(unsigned long long)stats.inserts,
+			(unsigned long long)stats.evictions);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_setup
+// Description  : Allocate the hash buckets on first use
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int cache_setup(void) {
+	uint32_t buckets = 1;
+
+	// Already done?
+	if (cache_buckets != NULL) {
+		return(0);
+	}
+
+	// Size the buckets to the next power of two above the line count
+	while (buckets < cache_max_lines) {
+		buckets <<= 1;
+	}
+	cache_buckets = calloc(buckets, sizeof(CrudCacheLine *));
+	if (cache_buckets == NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD cache : failed to allocate %u buckets.", buckets);
+		return(-1);
+	}
+	cache_bucket_mask = buckets - 1;
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_find
+// Description  : Look up the line holding an object
+//
+// Inputs       : oid - the object to look for
+// Outputs      : the line, or NULL if not cached
+
+static CrudCacheLine *cache_find(CrudOID oid) {
+	CrudCacheLine *line;
+
+	if (cache_buckets == NULL) {
+		return(NULL);
+	}
+	for (line = cache_buckets[oid & cache_bucket_mask]; line != NULL; line = line->hnext) {
+		if (line->object_id == oid) {
+			return(line);
+		}
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_unlink
+// Description  : Take a line out of the recently-used list
+//
+// Inputs       : line - the line to unlink
+// Outputs      : none
+
+static void cache_unlink(CrudCacheLine *line) {
+	if (line->prev != NULL) {
+		line->prev->next = line->next;
+	} else {
+		cache_mru = line->next;
+	}
+	if (line->next != NULL) {
+		line->next->prev = line->prev;
+	} else {
+		cache_lru = line->prev;
+	}
+	line->prev = line->next = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_push_front
+// Description  : Make a line the most recently used
+//
+// Inputs       : line - the line to move to the front
+// Outputs      : none
+
+static void cache_push_front(CrudCacheLine *line) {
+	line->prev = NULL;
+	line->next = cache_mru;
+	if (cache_mru != NULL) {
+		cache_mru->prev = line;
+	}
+	cache_mru = line;
+	if (cache_lru == NULL) {
+		cache_lru = line;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_remove
+// Description  : Remove a line from the cache and free it
+//
+// Inputs       : line - the line to remove
+// Outputs      : none
+
+static void cache_remove(CrudCacheLine *line) {
+	CrudCacheLine **walk;
+
+	// Take it out of the bucket chain and the recently-used list
+	walk = &cache_buckets[line->object_id & cache_bucket_mask];
+	while (*walk != line) {
+		walk = &(*walk)->hnext;
+	}
+	*walk = line->hnext;
+	cache_unlink(line);
+
+	// Release the memory
+	crud_buffer_free(line->data);
+	crud_buffer_free(line);
+	cache_used_lines--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cache_insert
+// Description  : Place the contents of an object in the cache, replacing
+//                any old copy and evicting the least recently used line if
+//                the cache is full.
+//
+// Inputs       : oid - the object identifier
+//                buf - the object contents
+//                length - the length of the object
+// Outputs      : none
+
+static void cache_insert(CrudOID oid, void *buf, uint32_t length) {
+	CrudCacheLine *line;
+	char *data;
+
+	// Copy the data first, skip caching if we cannot
+	data = crud_buffer_alloc(length);
+	if (data == NULL) {
+		return;
+	}
+	memcpy(data, buf, length);
+
+	// Replace an existing line, or make a new one
+	if ((line = cache_find(oid)) != NULL) {
+		crud_buffer_free(line->data);
+		cache_unlink(line);
+	} else {
+		if (cache_used_lines >= cache_max_lines) {
+			cache_remove(cache_lru);
+			crud_cache_stats.evictions++;
+		}
+		line = crud_buffer_alloc(sizeof(CrudCacheLine));
+		if (line == NULL) {
+			crud_buffer_free(data);
+			return;
+		}
+		line->object_id = oid;
+		line->hnext = cache_buckets[oid & cache_bucket_mask];
+		cache_buckets[oid & cache_bucket_mask] = line;
+		cache_used_lines++;
+	}
+
+	// Fill the line and make it most recently used
+	line->data = data;
+	line->length = length;
+	cache_push_front(line);
+	crud_cache_stats.inserts++;
+}
@@ -0,0 +1,77 @@
+#ifndef CRUD_CACHE_INCLUDED
+#define CRUD_CACHE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_cache.h
+//  Description   : This is the client-side object cache for the CRUD storage
+//                  system.  It sits between the file interface and the
+//                  network client, keeping recently used objects in memory
+//                  (LRU replacement).  Writes are passed through to the
+//                  server before the cache is updated.  The cache may be
+//                  used from several threads at once.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 09:12:44 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <crud_driver.h>
+#include <crud_network.h>
+
+// Defines
+#define CRUD_CACHE_DEFAULT_LINES 1024
+
+// Type definitions
+
+// This is a single cache line (one whole object)
+typedef struct CrudCacheLine {
+	CrudOID               object_id; // The object held in the line
+	uint32_t              length;    // The length of the object
+	char                 *data;      // The object contents
+	struct CrudCacheLine *hnext;     // Next line in the hash bucket
+	struct CrudCacheLine *prev;      // More recently used line
+	struct CrudCacheLine *next;      // Less recently used line
+} CrudCacheLine;
+
+// These are the cache statistics
+typedef struct {
+	uint64_t hits;      // Reads served from the cache
+	uint64_t misses;    // Reads sent to the server
+	uint64_t inserts;   // Lines filled
+	uint64_t evictions; // Lines removed to make room
+} CrudCacheStats;
+
+//
+// Functional Prototypes
+
+int crud_cache_init(uint32_t lines);
+	// Set the number of lines in the cache (0 disables caching)
+
+CrudResponse crud_cache_operation(CrudRequest op, void *buf);
+	// Perform a CRUD operation, serving reads from the cache when possible
+
+CrudResponse crud_cache_read_range(CrudRequest op, uint32_t offset, void *buf);
+	// Read part of an object, from the cache if it holds the object
+
+CrudResponse crud_cache_write_range(CrudRequest op, uint32_t offset, void *buf);
+	// Write part of an object, patching the cached copy if there is one
+
+int crud_cache_batch(CrudBatchOp *ops, uint32_t count);
+	// Send a batch of requests, keeping the cache in step with the results
+
+void crud_cache_flush(void);
+	// Remove every line from the cache
+
+void crud_cache_log_stats(void);
+	// Log the hit/miss/eviction counters
+
+//
+// Cache Global Data
+
+extern CrudCacheStats crud_cache_stats; // The cache statistics
+
+#endif
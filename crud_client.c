@@ -12,26 +12,109 @@
 // Project Include Files
 #include <crud_network.h>
 #include <crud_driver.h>
+#include <crud_buffer.h>
+#include <crud_compress.h>
+#include <crud_shm.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <stdlib.h>
+#include <string.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
 
 // Global variables
 int            crud_network_shutdown = 0; // Flag indicating shutdown
-unsigned char *crud_network_address = NULL; // Address of CRUD server 
+unsigned char *crud_network_address = NULL; // Address of CRUD server
 unsigned short crud_network_port = 0; // Port of CRUD server
+char          *crud_network_path = NULL; // Unix domain socket of CRUD server (NULL for TCP)
+char          *crud_network_shm = NULL; // Shared memory region of CRUD server (NULL for sockets)
+CrudShmRegion *crud_shm_region = NULL; // The region, once claimed
+uint32_t       crud_server_capabilities = 0; // Extensions granted at CRUD_INIT
+uint64_t       crud_client_requests = 0; // Requests sent to the server
+CrudTransportStats crud_transport_stats; // Syscalls and bytes on the wire (updated atomically)
+
+// This is a request waiting for its response on a pipelined connection (the
+// tag sent with it is its index in the connection's table)
+typedef struct {
+	uint8_t      used;     // Flag indicating the slot holds a request
+	uint8_t      done;     // Flag indicating the response is in
+	CrudRequest  request;  // The request sent
+	void        *buf;      // Where the payload of the response goes
+	CrudBatchOp *ops;      // The requests of a batch (NULL if not a batch)
+	uint32_t     count;    // The number of requests in the batch
+	CrudResponse response; // The response, once done
+} CrudPending;
+
+// This is one connection of the pool, requests for an object always use the
+// same connection so they reach the server in the order they were made.
+// Without pipelining the mutex is held from request to response.  With it,
+// requests go out tagged under the send lock, a reader thread matches each
+// response back to its request by tag, and the mutex only guards the table.
+typedef struct {
+	int             socket;      // The connected socket (-1 if not connected)
+	pthread_mutex_t mutex;       // One request at a time, or the pending table when pipelined
+	pthread_mutex_t send;        // One frame on the wire at a time (pipelined)
+	pthread_cond_t  changed;     // Signalled as responses come in and slots free up
+	CrudPending     pending[CRUD_PIPELINE_MAX_WINDOW]; // The requests in flight
+	uint32_t        outstanding; // Slots in use
+	pthread_t       reader;      // Reads the responses (pipelined)
+	uint8_t         reading;     // Flag indicating the reader is running
+	uint8_t         joinable;    // Flag indicating the reader has not been joined
+	uint8_t         failed;      // Flag indicating the connection broke
+	char           *inbuf;       // Bytes read from the socket, not yet taken
+	uint32_t        inhead;      // Next byte to take from inbuf
+	uint32_t        intail;      // End of the bytes in inbuf
+} CrudConnection;
 
 // Global variables to store connection info
-int socket_fd;
-struct sockaddr_in caddr;
-int isConnect = 0;
+uint32_t       crud_network_connections = 1; // Connections in the pool
+uint32_t       crud_pipeline_window = 0; // Requests in flight per connection (0 = lock-step)
+CrudConnection crud_pool[CRUD_MAX_CONNECTIONS]; // The connection pool
+uint32_t       crud_pool_next = 0; // Connection for the next new object (updated atomically)
+pthread_once_t crud_pool_once = PTHREAD_ONCE_INIT; // Sets up the pool on first use
+pthread_mutex_t crud_pool_gate = PTHREAD_MUTEX_INITIALIZER; // Guards the two below
+pthread_cond_t crud_pool_gated = PTHREAD_COND_INITIALIZER; // Signalled as requests leave and the pool reopens
+uint32_t       crud_pool_active = 0; // Requests using the pool
+uint8_t        crud_pool_quiescing = 0; // Flag indicating INIT, FORMAT or CLOSE has the pool
 
 //
 // Functions
-void my_cruddy_send(CrudRequest req, char *buf);
-CrudResponse my_cruddy_receive(CrudResponse res, char *buf);
+void my_cruddy_pool_init(void);
+CrudConnection *my_cruddy_pick(CrudRequest req);
+int my_cruddy_management(CrudRequest req);
+void my_cruddy_enter(void);
+void my_cruddy_leave(void);
+void my_cruddy_quiesce(void);
+void my_cruddy_resume(void);
+int my_cruddy_connect(CrudConnection *conn);
+void my_cruddy_disconnect(CrudConnection *conn);
+int my_cruddy_pipelined(void);
+CrudResponse my_cruddy_exchange(CrudConnection *conn, CrudRequest op, uint32_t offset, void *buf);
+CrudResponse my_cruddy_shm_exchange(CrudRequest op, uint32_t offset, void *buf);
+int my_cruddy_shm_batch(CrudBatchOp *ops, uint32_t count);
+void my_cruddy_shm_release(void);
+int my_cruddy_post(CrudConnection *conn, CrudRequest op, uint32_t offset, void *buf, CrudBatchOp *ops, uint32_t count);
+CrudResponse my_cruddy_wait(CrudConnection *conn, int slot);
+void my_cruddy_drain(CrudConnection *conn);
+void *my_cruddy_reader(void *arg);
+int my_cruddy_send(CrudConnection *conn, CrudRequest req, uint32_t offset, char *buf, int32_t tag);
+CrudResponse my_cruddy_receive(CrudConnection *conn, CrudRequest res, char *buf);
+CrudResponse my_cruddy_receive_payload(CrudConnection *conn, CrudRequest req, CrudResponse netResp, char *buf);
+uint32_t my_cruddy_batch_fit(CrudBatchOp *ops, uint32_t count);
+int my_cruddy_batch_send(CrudConnection *conn, CrudBatchOp *ops, uint32_t count, int32_t tag);
+int my_cruddy_batch_receive(CrudConnection *conn, CrudBatchOp *ops, uint32_t count);
+int my_cruddy_read_all(CrudConnection *conn, char *buf, uint32_t length);
+int my_cruddy_write_vector(CrudConnection *conn, struct iovec *iov, int count);
+int my_cruddy_compressing(uint32_t length);
+CrudRequest my_cruddy_wire(CrudRequest req);
+CrudRequest my_cruddy_flag(CrudRequest req, uint8_t flag, int on);
 void extract_crud_request(CrudRequest crud, int *req, int *length);
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -44,65 +127,1107 @@ void extract_crud_request(CrudRequest crud, int *req, int *length);
 //                2) send any request to the server, returning results
 //                3) if CLOSE, will close the connection
 //
+//                INIT, FORMAT and CLOSE wait for every request using the pool
+//                to finish and are sent on the first connection, anything
+//                else goes on the connection for its object.  Over shared
+//                memory there is one "connection" and the requests go
+//                through the rings.
+//
 // Inputs       : op - the request opcode for the command
 //                buf - the block to be read/written from (READ/WRITE)
 // Outputs      : the response structure encoded as needed
 
 CrudResponse crud_client_operation(CrudRequest op, void *buf) {
-	// Check if already connected
-	if (isConnect != 1){
-		// Prepare for connections
-		socket_fd = socket(PF_INET, SOCK_STREAM, 0);
-		caddr.sin_family = AF_INET;
-		caddr.sin_port = htons(CRUD_DEFAULT_PORT);
-		inet_aton(CRUD_DEFAULT_IP, &caddr.sin_addr);
+	// Local variables for request info
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length, i;
+	uint8_t flags, res;
+	CrudConnection *conn;
+	CrudResponse read;
 
-		// Connect to server 
-		connect(socket_fd, (const struct sockaddr*)&caddr, sizeof(struct sockaddr));
-		isConnect = 1;
+	// Check if already connected, the connection is ours until the response is in
+	pthread_once(&crud_pool_once, my_cruddy_pool_init);
+	__atomic_add_fetch(&crud_transport_stats.operations, 1, __ATOMIC_RELAXED);
+	if (my_cruddy_management(op)) {
+		my_cruddy_quiesce();
+		conn = &crud_pool[0];
+	} else {
+		my_cruddy_enter();
+		conn = my_cruddy_pick(op);
+	}
+	pthread_mutex_lock(&conn->mutex);
+
+	// Ask for the protocol extensions when initializing (the length stays zero so
+	// an older server just echoes the request back)
+	deconstruct_crud_request(op, &oid, &request, &length, &flags, &res);
+	if (request == CRUD_INIT) {
+		op = construct_crud_request(oid, request, 0, flags|CRUD_NEGOTIATE, res);
 	}
 
 	// Send request to server
-	my_cruddy_send(op, (char*)buf);
-	CrudResponse read = my_cruddy_receive(op, (char*)buf);
+	read = my_cruddy_exchange(conn, op, 0, buf);
 
+	// Keep the granted extensions we want (compression only if turned on, and neither
+	// it nor tagging over shared memory, where the rings do that job), hide the
+	// negotiation from the caller
+	if (request == CRUD_INIT) {
+		deconstruct_crud_request(read, &oid, &request, &length, &flags, &res);
+		crud_server_capabilities = 0;
+		if ((res == 0) && (length & CRUD_CAP_ACK)) {
+			crud_server_capabilities = length & ((crud_network_shm != NULL) ?
+				(CRUD_CLIENT_CAPABILITIES & ~(CRUD_CAP_COMPRESS|CRUD_CAP_PIPELINE)) : (crud_compress_threshold == 0) ?
+				(CRUD_CLIENT_CAPABILITIES & ~CRUD_CAP_COMPRESS) : CRUD_CLIENT_CAPABILITIES);
+		}
+		logMessage(LOG_INFO_LEVEL, "CRUD server granted extensions [%x]", crud_server_capabilities);
+		read = construct_crud_request(oid, request, 0, flags & ~CRUD_NEGOTIATE, res);
+	}
+
+	// The server is done with us after a close, drop the rest of the pool too
+	// (one connection held at a time)
+	pthread_mutex_unlock(&conn->mutex);
+	if (my_cruddy_management(op)) {
+		for (i=0; (request == CRUD_CLOSE) && (i<crud_network_connections); i++) {
+			pthread_mutex_lock(&crud_pool[i].mutex);
+			my_cruddy_disconnect(&crud_pool[i]);
+			pthread_mutex_unlock(&crud_pool[i].mutex);
+		}
+		if (request == CRUD_CLOSE) {
+			my_cruddy_shm_release();
+		}
+		my_cruddy_resume();
+	} else {
+		my_cruddy_leave();
+	}
 	return read;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_read_range
+// Description  : Read part of an object from the CRUD server.  The request
+//                header is followed on the wire by the starting offset, and
+//                only the bytes asked for come back.
+//
+// Inputs       : op - the CRUD_READ_RANGE request (length is bytes wanted)
+//                offset - the offset in the object to start reading at
+//                buf - the buffer to place the bytes into
+// Outputs      : the response (length is the number of bytes returned)
+
+CrudResponse crud_client_read_range(CrudRequest op, uint32_t offset, void *buf) {
+	CrudConnection *conn;
+	CrudResponse read;
+
+	// Send the request and offset together, then get the bytes back
+	pthread_once(&crud_pool_once, my_cruddy_pool_init);
+	__atomic_add_fetch(&crud_transport_stats.operations, 1, __ATOMIC_RELAXED);
+	my_cruddy_enter();
+	conn = my_cruddy_pick(op);
+	pthread_mutex_lock(&conn->mutex);
+	read = my_cruddy_exchange(conn, op, offset, buf);
+	pthread_mutex_unlock(&conn->mutex);
+	my_cruddy_leave();
+	return read;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_write_range
+// Description  : Write part of an object on the CRUD server.  The request
+//                header is followed on the wire by the starting offset and
+//                then the bytes, all sent in one write.
+//
+// Inputs       : op - the CRUD_WRITE_RANGE request (length is bytes sent)
+//                offset - the offset in the object to start writing at
+//                buf - the bytes to write
+// Outputs      : the response (length is the number of bytes written)
+
+CrudResponse crud_client_write_range(CrudRequest op, uint32_t offset, void *buf) {
+	CrudConnection *conn;
+	CrudResponse read;
+
+	// Send the request, offset and bytes, then get the response
+	pthread_once(&crud_pool_once, my_cruddy_pool_init);
+	__atomic_add_fetch(&crud_transport_stats.operations, 1, __ATOMIC_RELAXED);
+	my_cruddy_enter();
+	conn = my_cruddy_pick(op);
+	pthread_mutex_lock(&conn->mutex);
+	read = my_cruddy_exchange(conn, op, offset, buf);
+	pthread_mutex_unlock(&conn->mutex);
+	my_cruddy_leave();
+	return read;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_batch
+// Description  : Send a list of requests to the CRUD server as CRUD_BATCHes,
+//                then collect every response.  The requests are split by
+//                the connection for their object, and a batch is sent on
+//                each connection before any response is read, so the server
+//                can work on them in parallel.  If the server did not grant
+//                batching the requests are sent one at a time.
+//
+// Inputs       : ops - the requests (responses filled in on return)
+//                count - the number of requests
+// Outputs      : 0 if the responses were collected, -1 if failure
+
+int crud_client_batch(CrudBatchOp *ops, uint32_t count) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length, first[CRUD_MAX_CONNECTIONS], left[CRUD_MAX_CONNECTIONS], i, c;
+	int32_t sent[CRUD_MAX_CONNECTIONS], slot[CRUD_MAX_CONNECTIONS];
+	uint8_t flags, res, held[CRUD_MAX_CONNECTIONS];
+	int pipelined;
+	CrudBatchOp *sorted;
+	uint32_t *from;
+	int ret = 0;
+
+	// Over shared memory the rings carry the whole list, no CRUD_BATCH needed
+	if (crud_network_shm != NULL) {
+		pthread_once(&crud_pool_once, my_cruddy_pool_init);
+		__atomic_add_fetch(&crud_transport_stats.operations, count, __ATOMIC_RELAXED);
+		my_cruddy_enter();
+		pthread_mutex_lock(&crud_pool[0].mutex);
+		ret = my_cruddy_shm_batch(ops, count);
+		pthread_mutex_unlock(&crud_pool[0].mutex);
+		my_cruddy_leave();
+		return(ret);
+	}
+
+	// Without the extension, just send them in turn
+	if (!(crud_server_capabilities & CRUD_CAP_BATCH)) {
+		for (i=0; i<count; i++) {
+			deconstruct_crud_request(ops[i].request, &oid, &request, &length, &flags, &res);
+			ops[i].response = (request == CRUD_READ_RANGE) ?
+					crud_client_read_range(ops[i].request, ops[i].offset, ops[i].buf) :
+					(request == CRUD_WRITE_RANGE) ?
+					crud_client_write_range(ops[i].request, ops[i].offset, ops[i].buf) :
+					crud_client_operation(ops[i].request, ops[i].buf);
+		}
+		return(0);
+	}
+
+	// Group the requests by connection, keeping their order within each
+	pthread_once(&crud_pool_once, my_cruddy_pool_init);
+	__atomic_add_fetch(&crud_transport_stats.operations, count, __ATOMIC_RELAXED);
+	sorted = malloc(count*sizeof(CrudBatchOp));
+	from = malloc(2*count*sizeof(uint32_t));
+	if ((sorted == NULL) || (from == NULL)) {
+		free(sorted);
+		free(from);
+		for (i=0; i<count; i++) {
+			ops[i].response = ops[i].request | 1;
+		}
+		return(-1);
+	}
+	memset(left, 0x0, sizeof(left));
+	for (i=0; i<count; i++) {
+		from[count+i] = my_cruddy_pick(ops[i].request) - crud_pool;
+		left[from[count+i]]++;
+	}
+	for (c=0, length=0; c<crud_network_connections; length+=left[c], c++) {
+		first[c] = length;
+	}
+	for (i=0; i<count; i++) {
+		c = from[count+i];
+		from[first[c]] = i;
+		sorted[first[c]] = ops[i];
+		sorted[first[c]].response = ops[i].request | 1;
+		first[c]++;
+	}
+	for (c=0; c<crud_network_connections; c++) {
+		first[c] -= left[c];
+	}
+
+	// Send the next batch on every connection with requests left, then collect the responses.
+	// Lock-step, the connections are held in pool order until done.  Pipelined, one is held
+	// at a time (posting and waiting let go of it, so holding others would invert the order).
+	my_cruddy_enter();
+	pipelined = my_cruddy_pipelined();
+	for (c=0; c<crud_network_connections; c++) {
+		if ((held[c] = ((left[c] > 0) && !pipelined))) {
+			pthread_mutex_lock(&crud_pool[c].mutex);
+		}
+	}
+	while (ret == 0) {
+		for (c=0, length=0; c<crud_network_connections; c++) {
+			sent[c] = 0;
+			if (left[c] == 0) {
+				continue;
+			}
+			sent[c] = my_cruddy_batch_fit(&sorted[first[c]], left[c]);
+			if (pipelined) {
+				pthread_mutex_lock(&crud_pool[c].mutex);
+			}
+			if (my_cruddy_connect(&crud_pool[c])) {
+				sent[c] = 0;
+				ret = -1;
+			} else if (pipelined) {
+				slot[c] = my_cruddy_post(&crud_pool[c], 0, 0, NULL, &sorted[first[c]], sent[c]);
+				sent[c] = (slot[c] < 0) ? 0 : sent[c];
+				ret = (slot[c] < 0) ? -1 : ret;
+			} else if (my_cruddy_batch_send(&crud_pool[c], &sorted[first[c]], sent[c], -1)) {
+				sent[c] = 0;
+				ret = -1;
+			}
+			if (pipelined) {
+				pthread_mutex_unlock(&crud_pool[c].mutex);
+			}
+			length += sent[c];
+		}
+		for (c=0; c<crud_network_connections; c++) {
+			if (sent[c] > 0) {
+				if (pipelined) {
+					pthread_mutex_lock(&crud_pool[c].mutex);
+				}
+				if (pipelined ? (my_cruddy_wait(&crud_pool[c], slot[c]) & 1) :
+						my_cruddy_batch_receive(&crud_pool[c], &sorted[first[c]], sent[c])) {
+					ret = -1;
+				}
+				if (pipelined) {
+					pthread_mutex_unlock(&crud_pool[c].mutex);
+				}
+			}
+			first[c] += sent[c];
+			left[c] -= sent[c];
+		}
+		if (length == 0) {
+			break;
+		}
+	}
+	for (c=crud_network_connections; c>0; c--) {
+		if (held[c-1]) {
+			pthread_mutex_unlock(&crud_pool[c-1].mutex);
+		}
+	}
+	my_cruddy_leave();
+
+	// Hand the responses back in the caller's order (anything not sent failed)
+	for (i=0; i<count; i++) {
+		ops[from[i]].response = sorted[i].response;
+	}
+	free(sorted);
+	free(from);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_client_log_stats
+// Description  : Log the syscalls and bytes the transport has used
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_client_log_stats(void) {
+	CrudTransportStats stats;
+
+	stats.operations = __atomic_load_n(&crud_transport_stats.operations, __ATOMIC_RELAXED);
+	stats.writes = __atomic_load_n(&crud_transport_stats.writes, __ATOMIC_RELAXED);
+	stats.reads = __atomic_load_n(&crud_transport_stats.reads, __ATOMIC_RELAXED);
+	stats.sent = __atomic_load_n(&crud_transport_stats.sent, __ATOMIC_RELAXED);
+	stats.received = __atomic_load_n(&crud_transport_stats.received, __ATOMIC_RELAXED);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD transport : %llu operations, %llu writes, %llu reads "
+			"(%.2f syscalls per operation), %llu bytes sent, %llu bytes received",
+			(unsigned long long)stats.operations, (unsigned long long)stats.writes,
+			(unsigned long long)stats.reads,
+			(stats.operations == 0) ? 0.0 : (double)(stats.writes + stats.reads) / stats.operations,
+			(unsigned long long)stats.sent, (unsigned long long)stats.received);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_exchange
+// Description	: Send a request on a connection and wait for its response,
+// 		  lock-step or pipelined as negotiated
+//
+// Inputs	: conn - the connection (its mutex held by the caller)
+// 		  op - the CrudRequest
+// 		  offset - the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+// 		  buf - the bytes to send, or the buffer to read into
+// Outputs	: the response
+
+CrudResponse my_cruddy_exchange(CrudConnection *conn, CrudRequest op, uint32_t offset, void *buf) {
+	int slot;
+
+	// Over shared memory the request goes through the rings instead
+	if (crud_network_shm != NULL) {
+		return(my_cruddy_shm_exchange(op, offset, buf));
+	}
+	if (my_cruddy_connect(conn)) {
+		return(op | 1);
+	}
+
+	// Pipelined, the reader thread hands the response back
+	if (my_cruddy_pipelined() && !my_cruddy_management(op)) {
+		if ((slot = my_cruddy_post(conn, op, offset, buf, NULL, 0)) < 0) {
+			return(op | 1);
+		}
+		return(my_cruddy_wait(conn, slot));
+	}
+
+	// Lock-step, nothing else is on the connection until the response is in
+	if (my_cruddy_management(op) || conn->reading || conn->joinable) {
+		my_cruddy_drain(conn);
+	}
+	__atomic_add_fetch(&crud_client_requests, 1, __ATOMIC_RELAXED);
+	if (my_cruddy_send(conn, op, offset, (char*)buf, -1)) {
+		conn->failed = 1;
+		return(op | 1);
+	}
+	return(my_cruddy_receive(conn, op, (char*)buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_shm_exchange
+// Description	: Send a request through the shared memory rings and wait for
+// 		  its response
+//
+// Inputs	: op - the CrudRequest
+// 		  offset - the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+// 		  buf - the bytes to send, or the buffer to read into
+// Outputs	: the response
+
+CrudResponse my_cruddy_shm_exchange(CrudRequest op, uint32_t offset, void *buf) {
+	CrudBatchOp one;
+
+	one.request = op;
+	one.offset = offset;
+	one.buf = buf;
+	my_cruddy_shm_batch(&one, 1);
+	return(one.response);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_shm_batch
+// Description	: Send requests through the shared memory rings, as many at
+// 		  a time as the ring and arena hold, then collect the responses
+// 		  in order.  The bytes going out are copied into the arena
+// 		  (the server copies them on into its store) and those coming
+// 		  back are copied out of it.  If the rings get out of step (a
+// 		  push fails or a response does not come) the region is given
+// 		  up, the next claim has the server empty the rings so nothing
+// 		  left in them is taken for the answer to a later request.
+//
+// Inputs	: ops - the requests (responses filled in on return)
+// 		  count - the number of requests
+// Outputs	: 0 if the responses were collected, -1 if failure
+
+int my_cruddy_shm_batch(CrudBatchOp *ops, uint32_t count) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request, respRequest;
+	uint32_t length, respLength, span, used, posted, done, i;
+	uint8_t flags, res;
+	CrudShmEntry entry;
+
+	// Claim the region on first use (anything not answered fails)
+	for (i=0; i<count; i++) {
+		ops[i].response = ops[i].request | 1;
+	}
+	if ((crud_shm_region == NULL) && ((crud_shm_region = crud_shm_attach(crud_network_shm)) == NULL)) {
+		return(-1);
+	}
+
+	for (done=0; done<count; done+=posted) {
+		// Post what fits, the rings are empty between rounds so a push should not fail
+		for (posted=0, used=0; (done+posted<count) && (posted<CRUD_SHM_RING_SLOTS); posted++) {
+			span = crud_shm_span(ops[done+posted].request);
+			if ((posted > 0) && (used + span > CRUD_SHM_ARENA_SIZE)) {
+				break;
+			}
+			deconstruct_crud_request(ops[done+posted].request, &oid, &request, &length, &flags, &res);
+			if (request == CRUD_CREATE || request == CRUD_UPDATE || request == CRUD_WRITE_RANGE) {
+				memcpy(&crud_shm_region->arena[used], ops[done+posted].buf, length);
+			}
+			entry.request = ops[done+posted].request;
+			entry.offset = ops[done+posted].offset;
+			entry.data = used;
+			if (crud_shm_push(&crud_shm_region->requests, &entry)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD client : request ring full on shared memory [%s].", crud_network_shm);
+				my_cruddy_shm_release();
+				return(-1);
+			}
+			used += span;
+		}
+		__atomic_add_fetch(&crud_client_requests, 1, __ATOMIC_RELAXED);
+
+		// Collect the responses, taking the bytes of a read out of the arena
+		for (i=0; i<posted; i++) {
+			if (crud_shm_pop(&crud_shm_region->responses, &entry, CRUD_SHM_TIMEOUT)) {
+				// The rings are out of step now, give the region up
+				logMessage(LOG_ERROR_LEVEL, "CRUD client : no response on shared memory [%s].", crud_network_shm);
+				my_cruddy_shm_release();
+				return(-1);
+			}
+			ops[done+i].response = entry.request;
+			deconstruct_crud_request(ops[done+i].request, &oid, &request, &length, &flags, &res);
+			deconstruct_crud_request(entry.request, &oid, &respRequest, &respLength, &flags, &res);
+			if ((request == CRUD_READ || request == CRUD_READ_RANGE) && (res == 0) && (respLength <= length)) {
+				memcpy(ops[done+i].buf, &crud_shm_region->arena[entry.data], respLength);
+			}
+		}
+	}
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_shm_release
+// Description	: Give up the claim on the shared memory region, if held.  Run
+// 		  at exit too, so a client that never sends CRUD_CLOSE (e.g.,
+// 		  after an extraction) does not keep others out.
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_shm_release(void) {
+	if (crud_shm_region != NULL) {
+		crud_shm_detach(crud_shm_region);
+		crud_shm_region = NULL;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_post
+// Description	: Send a request (or a batch) tagged with a free slot of the
+// 		  pending table, waiting for one if the window is full.  The
+// 		  reader thread is started with the first request.
+//
+// Inputs	: conn - the connection (its mutex held by the caller)
+// 		  op - the CrudRequest (ignored for a batch)
+// 		  offset - the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+// 		  buf - the bytes to send, or the buffer to read into
+// 		  ops - the requests of a batch (NULL if not a batch)
+// 		  count - the number of requests in the batch
+// Outputs	: the slot to wait on, -1 if failure
+
+int my_cruddy_post(CrudConnection *conn, CrudRequest op, uint32_t offset, void *buf, CrudBatchOp *ops, uint32_t count) {
+	uint32_t window = crud_pipeline_window;
+	int slot, ret;
+
+	// Start the reader, then wait for room in the window
+	if (!conn->reading && !conn->failed) {
+		if (pthread_create(&conn->reader, NULL, my_cruddy_reader, conn) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : failed to start response reader.");
+			return(-1);
+		}
+		conn->reading = conn->joinable = 1;
+	}
+	while (conn->reading && (conn->outstanding >= window)) {
+		pthread_cond_wait(&conn->changed, &conn->mutex);
+	}
+	if (!conn->reading) {
+		return(-1);
+	}
+	for (slot=0; conn->pending[slot].used; slot++);
+	memset(&conn->pending[slot], 0x0, sizeof(CrudPending));
+	conn->pending[slot].used = 1;
+	conn->pending[slot].request = (ops == NULL) ? op : construct_crud_request(0, CRUD_BATCH, count, 0, 0);
+	conn->pending[slot].buf = buf;
+	conn->pending[slot].ops = ops;
+	conn->pending[slot].count = count;
+	conn->outstanding++;
+
+	// Send it, leaving the table to the reader while the bytes go out
+	pthread_mutex_unlock(&conn->mutex);
+	pthread_mutex_lock(&conn->send);
+	__atomic_add_fetch(&crud_client_requests, 1, __ATOMIC_RELAXED);
+	ret = (ops == NULL) ? my_cruddy_send(conn, op, offset, (char*)buf, slot) :
+			my_cruddy_batch_send(conn, ops, count, slot);
+	if (ret) {
+		// Stop the reader, which fails everything in flight
+		shutdown(conn->socket, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&conn->send);
+	pthread_mutex_lock(&conn->mutex);
+	return(slot);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_wait
+// Description	: Wait for the response to a posted request, freeing its slot
+//
+// Inputs	: conn - the connection (its mutex held by the caller)
+// 		  slot - the slot the request was posted in
+// Outputs	: the response
+
+CrudResponse my_cruddy_wait(CrudConnection *conn, int slot) {
+	CrudResponse response;
+
+	while (!conn->pending[slot].done) {
+		pthread_cond_wait(&conn->changed, &conn->mutex);
+	}
+	response = conn->pending[slot].response;
+	conn->pending[slot].used = 0;
+	conn->outstanding--;
+	pthread_cond_broadcast(&conn->changed);
+	return(response);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_drain
+// Description	: Wait for every request in flight on a connection, then stop
+// 		  its reader so the next request can go lock-step
+//
+// Inputs	: conn - the connection (its mutex held by the caller)
+// Outputs	: none
+
+void my_cruddy_drain(CrudConnection *conn) {
+	while (conn->outstanding > 0) {
+		pthread_cond_wait(&conn->changed, &conn->mutex);
+	}
+	if (conn->reading || conn->joinable) {
+		my_cruddy_disconnect(conn);
+		my_cruddy_connect(conn);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_reader
+// Description	: Read the responses on a pipelined connection, handing each to
+// 		  the request with its tag, until the connection closes
+//
+// Inputs	: arg - the connection
+// Outputs	: NULL
+
+void *my_cruddy_reader(void *arg) {
+	CrudConnection *conn = arg;
+	char header[CRUD_NET_HEADER_SIZE + CRUD_TAG_SIZE];
+	CrudResponse netResp, response;
+	CrudPending *pending;
+	uint32_t tag, i;
+
+	while (my_cruddy_read_all(conn, header, sizeof(header)) == 0) {
+		memcpy(&netResp, header, CRUD_NET_HEADER_SIZE);
+		memcpy(&tag, &header[CRUD_NET_HEADER_SIZE], CRUD_TAG_SIZE);
+		netResp = ntohll64(netResp);
+		tag = ntohl(tag);
+
+		// Find the request, it stays put while its owner waits
+		pthread_mutex_lock(&conn->mutex);
+		pending = ((tag < CRUD_PIPELINE_MAX_WINDOW) && conn->pending[tag].used && !conn->pending[tag].done) ?
+				&conn->pending[tag] : NULL;
+		pthread_mutex_unlock(&conn->mutex);
+		if (pending == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : response for unknown tag %u.", tag);
+			break;
+		}
+
+		// Take the payload (or the responses of a batch) straight into the caller's buffers
+		response = my_cruddy_flag(netResp, CRUD_TAGGED, 0);
+		if (pending->ops != NULL) {
+			if (!(response & 1) && my_cruddy_batch_receive(conn, pending->ops, pending->count)) {
+				response |= 1;
+			}
+		} else {
+			response = my_cruddy_receive_payload(conn, pending->request, response, (char*)pending->buf);
+		}
+		pthread_mutex_lock(&conn->mutex);
+		pending->response = response;
+		pending->done = 1;
+		pthread_cond_broadcast(&conn->changed);
+		pthread_mutex_unlock(&conn->mutex);
+		if (conn->failed) {
+			break;
+		}
+	}
+
+	// The connection is gone, fail whatever is still in flight
+	pthread_mutex_lock(&conn->mutex);
+	conn->failed = 1;
+	for (tag=0; tag<CRUD_PIPELINE_MAX_WINDOW; tag++) {
+		if (conn->pending[tag].used && !conn->pending[tag].done) {
+			for (i=0; (conn->pending[tag].ops != NULL) && (i<conn->pending[tag].count); i++) {
+				conn->pending[tag].ops[i].response = conn->pending[tag].ops[i].request | 1;
+			}
+			conn->pending[tag].response = conn->pending[tag].request | 1;
+			conn->pending[tag].done = 1;
+		}
+	}
+	conn->reading = 0;
+	pthread_cond_broadcast(&conn->changed);
+	pthread_mutex_unlock(&conn->mutex);
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_batch_fit
+// Description	: Count the requests that fit in one CRUD_BATCH
+//
+// Inputs	: ops - the requests
+// 		  count - the number of requests (at least one)
+// Outputs	: the number of requests that fit (always at least one)
+
+uint32_t my_cruddy_batch_fit(CrudBatchOp *ops, uint32_t count) {
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length, size, more, n;
+	uint8_t flags, res;
+
+	size = CRUD_NET_HEADER_SIZE + CRUD_TAG_SIZE;
+	for (n=0; (n<count) && (n<CRUD_BATCH_MAX_OPS); n++) {
+		deconstruct_crud_request(ops[n].request, &oid, &request, &length, &flags, &res);
+		more = CRUD_NET_HEADER_SIZE + ((request == CRUD_CREATE || request == CRUD_UPDATE) ?
+				length + CRUD_COMPRESS_SIZE_HEADER : (request == CRUD_READ_RANGE) ? CRUD_RANGE_HEADER_SIZE :
+				(request == CRUD_WRITE_RANGE) ? CRUD_RANGE_HEADER_SIZE + length : 0);
+		if ((n > 0) && (size + more > CRUD_BATCH_MAX_BYTES)) {
+			break;
+		}
+		size += more;
+	}
+	return(n);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_batch_send
+// Description	: Frame requests as one CRUD_BATCH and send it
+//
+// Inputs	: conn - the connection (held by the caller)
+// 		  ops - the requests
+// 		  count - the number of requests (as counted by my_cruddy_batch_fit)
+// 		  tag - the tag to send with the batch (-1 for none)
+// Outputs	: 0 if successful, -1 if failure
+
+int my_cruddy_batch_send(CrudConnection *conn, CrudBatchOp *ops, uint32_t count, int32_t tag) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length, size, used, packed, netSize, netTag, i;
+	uint8_t flags, res;
+	CrudRequest netReq;
+	uint32_t netOffset;
+	struct iovec iov;
+	char *frame;
+	int ret;
+
+	// Size the frame for the requests and what follows them
+	size = CRUD_NET_HEADER_SIZE + CRUD_TAG_SIZE;
+	for (i=0; i<count; i++) {
+		deconstruct_crud_request(ops[i].request, &oid, &request, &length, &flags, &res);
+		size += CRUD_NET_HEADER_SIZE + ((request == CRUD_CREATE || request == CRUD_UPDATE) ?
+				length + CRUD_COMPRESS_SIZE_HEADER : (request == CRUD_READ_RANGE) ? CRUD_RANGE_HEADER_SIZE :
+				(request == CRUD_WRITE_RANGE) ? CRUD_RANGE_HEADER_SIZE + length : 0);
+	}
+
+	// Frame the batch header (and tag), then each request with what follows it
+	if ((frame = crud_buffer_alloc(size)) == NULL) {
+		return(-1);
+	}
+	netReq = htonll64(construct_crud_request(0, CRUD_BATCH, count, (tag < 0) ? 0 : CRUD_TAGGED, 0));
+	memcpy(frame, &netReq, CRUD_NET_HEADER_SIZE);
+	used = CRUD_NET_HEADER_SIZE;
+	if (tag >= 0) {
+		netTag = htonl(tag);
+		memcpy(&frame[used], &netTag, CRUD_TAG_SIZE);
+		used += CRUD_TAG_SIZE;
+	}
+	for (i=0; i<count; i++) {
+		deconstruct_crud_request(ops[i].request, &oid, &request, &length, &flags, &res);
+		packed = 0;
+		if ((request == CRUD_CREATE || request == CRUD_UPDATE) && my_cruddy_compressing(length)) {
+			packed = crud_compress(ops[i].buf, length,
+					(uint8_t *)&frame[used + CRUD_NET_HEADER_SIZE + CRUD_COMPRESS_SIZE_HEADER], length - 1);
+		}
+		netReq = htonll64((packed > 0) ? my_cruddy_flag(ops[i].request, CRUD_COMPRESSED, 1) :
+				my_cruddy_wire(ops[i].request));
+		memcpy(&frame[used], &netReq, CRUD_NET_HEADER_SIZE);
+		used += CRUD_NET_HEADER_SIZE;
+		if (packed > 0) {
+			netSize = htonl(packed);
+			memcpy(&frame[used], &netSize, CRUD_COMPRESS_SIZE_HEADER);
+			used += CRUD_COMPRESS_SIZE_HEADER + packed;
+		} else if (request == CRUD_CREATE || request == CRUD_UPDATE) {
+			memcpy(&frame[used], ops[i].buf, length);
+			used += length;
+		} else if (request == CRUD_READ_RANGE || request == CRUD_WRITE_RANGE) {
+			netOffset = htonl(ops[i].offset);
+			memcpy(&frame[used], &netOffset, CRUD_RANGE_HEADER_SIZE);
+			used += CRUD_RANGE_HEADER_SIZE;
+			if (request == CRUD_WRITE_RANGE) {
+				memcpy(&frame[used], ops[i].buf, length);
+				used += length;
+			}
+		}
+	}
+
+	// Send it all (compressed payloads leave it short of the size)
+	if (tag < 0) {
+		__atomic_add_fetch(&crud_client_requests, 1, __ATOMIC_RELAXED);
+	}
+	iov.iov_base = frame;
+	iov.iov_len = used;
+	ret = my_cruddy_write_vector(conn, &iov, 1);
+	crud_buffer_free(frame);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_batch_receive
+// Description	: Collect the responses to a CRUD_BATCH sent on a connection
+// 		  (after the batch response itself, when pipelined)
+//
+// Inputs	: conn - the connection (held by the caller, or its reader)
+// 		  ops - the requests sent (responses filled in)
+// 		  count - the number of requests in the batch
+// Outputs	: 0 if successful, -1 if the batch failed
+
+int my_cruddy_batch_receive(CrudConnection *conn, CrudBatchOp *ops, uint32_t count) {
+	CrudResponse read;
+	uint32_t i;
+
+	// The batch response comes first (the reader has already taken it), then one for each request
+	if (!conn->reading) {
+		read = my_cruddy_receive(conn, construct_crud_request(0, CRUD_BATCH, 0, 0, 0), NULL);
+		if (read & 1) {
+			return(-1);
+		}
+	}
+	for (i=0; i<count; i++) {
+		ops[i].response = my_cruddy_receive(conn, ops[i].request, (char*)ops[i].buf);
+	}
+	return(conn->failed ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_pool_init
+// Description	: Set up the connection pool (once, before first use)
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_pool_init(void){
+	uint32_t i;
+
+	if ((crud_network_connections == 0) || (crud_network_connections > CRUD_MAX_CONNECTIONS)) {
+		crud_network_connections = (crud_network_connections == 0) ? 1 : CRUD_MAX_CONNECTIONS;
+	}
+	if (crud_pipeline_window > CRUD_PIPELINE_MAX_WINDOW) {
+		crud_pipeline_window = CRUD_PIPELINE_MAX_WINDOW;
+	}
+	if (crud_network_shm != NULL) {
+		// The rings have one producer each way, so one "connection" (the rings pipeline batches),
+		// and the claim on the region is let go at exit whether or not it is closed
+		crud_network_connections = 1;
+		crud_pipeline_window = 0;
+		atexit(my_cruddy_shm_release);
+	}
+	for (i=0; i<CRUD_MAX_CONNECTIONS; i++) {
+		memset(&crud_pool[i], 0x0, sizeof(CrudConnection));
+		crud_pool[i].socket = -1;
+		pthread_mutex_init(&crud_pool[i].mutex, NULL);
+		pthread_mutex_init(&crud_pool[i].send, NULL);
+		pthread_cond_init(&crud_pool[i].changed, NULL);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_pipelined
+// Description	: Check if requests go out tagged, many to a connection
+//
+// Inputs	: none
+// Outputs	: 1 if they do, 0 if each waits for its response
+
+int my_cruddy_pipelined(void){
+	return (crud_pipeline_window > 0) && (crud_server_capabilities & CRUD_CAP_PIPELINE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_pick
+// Description	: Choose the connection a request goes on.  Requests for an
+// 		  object always use the same one, new objects are spread
+// 		  round robin and the priority object uses the first.
+//
+// Inputs	: req - the CrudRequest
+// Outputs	: the connection
+
+CrudConnection *my_cruddy_pick(CrudRequest req){
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length;
+	uint8_t flags, res;
+
+	deconstruct_crud_request(req, &oid, &request, &length, &flags, &res);
+	if ((crud_network_connections == 1) || (flags & CRUD_PRIORITY_OBJECT)) {
+		return &crud_pool[0];
+	}
+	if (oid == CRUD_NO_OBJECT) {
+		return &crud_pool[__atomic_fetch_add(&crud_pool_next, 1, __ATOMIC_RELAXED) % crud_network_connections];
+	}
+	return &crud_pool[oid % crud_network_connections];
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_management
+// Description	: Check if a request acts on the whole store (INIT, FORMAT, CLOSE)
+//
+// Inputs	: req - the CrudRequest
+// Outputs	: 1 if it does, 0 if not
+
+int my_cruddy_management(CrudRequest req){
+	int request, length;
+
+	extract_crud_request(req, &request, &length);
+	return (request == CRUD_INIT) || (request == CRUD_FORMAT) || (request == CRUD_CLOSE);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_enter
+// Description	: Start a request on the pool, waiting out any INIT, FORMAT or
+// 		  CLOSE that has it
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_enter(void){
+	pthread_mutex_lock(&crud_pool_gate);
+	while (crud_pool_quiescing) {
+		pthread_cond_wait(&crud_pool_gated, &crud_pool_gate);
+	}
+	crud_pool_active++;
+	pthread_mutex_unlock(&crud_pool_gate);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_leave
+// Description	: Finish a request started with my_cruddy_enter
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_leave(void){
+	pthread_mutex_lock(&crud_pool_gate);
+	if (--crud_pool_active == 0) {
+		pthread_cond_broadcast(&crud_pool_gated);
+	}
+	pthread_mutex_unlock(&crud_pool_gate);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_quiesce
+// Description	: Hold new requests back and wait for those using the pool to
+// 		  finish, so INIT, FORMAT and CLOSE can stop readers and
+// 		  reconnect without anyone else touching a connection.  No
+// 		  connection is held while waiting.
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_quiesce(void){
+	pthread_mutex_lock(&crud_pool_gate);
+	while (crud_pool_quiescing) {
+		pthread_cond_wait(&crud_pool_gated, &crud_pool_gate);
+	}
+	crud_pool_quiescing = 1;
+	while (crud_pool_active > 0) {
+		pthread_cond_wait(&crud_pool_gated, &crud_pool_gate);
+	}
+	pthread_mutex_unlock(&crud_pool_gate);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_resume
+// Description	: Let requests use the pool again after my_cruddy_quiesce
+//
+// Inputs	: none
+// Outputs	: none
+
+void my_cruddy_resume(void){
+	pthread_mutex_lock(&crud_pool_gate);
+	crud_pool_quiescing = 0;
+	pthread_cond_broadcast(&crud_pool_gated);
+	pthread_mutex_unlock(&crud_pool_gate);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_connect
+// Description	: Connect to the server (on the unix domain socket at -U, else
+// 		  at -a/-p or the defaults) if there is no connection yet, or
+// 		  the one there was broke
+//
+// Inputs	: conn - the connection (held by the caller)
+// Outputs	: 0 if connected, -1 if failure
+
+int my_cruddy_connect(CrudConnection *conn){
+	struct sockaddr_in caddr;
+	struct sockaddr_un uaddr;
+	struct sockaddr *addr = (struct sockaddr *)&caddr;
+	socklen_t addrlen = sizeof(caddr);
+	int optval = 1;
+	const char *ip = (crud_network_address == NULL) ? CRUD_DEFAULT_IP : (const char *)crud_network_address;
+
+	// Check if already connected
+	if (conn->failed) {
+		my_cruddy_disconnect(conn);
+	}
+	if (conn->socket != -1) {
+		return 0;
+	}
+
+	// Prepare for connections (a co-located server skips the TCP stack)
+	memset(&caddr, 0x0, sizeof(caddr));
+	memset(&uaddr, 0x0, sizeof(uaddr));
+	if (crud_network_path != NULL) {
+		if (strlen(crud_network_path) >= sizeof(uaddr.sun_path)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : socket path too long [%s].", crud_network_path);
+			return -1;
+		}
+		uaddr.sun_family = AF_UNIX;
+		strcpy(uaddr.sun_path, crud_network_path);
+		addr = (struct sockaddr *)&uaddr;
+		addrlen = sizeof(uaddr);
+	} else {
+		caddr.sin_family = AF_INET;
+		caddr.sin_port = htons((crud_network_port == 0) ? CRUD_DEFAULT_PORT : crud_network_port);
+		if (inet_aton(ip, &caddr.sin_addr) == 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : bad server address [%s].", ip);
+			return -1;
+		}
+	}
+
+	// Responses are read into the connection's buffer, many at a time
+	if ((conn->inbuf == NULL) && ((conn->inbuf = malloc(CRUD_RECEIVE_BUFFER_SIZE)) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD client : failed to allocate receive buffer.");
+		return -1;
+	}
+	conn->inhead = conn->intail = 0;
+
+	// Connect to server (small requests go out at once, not held for an ACK)
+	if ((conn->socket = socket(addr->sa_family, SOCK_STREAM, 0)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD client : socket() failed [%s].", strerror(errno));
+		return -1;
+	}
+	if (connect(conn->socket, addr, addrlen) == -1) {
+		if (crud_network_path != NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : connect to %s failed [%s].", crud_network_path,
+					strerror(errno));
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : connect to %s:%d failed [%s].", ip,
+					ntohs(caddr.sin_port), strerror(errno));
+		}
+		close(conn->socket);
+		conn->socket = -1;
+		return -1;
+	}
+	if (crud_network_path == NULL) {
+		setsockopt(conn->socket, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_disconnect
+// Description	: Close a connection, stopping its reader (it is reopened on
+// 		  next use)
+//
+// Inputs	: conn - the connection (held by the caller)
+// Outputs	: none
+
+void my_cruddy_disconnect(CrudConnection *conn){
+	if (conn->socket != -1) {
+		if (conn->reading) {
+			shutdown(conn->socket, SHUT_RDWR);
+			while (conn->reading) {
+				pthread_cond_wait(&conn->changed, &conn->mutex);
+			}
+		}
+		if (conn->joinable) {
+			pthread_join(conn->reader, NULL);
+			conn->joinable = 0;
+		}
+		close(conn->socket);
+		conn->socket = -1;
+	}
+	conn->failed = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////
 //
 // Function	: my_cruddy_send
 // Description	: This checks what kind of CrudRequest is used then sends the
-// 		  the request to the server.
+// 		  the request to the server, with whatever follows it on the
+// 		  wire (tag, offset, payload) gathered into one writev.
 //
-// Inputs	: req - the CrudRequest
+// Inputs	: conn - the connection (held by the caller)
+// 		  req - the CrudRequest
+// 		  offset - the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
 // 		  buf - the block to read/write from
-// Outputs	: none
+// 		  tag - the tag to send with the request (-1 for none)
+// Outputs	: 0 if successful, -1 if the connection failed
 
-void my_cruddy_send(CrudRequest req, char *buf){
+int my_cruddy_send(CrudConnection *conn, CrudRequest req, uint32_t offset, char *buf, int32_t tag){
 	// Local variables for request info
 	int request;
 	int length;
+	uint32_t packed = 0, netSize, netOffset, netTag, prefix, payload;
+	char head[CRUD_NET_HEADER_SIZE + CRUD_TAG_SIZE + CRUD_RANGE_HEADER_SIZE + CRUD_COMPRESS_SIZE_HEADER];
+	char *frame = NULL;
+	struct iovec iov[2];
+	CrudRequest netReq;
+	int ret;
 
-	// Extract req to see what the actual request is
+	// Extract req to see what the actual request is, and size what goes with it
 	extract_crud_request(req, &request, &length);
+	prefix = CRUD_NET_HEADER_SIZE + ((tag < 0) ? 0 : CRUD_TAG_SIZE) +
+			((request == CRUD_READ_RANGE || request == CRUD_WRITE_RANGE) ? CRUD_RANGE_HEADER_SIZE : 0);
+	payload = (request == CRUD_CREATE || request == CRUD_UPDATE || request == CRUD_WRITE_RANGE) ? length : 0;
+	req = my_cruddy_flag(req, CRUD_TAGGED, tag >= 0);
+	netReq = htonll64(my_cruddy_wire(req));
 
-	// Translate the request to network byte order
-	CrudRequest netReq = htonll64(req);
-
-	// Send the request
-	write(socket_fd, &netReq, sizeof(netReq));
-
-	// Compare request to current request type and send buffer if necessary
-	if (request == CRUD_CREATE || request == CRUD_UPDATE){
-		// Send the buffer, use loop to ensure entire buf is sent
-		int bufCount = 0;
-		do {
-			int retBuf = write(socket_fd, &buf[bufCount], length - bufCount);
-			bufCount = bufCount + retBuf;
-		} while (bufCount != length);
+	// Compress a large enough payload, sending it that way if it shrank
+	if ((request == CRUD_CREATE || request == CRUD_UPDATE) && my_cruddy_compressing(length)) {
+		if ((frame = crud_buffer_alloc(length)) != NULL) {
+			packed = crud_compress((uint8_t *)buf, length, (uint8_t *)frame, length - 1);
+		}
+		if (packed > 0) {
+			netReq = htonll64(my_cruddy_flag(req, CRUD_COMPRESSED, 1));
+			netSize = htonl(packed);
+			memcpy(&head[prefix], &netSize, CRUD_COMPRESS_SIZE_HEADER);
+			prefix += CRUD_COMPRESS_SIZE_HEADER;
+			payload = packed;
+			buf = frame;
+		}
+	}
 
+	// The header, tag and offset go in front, the payload is sent from where it is
+	memcpy(head, &netReq, CRUD_NET_HEADER_SIZE);
+	if (tag >= 0) {
+		netTag = htonl(tag);
+		memcpy(&head[CRUD_NET_HEADER_SIZE], &netTag, CRUD_TAG_SIZE);
+	}
+	if (request == CRUD_READ_RANGE || request == CRUD_WRITE_RANGE) {
+		netOffset = htonl(offset);
+		memcpy(&head[prefix - CRUD_RANGE_HEADER_SIZE], &netOffset, CRUD_RANGE_HEADER_SIZE);
 	}
+	iov[0].iov_base = head;
+	iov[0].iov_len = prefix;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = payload;
+	ret = my_cruddy_write_vector(conn, iov, (payload > 0) ? 2 : 1);
+	crud_buffer_free(frame);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -111,11 +1236,37 @@ void my_cruddy_send(CrudRequest req, char *buf){
 // Description	: This checks what kind of CrudRequest is used then receives the
 // 		  the corresponding information
 //
-// Inputs	: req - the CrudRequest
+// Inputs	: conn - the connection (held by the caller)
+// 		  req - the CrudRequest
 // 		  buf - the block to read/write from
 // Outputs	: returns the CrudResponse that was sent back
 
-CrudResponse my_cruddy_receive(CrudRequest req, char *buf){
+CrudResponse my_cruddy_receive(CrudConnection *conn, CrudRequest req, char *buf){
+	// Create variables to store the current response
+	CrudResponse tempResp;
+
+	// Read the resonse (a lost connection fails the request)
+	if (my_cruddy_read_all(conn, (char *)&tempResp, sizeof(tempResp))) {
+		conn->failed = 1;
+		return my_cruddy_flag(req, CRUD_COMPRESSED, 0) | 1;
+	}
+
+	// Convert CrudResponse to local byte order, then take what follows it
+	return my_cruddy_receive_payload(conn, req, ntohll64(tempResp), buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_receive_payload
+// Description	: Receive whatever follows a response on the wire
+//
+// Inputs	: conn - the connection (held by the caller, or its reader)
+// 		  req - the CrudRequest
+// 		  netResp - the response (local byte order)
+// 		  buf - the block to read into
+// Outputs	: returns the CrudResponse, as the caller should see it
+
+CrudResponse my_cruddy_receive_payload(CrudConnection *conn, CrudRequest req, CrudResponse netResp, char *buf){
 	// Local variables to store request info
 	int request;
 	int length;
@@ -123,30 +1274,184 @@ CrudResponse my_cruddy_receive(CrudRequest req, char *buf){
 	// Extract req to see what the actual request is
 	extract_crud_request(req, &request, &length);
 
-	// Create variables to store the current response
-	CrudResponse tempResp;
-	CrudResponse netResp;
+	// A read returns however many bytes the response says (none if it failed)
+	if (request == CRUD_READ || request == CRUD_READ_RANGE){
+		int respRequest, respLength;
+		extract_crud_request(netResp, &respRequest, &respLength);
+		length = ((netResp & 1) || (respLength > length)) ? 0 : respLength;
+	}
 
-	// Read the resonse 
-	read(socket_fd, &tempResp, sizeof(tempResp));
+	// Compare request to current request type and send buffer if necessary
+	if ((request == CRUD_READ || request == CRUD_READ_RANGE) && (length > 0) &&
+			(netResp != my_cruddy_flag(netResp, CRUD_COMPRESSED, 0))) {
+		// Compressed, the size comes first then the bytes to expand into the buffer
+		uint32_t netSize, size;
+		char *packed;
+		if (my_cruddy_read_all(conn, (char *)&netSize, CRUD_COMPRESS_SIZE_HEADER)) {
+			conn->failed = 1;
+			return my_cruddy_flag(netResp, CRUD_COMPRESSED, 0) | 1;
+		}
+		size = ntohl(netSize);
+		if ((size > (uint32_t)length) || ((packed = crud_buffer_alloc(size)) == NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD client : bad compressed payload size %u.", size);
+			conn->failed = 1;
+			netResp |= 1;
+		} else {
+			if (my_cruddy_read_all(conn, packed, size)) {
+				conn->failed = 1;
+				netResp |= 1;
+			} else if (crud_decompress((uint8_t *)packed, size, (uint8_t *)buf, length)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD client : corrupt compressed payload.");
+				netResp |= 1;
+			}
+			crud_buffer_free(packed);
+		}
+	} else if ((request == CRUD_READ || request == CRUD_READ_RANGE) && my_cruddy_read_all(conn, buf, length)){
+		conn->failed = 1;
+		netResp |= 1;
+	}
 
-	// Convert CrudResponse to local byte order
-	netResp = ntohll64(tempResp);
+	// The caller never sees how the payload travelled
+	return my_cruddy_flag(netResp, CRUD_COMPRESSED, 0);
+}
 
-	// Compare request to current request type and send buffer if necessary
-	if (request == CRUD_READ){
-		int bufCount = 0;
-		do {
-			int retBuf = read(socket_fd, &buf[bufCount], length-bufCount);
-			bufCount = bufCount + retBuf;
-		} while(bufCount != length);
-	} else if (request == CRUD_CLOSE){
-		close(socket_fd);
-		socket_fd = -1;
-		isConnect = 0;
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_write_vector
+// Description	: Write every byte of a list of buffers to the server, in one
+// 		  writev unless the socket takes less than all of it
+//
+// Inputs	: conn - the connection (held by the caller)
+// 		  iov - the buffers to send (adjusted as they go out)
+// 		  count - the number of buffers
+// Outputs	: 0 if successful, -1 if the connection failed
+
+int my_cruddy_write_vector(CrudConnection *conn, struct iovec *iov, int count){
+	ssize_t retBuf;
+
+	// Use loop to ensure everything is sent, skipping past what went out
+	while (count > 0) {
+		retBuf = writev(conn->socket, iov, count);
+		__atomic_add_fetch(&crud_transport_stats.writes, 1, __ATOMIC_RELAXED);
+		if (retBuf <= 0) {
+			if ((retBuf == -1) && (errno == EINTR)) {
+				continue;
+			}
+			return -1;
+		}
+		__atomic_add_fetch(&crud_transport_stats.sent, retBuf, __ATOMIC_RELAXED);
+		while ((count > 0) && ((size_t)retBuf >= iov->iov_len)) {
+			retBuf -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + retBuf;
+			iov->iov_len -= retBuf;
+		}
 	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_read_all
+// Description	: Read exactly length bytes from the server.  They come out of
+// 		  the connection's buffer, which is refilled with one read of
+// 		  whatever has arrived; what is too big for it is read in place.
+//
+// Inputs	: conn - the connection (held by the caller, or its reader)
+// 		  buf - the buffer to place the bytes in
+// 		  length - the number of bytes to read
+// Outputs	: 0 if successful, -1 if the connection failed
+
+int my_cruddy_read_all(CrudConnection *conn, char *buf, uint32_t length){
+	uint32_t bufCount = 0, taken;
+	ssize_t retBuf;
+
+	// Use loop to ensure everything is read, taking what is buffered first
+	while (bufCount < length) {
+		if (conn->inhead < conn->intail) {
+			taken = conn->intail - conn->inhead;
+			taken = (taken < length - bufCount) ? taken : length - bufCount;
+			memcpy(&buf[bufCount], &conn->inbuf[conn->inhead], taken);
+			conn->inhead += taken;
+			bufCount += taken;
+			continue;
+		}
+		if (length - bufCount >= CRUD_RECEIVE_BUFFER_SIZE) {
+			retBuf = read(conn->socket, &buf[bufCount], length - bufCount);
+		} else {
+			retBuf = read(conn->socket, conn->inbuf, CRUD_RECEIVE_BUFFER_SIZE);
+		}
+		__atomic_add_fetch(&crud_transport_stats.reads, 1, __ATOMIC_RELAXED);
+		if (retBuf <= 0) {
+			if ((retBuf == -1) && (errno == EINTR)) {
+				continue;
+			}
+			return -1;
+		}
+		__atomic_add_fetch(&crud_transport_stats.received, retBuf, __ATOMIC_RELAXED);
+		if (length - bufCount >= CRUD_RECEIVE_BUFFER_SIZE) {
+			bufCount += retBuf;
+		} else {
+			conn->inhead = 0;
+			conn->intail = retBuf;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_compressing
+// Description	: Check if a payload should be compressed on the wire
+//
+// Inputs	: length - the length of the payload
+// Outputs	: 1 if it should, 0 if not
+
+int my_cruddy_compressing(uint32_t length){
+	return (crud_server_capabilities & CRUD_CAP_COMPRESS) && (crud_compress_threshold > 0) &&
+			(length >= crud_compress_threshold);
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_wire
+// Description	: Mark a large enough read as willing to take a compressed reply
+//
+// Inputs	: req - the CrudRequest
+// Outputs	: the request to send
+
+CrudRequest my_cruddy_wire(CrudRequest req){
+	int request, length;
+
+	extract_crud_request(req, &request, &length);
+	if ((request == CRUD_READ || request == CRUD_READ_RANGE) && my_cruddy_compressing(length)) {
+		return my_cruddy_flag(req, CRUD_COMPRESSED, 1);
+	}
+	return req;
+}
+
+////////////////////////////////////////////////////////////////////////////////////
+//
+// Function	: my_cruddy_flag
+// Description	: Set or clear one of the flags of a request or response
+//
+// Inputs	: req - the CrudRequest/CrudResponse
+// 		  flag - the flag (CRUD_FLAG_TYPES)
+// 		  on - non-zero to set it, zero to clear it
+// Outputs	: the changed request/response
+
+CrudRequest my_cruddy_flag(CrudRequest req, uint8_t flag, int on){
+	CrudOID oid;
+	CRUD_REQUEST_TYPES request;
+	uint32_t length;
+	uint8_t flags, res;
 
-	return netResp;
+	deconstruct_crud_request(req, &oid, &request, &length, &flags, &res);
+	flags = on ? (flags | flag) : (flags & ~flag);
+	return construct_crud_request(oid, request, length, flags, res);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////
@@ -160,6 +1465,6 @@ CrudResponse my_cruddy_receive(CrudRequest req, char *buf){
 //  Outputs	: none
 
 void extract_crud_request( CrudRequest crud, int *req, int *length ) {
-	*req =(int) (int64_t) (crud & (((int64_t)1<<32)-1))>>28;
+	*req =(int) ((uint32_t) (crud & (((int64_t)1<<32)-1))>>28);
 	*length = (int)(int64_t) (crud & ((1<<28)-1))>>4;
 }
@@ -0,0 +1,368 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_compress.c
+//  Description   : This is the implementation of the CRUD payload codec.  A
+//                  compressed payload is a list of sequences, each
+//
+//                    token   - literal count (high 4 bits), match length
+//                              less CRUD_COMPRESS_MIN_MATCH (low 4 bits)
+//                    [count] - if a field is 15, more bytes added to it
+//                              until one is not 255
+//                    literals
+//                    offset  - 16 bits, little endian (not in the last
+//                              sequence, which is literals only)
+//                    [length] - extension of the match length, as above
+//
+//                  Matches are found with a single-probe hash table on the
+//                  next four bytes.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 18:05:37 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_compress.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_COMPRESS_UNIT_TEST_SIZE 0x8000
+
+//
+// Global Data
+
+uint32_t          crud_compress_threshold = 0; // Smallest payload compressed (0 = compression off)
+CrudCompressStats crud_compress_stats;         // The codec statistics
+
+// Module local data
+static pthread_mutex_t compress_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards the statistics
+
+//
+// Module local functions
+
+static uint64_t compress_now(void);
+static uint8_t *compress_put_length(uint8_t *out, uint8_t *end, uint32_t value);
+static uint8_t *compress_put_sequence(uint8_t *out, uint8_t *end, const uint8_t *literals, uint32_t count,
+		uint32_t offset, uint32_t match);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress
+// Description  : Compress a payload.  Gives up as soon as the output would
+//                pass the limit, so the caller can send the payload raw.
+//
+// Inputs       : src - the payload
+//                length - the length of the payload
+//                dst - the buffer for the compressed bytes
+//                limit - the most bytes to use in dst
+// Outputs      : the compressed size, or 0 if it would not fit in limit
+
+uint32_t crud_compress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t limit) {
+	uint32_t table[1 << CRUD_COMPRESS_HASH_BITS], pos = 0, anchor = 0, candidate, hash, value, match;
+	uint8_t *out = dst, *end = dst + limit;
+	uint64_t start = compress_now();
+
+	// Look for a back reference at each position (the last few bytes are always literals)
+	memset(table, 0x0, sizeof(table));
+	while ( (out != NULL) && (length >= CRUD_COMPRESS_MIN_MATCH) && (pos <= length - CRUD_COMPRESS_MIN_MATCH) ) {
+		memcpy(&value, &src[pos], sizeof(uint32_t));
+		hash = (value * 2654435761U) >> (32 - CRUD_COMPRESS_HASH_BITS);
+		candidate = table[hash];
+		table[hash] = pos;
+		if ( (candidate >= pos) || (pos - candidate > CRUD_COMPRESS_MAX_OFFSET) ||
+				memcmp(&src[candidate], &src[pos], CRUD_COMPRESS_MIN_MATCH) ) {
+			pos++;
+			continue;
+		}
+
+		// Extend the match as far as it goes, emit it with the literals before it
+		match = CRUD_COMPRESS_MIN_MATCH;
+		while ( (pos + match < length) && (src[candidate + match] == src[pos + match]) ) {
+			match++;
+		}
+		out = compress_put_sequence(out, end, &src[anchor], pos - anchor, pos - candidate, match);
+		pos += match;
+		anchor = pos;
+	}
+
+	// Finish with the trailing literals
+	if ( out != NULL ) {
+		out = compress_put_sequence(out, end, &src[anchor], length - anchor, 0, 0);
+	}
+
+	// Count the attempt either way
+	pthread_mutex_lock(&compress_mutex);
+	crud_compress_stats.compress_ns += compress_now() - start;
+	if ( out == NULL ) {
+		crud_compress_stats.incompressible++;
+	} else {
+		crud_compress_stats.compressed++;
+		crud_compress_stats.bytes_raw += length;
+		crud_compress_stats.bytes_wire += out - dst;
+	}
+	pthread_mutex_unlock(&compress_mutex);
+	return( (out == NULL) ? 0 : (uint32_t)(out - dst) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_decompress
+// Description  : Decompress a payload, checking every length and offset
+//                against the buffers (the bytes come off the network).
+//
+// Inputs       : src - the compressed bytes
+//                size - the number of compressed bytes
+//                dst - the buffer for the payload
+//                length - the length of the payload
+// Outputs      : 0 if exactly length bytes were produced, -1 if corrupt
+
+int crud_decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t length) {
+	const uint8_t *in = src, *inEnd = src + size;
+	uint32_t out = 0, count, offset, more;
+	uint64_t start = compress_now();
+	int ret = -1;
+	uint8_t token;
+
+	while ( in < inEnd ) {
+
+		// Copy the literals
+		token = *in++;
+		count = token >> 4;
+		if ( count == 15 ) {
+			do {
+				if ( in >= inEnd ) {
+					goto done;
+				}
+				more = *in++;
+				count += more;
+			} while ( more == 255 );
+		}
+		if ( (count > (uint32_t)(inEnd - in)) || (count > length - out) ) {
+			break;
+		}
+		memcpy(&dst[out], in, count);
+		in += count;
+		out += count;
+
+		// The last sequence has no match
+		if ( in == inEnd ) {
+			ret = (out == length) ? 0 : -1;
+			break;
+		}
+
+		// Copy the match (byte by byte, it may overlap itself)
+		if ( inEnd - in < 2 ) {
+			break;
+		}
+		offset = in[0] | (in[1] << 8);
+		in += 2;
+		count = (token & 0xf);
+		if ( count == 15 ) {
+			do {
+				if ( in >= inEnd ) {
+					goto done;
+				}
+				more = *in++;
+				count += more;
+			} while ( more == 255 );
+		}
+		count += CRUD_COMPRESS_MIN_MATCH;
+		if ( (offset == 0) || (offset > out) || (count > length - out) ) {
+			break;
+		}
+		for ( ; count > 0; count--, out++ ) {
+			dst[out] = dst[out - offset];
+		}
+	}
+
+done:
+	pthread_mutex_lock(&compress_mutex);
+	crud_compress_stats.decompress_ns += compress_now() - start;
+	if ( ret == 0 ) {
+		crud_compress_stats.decompressed++;
+		crud_compress_stats.bytes_raw += length;
+		crud_compress_stats.bytes_wire += size;
+	}
+	pthread_mutex_unlock(&compress_mutex);
+	return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_compress_log_stats
+// Description  : Log the codec counters, the bytes saved against the time
+//                spent getting them (to tune the threshold by)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_compress_log_stats(void) {
+	CrudCompressStats stats;
+
+	pthread_mutex_lock(&compress_mutex);
+	stats = crud_compress_stats;
+	pthread_mutex_unlock(&compress_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD compression : %llu payloads compressed, %llu incompressible, "
+			"%llu decompressed, %llu bytes sent as %llu (%llu saved, %.1f%%), "
+			"%.3f ms compressing, %.3f ms decompressing",
+			(unsigned long long)stats.compressed, (unsigned long long)stats.incompressible,
+			(unsigned long long)stats.decompressed, (unsigned long long)stats.bytes_raw,
+			(unsigned long long)stats.bytes_wire, (unsigned long long)(stats.bytes_raw - stats.bytes_wire),
+			(stats.bytes_raw == 0) ? 0.0 : (100.0 * (stats.bytes_raw - stats.bytes_wire)) / stats.bytes_raw,
+			stats.compress_ns / 1000000.0, stats.decompress_ns / 1000000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudCompressUnitTest
+// Description  : Round trip buffers of assorted contents (random, runs,
+//                text-like, tiny) through the codec, and check that corrupt
+//                input is refused rather than overrunning the buffer.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudCompressUnitTest(void) {
+	uint8_t *raw, *packed, *back;
+	uint32_t i, t, length, size;
+	const char *words = "the quick brown fox jumps over the lazy dog ";
+
+	raw = malloc(CRUD_COMPRESS_UNIT_TEST_SIZE);
+	packed = malloc(CRUD_COMPRESS_UNIT_TEST_SIZE);
+	back = malloc(CRUD_COMPRESS_UNIT_TEST_SIZE);
+	for (t=0; t<64; t++) {
+
+		// Pick the contents and length of this buffer
+		length = (t % 8 == 0) ? t / 8 : getRandomValue(1, CRUD_COMPRESS_UNIT_TEST_SIZE);
+		for (i=0; i<length; i++) {
+			switch (t % 4) {
+			case 0:  raw[i] = (uint8_t)getRandomValue(0, 255); break;
+			case 1:  raw[i] = (uint8_t)('a' + (i / 300) % 26); break;
+			case 2:  raw[i] = (uint8_t)words[(i * 7 + i / 50) % strlen(words)]; break;
+			default: raw[i] = (i % 1000 < 10) ? (uint8_t)getRandomValue(0, 255) : 0; break;
+			}
+		}
+
+		// Compress (raw buffers may not fit), then check it comes back the same
+		size = crud_compress(raw, length, packed, CRUD_COMPRESS_UNIT_TEST_SIZE);
+		if ( (size == 0) && (t % 4 != 0) && (length > 64) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_COMPRESS_UNIT_TEST : compressible buffer (%u bytes) not compressed.", length);
+			return(-1);
+		}
+		if ( (size > 0) && (crud_decompress(packed, size, back, length) || memcmp(raw, back, length)) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_COMPRESS_UNIT_TEST : round trip of %u bytes failed.", length);
+			return(-1);
+		}
+
+		// A truncated or wrongly sized payload must be refused
+		if ( (size > 1) && ((crud_decompress(packed, size - 1, back, length) == 0) ||
+				(crud_decompress(packed, size, back, length - 1) == 0)) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_COMPRESS_UNIT_TEST : corrupt payload accepted.");
+			return(-1);
+		}
+	}
+
+	// Log, cleanup and return successfully
+	free(raw);
+	free(packed);
+	free(back);
+	logMessage(LOG_INFO_LEVEL, "CRUD_COMPRESS_UNIT_TEST : codec round trips successful.");
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compress_now
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+static uint64_t compress_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compress_put_length
+// Description  : Write the extension bytes of a count that did not fit its
+//                four bits
+//
+// Inputs       : out - where to write
+//                end - the end of the output buffer
+//                value - what is left of the count (after the 15)
+// Outputs      : past the bytes written, or NULL if out of room
+
+static uint8_t *compress_put_length(uint8_t *out, uint8_t *end, uint32_t value) {
+	for ( ; ; value -= 255 ) {
+		if ( out >= end ) {
+			return( NULL );
+		}
+		*out++ = (value >= 255) ? 255 : (uint8_t)value;
+		if ( value < 255 ) {
+			return( out );
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compress_put_sequence
+// Description  : Write one sequence: the token, the literals and (unless it
+//                is the last) the match
+//
+// Inputs       : out - where to write (NULL if already out of room)
+//                end - the end of the output buffer
+//                literals - the literal bytes
+//                count - the number of literals
+//                offset - how far back the match is (0 for the last sequence)
+//                match - the length of the match
+// Outputs      : past the bytes written, or NULL if out of room
+
+static uint8_t *compress_put_sequence(uint8_t *out, uint8_t *end, const uint8_t *literals, uint32_t count,
+		uint32_t offset, uint32_t match) {
+	uint32_t extra = (offset > 0) ? match - CRUD_COMPRESS_MIN_MATCH : 0;
+	uint8_t *token = out;
+
+	// The token, then the literals
+	if ( out >= end ) {
+		return( NULL );
+	}
+	*out++ = (uint8_t)(((count >= 15) ? 15 : count) << 4) | ((extra >= 15) ? 15 : extra);
+	if ( (count >= 15) && ((out = compress_put_length(out, end, count - 15)) == NULL) ) {
+		return( NULL );
+	}
+	if ( count > (uint32_t)(end - out) ) {
+		return( NULL );
+	}
+	memcpy(out, literals, count);
+	out += count;
+
+	// The last sequence ends with its literals
+	if ( offset == 0 ) {
+		*token &= 0xf0;
+		return( out );
+	}
+	if ( end - out < 2 ) {
+		return( NULL );
+	}
+	*out++ = (uint8_t)(offset & 0xff);
+	*out++ = (uint8_t)(offset >> 8);
+	if ( extra >= 15 ) {
+		return( compress_put_length(out, end, extra - 15) );
+	}
+	return( out );
+}
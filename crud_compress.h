@@ -0,0 +1,65 @@
+#ifndef CRUD_COMPRESS_INCLUDED
+#define CRUD_COMPRESS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_compress.h
+//  Description   : This is the payload codec for the CRUD wire protocol.  It
+//                  is a byte-oriented LZ77 variant (sequences of literals
+//                  then a back reference into the last 64 KB), chosen to be
+//                  cheap on CPU rather than to compress hard.  Both the
+//                  client and the stand-in use it once CRUD_CAP_COMPRESS has
+//                  been negotiated (see crud_network.h).
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 18:05:37 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Defines
+#define CRUD_COMPRESS_SIZE_HEADER sizeof(uint32_t) // Compressed length sent ahead of a compressed payload
+#define CRUD_COMPRESS_DEFAULT_THRESHOLD 512 // Smallest payload worth compressing
+#define CRUD_COMPRESS_HASH_BITS 12          // Match finder table is 4096 entries
+#define CRUD_COMPRESS_MIN_MATCH 4           // Shortest back reference
+#define CRUD_COMPRESS_MAX_OFFSET 0xffff     // Furthest back reference
+
+// Type definitions
+
+// These are the codec statistics (both directions)
+typedef struct {
+	uint64_t compressed;     // Payloads compressed
+	uint64_t incompressible; // Payloads that would not shrink (sent raw)
+	uint64_t decompressed;   // Payloads decompressed
+	uint64_t bytes_raw;      // Bytes of those payloads before compression
+	uint64_t bytes_wire;     // Bytes of those payloads as compressed
+	uint64_t compress_ns;    // Time spent compressing (including failed attempts)
+	uint64_t decompress_ns;  // Time spent decompressing
+} CrudCompressStats;
+
+//
+// Functional Prototypes
+
+uint32_t crud_compress(const uint8_t *src, uint32_t length, uint8_t *dst, uint32_t limit);
+	// Compress a payload, returns the compressed size (0 if it needs more than limit bytes)
+
+int crud_decompress(const uint8_t *src, uint32_t size, uint8_t *dst, uint32_t length);
+	// Decompress a payload of exactly length bytes, 0 if successful, -1 if corrupt
+
+void crud_compress_log_stats(void);
+	// Log the bytes saved against the time spent
+
+//
+// Unit testing for the module
+
+int crudCompressUnitTest(void);
+	// Round trip buffers of assorted contents through the codec
+
+//
+// Compression Global Data
+
+extern uint32_t          crud_compress_threshold; // Smallest payload compressed (0 = compression off)
+extern CrudCompressStats crud_compress_stats;     // The codec statistics
+
+#endif
@@ -0,0 +1,594 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_dedup.c
+//  Description   : This is the implementation of the CRUD content-addressed
+//                  deduplication layer.  Entries are found through two hash
+//                  tables, one on the OID and one on the content digest.
+//                  Only objects worth tracking have an entry: those hashed
+//                  (so later writes can share them) and those shared (so
+//                  they are copied before being changed).  Reference counts
+//                  are not stored, they are counted from the file table at
+//                  mount; the stored index holds the digests.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 16:40:12 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_dedup.h>
+#include <crud_buffer.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+//
+// Global Data
+
+CrudDedupStats crud_dedup_stats; // The dedup statistics
+
+// Module local data
+static int              dedup_on = 0;            // Written extents are hashed
+static CrudDedupEntry **dedup_by_oid = NULL;     // The OID hash buckets
+static CrudDedupEntry **dedup_by_digest = NULL;  // The digest hash buckets
+static uint32_t         dedup_buckets = 0;       // Buckets in each table
+static uint32_t         dedup_entries = 0;       // Entries tracked
+static uint32_t         dedup_hashed = 0;        // Entries with a valid digest
+static int              dedup_changed = 0;       // The digests changed since last encoded
+static pthread_mutex_t  dedup_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything above
+static pthread_mutex_t  dedup_hash_mutex = PTHREAD_MUTEX_INITIALIZER; // Serializes the (shared) hash context
+
+//
+// Module local functions
+
+static uint32_t dedup_digest_bucket(unsigned char *digest);
+static CrudDedupEntry *dedup_find_oid(CrudOID oid);
+static CrudDedupEntry *dedup_add(CrudOID oid, uint32_t length);
+static void dedup_hash_link(CrudDedupEntry *entry, unsigned char *digest);
+static void dedup_hash_unlink(CrudDedupEntry *entry);
+static void dedup_remove(CrudDedupEntry *entry);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_enable
+// Description  : Turn hashing of written extents on or off.  Objects already
+//                shared stay shared (and copied on write) either way.
+//
+// Inputs       : enable - non-zero to hash written extents
+// Outputs      : none
+
+void crud_dedup_enable(int enable) {
+	pthread_mutex_lock(&dedup_mutex);
+	dedup_on = (enable != 0);
+	pthread_mutex_unlock(&dedup_mutex);
+	logMessage(LOG_INFO_LEVEL, "CRUD dedup %s.", enable ? "enabled" : "disabled");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_enabled
+// Description  : Check if written extents are hashed
+//
+// Inputs       : none
+// Outputs      : 1 if enabled, 0 if not
+
+int crud_dedup_enabled(void) {
+	int on;
+
+	pthread_mutex_lock(&dedup_mutex);
+	on = dedup_on;
+	pthread_mutex_unlock(&dedup_mutex);
+	return(on);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_hash
+// Description  : Hash an object's contents
+//
+// Inputs       : buf - the contents
+//                length - the size of the object
+//                digest - the hash (CRUD_DEDUP_DIGEST_LENGTH bytes)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dedup_hash(void *buf, uint32_t length, unsigned char *digest) {
+	uint32_t size = CRUD_DEDUP_DIGEST_LENGTH;
+	int ret;
+
+	pthread_mutex_lock(&dedup_hash_mutex);
+	ret = generate_md5_signature((unsigned char *)buf, length, digest, &size);
+	pthread_mutex_unlock(&dedup_hash_mutex);
+	if ((ret != 0) || (size != CRUD_DEDUP_DIGEST_LENGTH)) {
+		return(-1);
+	}
+	pthread_mutex_lock(&dedup_mutex);
+	crud_dedup_stats.hashed++;
+	pthread_mutex_unlock(&dedup_mutex);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_find
+// Description  : Find an object holding the same contents, taking a
+//                reference to it for the caller.
+//
+// Inputs       : digest - the hash of the contents
+//                length - the size of the object
+//                current - the object being rewritten (CRUD_NO_OBJECT if none)
+// Outputs      : the object, or CRUD_NO_OBJECT if there is none
+
+CrudOID crud_dedup_find(unsigned char *digest, uint32_t length, CrudOID current) {
+	CrudDedupEntry *entry;
+	CrudOID oid = CRUD_NO_OBJECT;
+
+	pthread_mutex_lock(&dedup_mutex);
+	if (dedup_buckets > 0) {
+		for (entry = dedup_by_digest[dedup_digest_bucket(digest)]; entry != NULL; entry = entry->dnext) {
+			if ((entry->length == length) && (memcmp(entry->digest, digest, CRUD_DEDUP_DIGEST_LENGTH) == 0)) {
+				entry->refs++;
+				oid = entry->object_id;
+				if (oid == current) {
+					crud_dedup_stats.unchanged++;
+				} else {
+					crud_dedup_stats.shared++;
+				}
+				crud_dedup_stats.bytes_saved += length;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&dedup_mutex);
+	return(oid);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_insert
+// Description  : Record a newly created object (holding one reference), so
+//                later writes of the same contents can share it.
+//
+// Inputs       : oid - the object
+//                length - the size of the object
+//                digest - the hash of the contents (NULL if not hashed)
+// Outputs      : none
+
+void crud_dedup_insert(CrudOID oid, uint32_t length, unsigned char *digest) {
+	CrudDedupEntry *entry;
+
+	// Unhashed and unshared objects need no entry
+	if (digest == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&dedup_mutex);
+	if ((entry = dedup_find_oid(oid)) == NULL) {
+		if ((entry = dedup_add(oid, length)) == NULL) {
+			pthread_mutex_unlock(&dedup_mutex);
+			return;
+		}
+		entry->refs = 1;
+	}
+	entry->length = length;
+	dedup_hash_link(entry, digest);
+	pthread_mutex_unlock(&dedup_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_claim
+// Description  : Prepare to change an object in place.  A shared object must
+//                be copied instead, an unshared one stops being findable by
+//                its old contents (so no write shares it mid-change).
+//
+// Inputs       : oid - the object
+// Outputs      : 0 if it may be changed in place, 1 if it is shared
+
+int crud_dedup_claim(CrudOID oid) {
+	CrudDedupEntry *entry;
+	int shared = 0;
+
+	pthread_mutex_lock(&dedup_mutex);
+	if ((entry = dedup_find_oid(oid)) != NULL) {
+		if (entry->refs > 1) {
+			crud_dedup_stats.copies++;
+			shared = 1;
+		} else {
+			dedup_remove(entry);
+		}
+	}
+	pthread_mutex_unlock(&dedup_mutex);
+	return(shared);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_rehash
+// Description  : Record the new contents of an object changed in place (after
+//                crud_dedup_claim allowed it)
+//
+// Inputs       : oid - the object
+//                length - the size of the object
+//                digest - the hash of the new contents (NULL if not hashed)
+// Outputs      : none
+
+void crud_dedup_rehash(CrudOID oid, uint32_t length, unsigned char *digest) {
+	crud_dedup_insert(oid, length, digest);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_release
+// Description  : Drop a reference to an object, forgetting it once nothing
+//                refers to it (the caller then deletes it).
+//
+// Inputs       : oid - the object
+// Outputs      : the references left (0 if the object can be deleted)
+
+uint32_t crud_dedup_release(CrudOID oid) {
+	CrudDedupEntry *entry;
+	uint32_t refs = 0;
+
+	pthread_mutex_lock(&dedup_mutex);
+	if ((entry = dedup_find_oid(oid)) != NULL) {
+		refs = (entry->refs > 0) ? entry->refs - 1 : 0;
+		entry->refs = refs;
+		if ((refs == 0) || ((refs == 1) && !entry->hashed)) {
+			dedup_remove(entry);
+		}
+	}
+	pthread_mutex_unlock(&dedup_mutex);
+	return(refs);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_reference
+// Description  : Count a reference to an object found in the file table
+//                (while mounting, crud_dedup_prune tidies up after)
+//
+// Inputs       : oid - the object
+//                length - the size of the object
+// Outputs      : none
+
+void crud_dedup_reference(CrudOID oid, uint32_t length) {
+	CrudDedupEntry *entry;
+
+	pthread_mutex_lock(&dedup_mutex);
+	if (((entry = dedup_find_oid(oid)) != NULL) || ((entry = dedup_add(oid, length)) != NULL)) {
+		entry->refs++;
+	}
+	pthread_mutex_unlock(&dedup_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_load
+// Description  : Add the digests of a stored index, encoded as [OID (32),
+//                size (32), digest] per object
+//
+// Inputs       : buf - the stored index
+//                length - the length of the index
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dedup_load(char *buf, uint32_t length) {
+	CrudDedupEntry *entry;
+	uint32_t used, size;
+	CrudOID oid;
+
+	pthread_mutex_lock(&dedup_mutex);
+	for (used=0; used+CRUD_DEDUP_ENTRY_SIZE<=length; used+=CRUD_DEDUP_ENTRY_SIZE) {
+		memcpy(&oid, &buf[used], sizeof(CrudOID));
+		memcpy(&size, &buf[used+sizeof(CrudOID)], sizeof(uint32_t));
+		if (oid == CRUD_NO_OBJECT) {
+			break;
+		}
+		if ((entry = dedup_add(oid, size)) == NULL) {
+			pthread_mutex_unlock(&dedup_mutex);
+			return(-1);
+		}
+		dedup_hash_link(entry, (unsigned char *)&buf[used+sizeof(CrudOID)+sizeof(uint32_t)]);
+	}
+	dedup_changed = 0;
+	pthread_mutex_unlock(&dedup_mutex);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_prune
+// Description  : Drop the entries not worth keeping once the references in
+//                the file table are counted: objects no longer referred to,
+//                and unhashed objects referred to only once.
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_dedup_prune(void) {
+	CrudDedupEntry *entry, *next;
+	uint32_t i;
+
+	pthread_mutex_lock(&dedup_mutex);
+	for (i=0; i<dedup_buckets; i++) {
+		for (entry = dedup_by_oid[i]; entry != NULL; entry = next) {
+			next = entry->onext;
+			if ((entry->refs == 0) || ((entry->refs == 1) && !entry->hashed)) {
+				dedup_remove(entry);
+			}
+		}
+	}
+	pthread_mutex_unlock(&dedup_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_encode
+// Description  : Encode the digests for storing (see crud_dedup_load)
+//
+// Inputs       : buf - set to the encoding (from the pool, caller frees)
+// Outputs      : the length of the encoding
+
+uint32_t crud_dedup_encode(char **buf) {
+	CrudDedupEntry *entry;
+	uint32_t i, used = 0;
+
+	pthread_mutex_lock(&dedup_mutex);
+	if ((*buf = crud_buffer_alloc(dedup_hashed * CRUD_DEDUP_ENTRY_SIZE)) == NULL) {
+		pthread_mutex_unlock(&dedup_mutex);
+		return(0);
+	}
+	for (i=0; i<dedup_buckets; i++) {
+		for (entry = dedup_by_oid[i]; entry != NULL; entry = entry->onext) {
+			if (entry->hashed) {
+				memcpy(&(*buf)[used], &entry->object_id, sizeof(CrudOID));
+				memcpy(&(*buf)[used+sizeof(CrudOID)], &entry->length, sizeof(uint32_t));
+				memcpy(&(*buf)[used+sizeof(CrudOID)+sizeof(uint32_t)], entry->digest, CRUD_DEDUP_DIGEST_LENGTH);
+				used += CRUD_DEDUP_ENTRY_SIZE;
+			}
+		}
+	}
+	dedup_changed = 0;
+	pthread_mutex_unlock(&dedup_mutex);
+	return(used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_dirty
+// Description  : Check if the digests changed since the index was loaded or
+//                last encoded
+//
+// Inputs       : none
+// Outputs      : 1 if changed, 0 if not
+
+int crud_dedup_dirty(void) {
+	int changed;
+
+	pthread_mutex_lock(&dedup_mutex);
+	changed = dedup_changed;
+	pthread_mutex_unlock(&dedup_mutex);
+	return(changed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_reset
+// Description  : Forget every entry (the buckets are kept for reuse)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_dedup_reset(void) {
+	CrudDedupEntry *entry;
+	uint32_t i;
+
+	pthread_mutex_lock(&dedup_mutex);
+	for (i=0; i<dedup_buckets; i++) {
+		while ((entry = dedup_by_oid[i]) != NULL) {
+			dedup_by_oid[i] = entry->onext;
+			free(entry);
+		}
+		dedup_by_digest[i] = NULL;
+	}
+	dedup_entries = 0;
+	dedup_hashed = 0;
+	dedup_changed = 0;
+	pthread_mutex_unlock(&dedup_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_log_stats
+// Description  : Log the dedup counters
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_dedup_log_stats(void) {
+	CrudDedupStats stats;
+	uint32_t entries;
+
+	pthread_mutex_lock(&dedup_mutex);
+	stats = crud_dedup_stats;
+	entries = dedup_entries;
+	pthread_mutex_unlock(&dedup_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD dedup : %llu extents hashed, %llu shared, %llu unchanged, "
+			"%llu bytes not written, %llu copied on write, %u objects tracked",
+			(unsigned long long)stats.hashed, (unsigned long long)stats.shared,
+			(unsigned long long)stats.unchanged, (unsigned long long)stats.bytes_saved,
+			(unsigned long long)stats.copies, entries);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_digest_bucket
+// Description  : Pick the bucket for a digest (its leading bytes are already
+//                uniformly spread)
+//
+// Inputs       : digest - the hash of the contents
+// Outputs      : the bucket index
+
+static uint32_t dedup_digest_bucket(unsigned char *digest) {
+	uint32_t value;
+
+	memcpy(&value, digest, sizeof(uint32_t));
+	return(value & (dedup_buckets - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_find_oid
+// Description  : Find the entry for an object (the caller holds the mutex)
+//
+// Inputs       : oid - the object
+// Outputs      : the entry, or NULL if the object is not tracked
+
+static CrudDedupEntry *dedup_find_oid(CrudOID oid) {
+	CrudDedupEntry *entry;
+
+	if (dedup_buckets == 0) {
+		return(NULL);
+	}
+	for (entry = dedup_by_oid[oid & (dedup_buckets - 1)]; entry != NULL; entry = entry->onext) {
+		if (entry->object_id == oid) {
+			return(entry);
+		}
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_add
+// Description  : Add an (unhashed, unreferenced) entry for an object, growing
+//                the tables as needed (the caller holds the mutex)
+//
+// Inputs       : oid - the object
+//                length - the size of the object
+// Outputs      : the entry, or NULL if failure
+
+static CrudDedupEntry *dedup_add(CrudOID oid, uint32_t length) {
+	CrudDedupEntry **byOid, **byDigest, *entry, *next;
+	uint32_t i, buckets, bucket;
+
+	// Double the tables once they average more than an entry a bucket
+	if (dedup_entries >= dedup_buckets) {
+		buckets = (dedup_buckets == 0) ? CRUD_DEDUP_INITIAL_BUCKETS : dedup_buckets * 2;
+		byOid = calloc(buckets, sizeof(CrudDedupEntry *));
+		byDigest = calloc(buckets, sizeof(CrudDedupEntry *));
+		if ((byOid == NULL) || (byDigest == NULL)) {
+			free(byOid);
+			free(byDigest);
+			return(NULL);
+		}
+		for (i=0; i<dedup_buckets; i++) {
+			for (entry = dedup_by_oid[i]; entry != NULL; entry = next) {
+				next = entry->onext;
+				bucket = entry->object_id & (buckets - 1);
+				entry->onext = byOid[bucket];
+				byOid[bucket] = entry;
+			}
+			for (entry = dedup_by_digest[i]; entry != NULL; entry = next) {
+				next = entry->dnext;
+				memcpy(&bucket, entry->digest, sizeof(uint32_t));
+				bucket &= (buckets - 1);
+				entry->dnext = byDigest[bucket];
+				byDigest[bucket] = entry;
+			}
+		}
+		free(dedup_by_oid);
+		free(dedup_by_digest);
+		dedup_by_oid = byOid;
+		dedup_by_digest = byDigest;
+		dedup_buckets = buckets;
+	}
+
+	// Create the entry, link it by OID
+	if ((entry = calloc(1, sizeof(CrudDedupEntry))) == NULL) {
+		return(NULL);
+	}
+	entry->object_id = oid;
+	entry->length = length;
+	bucket = oid & (dedup_buckets - 1);
+	entry->onext = dedup_by_oid[bucket];
+	dedup_by_oid[bucket] = entry;
+	dedup_entries++;
+	return(entry);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_hash_link
+// Description  : Give an entry a digest, making it findable by its contents
+//                (the caller holds the mutex)
+//
+// Inputs       : entry - the entry
+//                digest - the hash of the contents
+// Outputs      : none
+
+static void dedup_hash_link(CrudDedupEntry *entry, unsigned char *digest) {
+	uint32_t bucket;
+
+	dedup_hash_unlink(entry);
+	memcpy(entry->digest, digest, CRUD_DEDUP_DIGEST_LENGTH);
+	bucket = dedup_digest_bucket(digest);
+	entry->dnext = dedup_by_digest[bucket];
+	dedup_by_digest[bucket] = entry;
+	entry->hashed = 1;
+	dedup_hashed++;
+	dedup_changed = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_hash_unlink
+// Description  : Take an entry's digest away (the caller holds the mutex)
+//
+// Inputs       : entry - the entry
+// Outputs      : none
+
+static void dedup_hash_unlink(CrudDedupEntry *entry) {
+	CrudDedupEntry **link;
+
+	if (!entry->hashed) {
+		return;
+	}
+	for (link = &dedup_by_digest[dedup_digest_bucket(entry->digest)]; *link != NULL; link = &(*link)->dnext) {
+		if (*link == entry) {
+			*link = entry->dnext;
+			break;
+		}
+	}
+	entry->hashed = 0;
+	entry->dnext = NULL;
+	dedup_hashed--;
+	dedup_changed = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dedup_remove
+// Description  : Remove and free an entry (the caller holds the mutex)
+//
+// Inputs       : entry - the entry
+// Outputs      : none
+
+static void dedup_remove(CrudDedupEntry *entry) {
+	CrudDedupEntry **link;
+
+	dedup_hash_unlink(entry);
+	for (link = &dedup_by_oid[entry->object_id & (dedup_buckets - 1)]; *link != NULL; link = &(*link)->onext) {
+		if (*link == entry) {
+			*link = entry->onext;
+			break;
+		}
+	}
+	free(entry);
+	dedup_entries--;
+}
@@ -0,0 +1,109 @@
+#ifndef CRUD_DEDUP_INCLUDED
+#define CRUD_DEDUP_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_dedup.h
+//  Description   : This is the content-addressed deduplication layer for the
+//                  CRUD file interface.  Extent objects are indexed by a
+//                  hash of their contents, and an extent written with the
+//                  same contents as an existing object shares that object
+//                  rather than storing another copy.  Shared objects carry a
+//                  reference count and are copied before being changed
+//                  (copy-on-write), and deleted only when the last
+//                  reference goes.  Reference counts are kept whether or not
+//                  dedup is enabled, so a store written with dedup is safe to
+//                  use without it.  The layer may be used from several
+//                  threads at once.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 16:40:12 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_DEDUP_DIGEST_LENGTH 20  // Bytes of hash kept per object (SHA-1)
+#define CRUD_DEDUP_INITIAL_BUCKETS 1024 // Hash buckets allocated at first, doubled as needed
+#define CRUD_DEDUP_ENTRY_SIZE (sizeof(CrudOID)+sizeof(uint32_t)+CRUD_DEDUP_DIGEST_LENGTH) // Stored index entry
+
+// Type definitions
+
+// This is an object the layer is tracking (hashed, shared or both)
+typedef struct CrudDedupEntry {
+	CrudOID                object_id; // The object
+	uint32_t               length;    // The size of the object
+	uint32_t               refs;      // Extents referring to the object
+	uint8_t                hashed;    // The digest is valid (contents unchanged since hashed)
+	unsigned char          digest[CRUD_DEDUP_DIGEST_LENGTH]; // The hash of the contents
+	struct CrudDedupEntry *onext;     // Next entry in the OID bucket
+	struct CrudDedupEntry *dnext;     // Next entry in the digest bucket
+} CrudDedupEntry;
+
+// These are the dedup statistics
+typedef struct {
+	uint64_t hashed;      // Extent contents hashed
+	uint64_t shared;      // Writes that shared an existing object
+	uint64_t unchanged;   // Writes that left an extent's contents as they were
+	uint64_t bytes_saved; // Bytes not sent because an object was shared
+	uint64_t copies;      // Shared objects copied before being changed
+} CrudDedupStats;
+
+//
+// Functional Prototypes
+
+void crud_dedup_enable(int enable);
+	// Turn hashing of written extents on or off
+
+int crud_dedup_enabled(void);
+	// Check if written extents are hashed
+
+int crud_dedup_hash(void *buf, uint32_t length, unsigned char *digest);
+	// Hash an object's contents
+
+CrudOID crud_dedup_find(unsigned char *digest, uint32_t length, CrudOID current);
+	// Find an object with the same contents, adding a reference (CRUD_NO_OBJECT if none)
+
+void crud_dedup_insert(CrudOID oid, uint32_t length, unsigned char *digest);
+	// Record a new object with one reference (digest may be NULL)
+
+int crud_dedup_claim(CrudOID oid);
+	// Prepare to change an object in place, 0 if allowed, 1 if it is shared
+
+void crud_dedup_rehash(CrudOID oid, uint32_t length, unsigned char *digest);
+	// Record the new contents of an object changed in place (digest may be NULL)
+
+uint32_t crud_dedup_release(CrudOID oid);
+	// Drop a reference, returns those left (0 means the object can be deleted)
+
+void crud_dedup_reference(CrudOID oid, uint32_t length);
+	// Count a reference found in the file table (while mounting)
+
+int crud_dedup_load(char *buf, uint32_t length);
+	// Add the hashes from a stored index (before counting references)
+
+void crud_dedup_prune(void);
+	// Drop entries not worth keeping once references are counted
+
+uint32_t crud_dedup_encode(char **buf);
+	// Encode the index for storing, returns the length (buf from the pool)
+
+int crud_dedup_dirty(void);
+	// Check if the index changed since it was last encoded
+
+void crud_dedup_reset(void);
+	// Forget every entry
+
+void crud_dedup_log_stats(void);
+	// Log the dedup counters
+
+//
+// Dedup Global Data
+
+extern CrudDedupStats crud_dedup_stats; // The dedup statistics
+
+#endif
@@ -33,7 +33,10 @@ typedef enum {
 	CRUD_DELETE  = 5, // Delete an object
 	CRUD_CLOSE   = 6, // Close the CRUD device
 	CRUD_UNKNOWN = 7, // Unknown type
-	CRUD_MAXVAL  = 8, // Max value
+	CRUD_READ_RANGE = 8, // Read a byte range of an object (extension)
+	CRUD_BATCH   = 9, // Run a batch of requests in one exchange (extension)
+	CRUD_WRITE_RANGE = 10, // Write a byte range of an object (extension)
+	CRUD_MAXVAL  = 11, // Max value
 } CRUD_REQUEST_TYPES;
 const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL];
 
@@ -41,7 +44,10 @@ const char *CRUD_REQUEST_TYPE_LABLES[CRUD_MAXVAL];
 typedef enum {
 	CRUD_NULL_FLAG       = 0,  // This is the "no flag" flag
 	CRUD_PRIORITY_OBJECT = 1,  // Flag indicating that object is a "priority object"
-	CRUD_FLAGMAX         = 2,  // Max value
+	CRUD_TAGGED          = 2,  // A tag follows the header on the wire (extension)
+	CRUD_COMPRESSED      = 4,  // The payload on the wire is compressed (extension)
+	CRUD_NEGOTIATE       = 4,  // On CRUD_INIT, asks for the protocol extensions (extension)
+	CRUD_FLAGMAX         = 8,  // Max value
 } CRUD_FLAG_TYPES;
 const char *CRUD_FLAG_TYPE_LABLES[CRUD_FLAGMAX];
 
@@ -66,9 +72,50 @@ typedef uint64_t CrudResponse;
    0-31 - OID - the object ID (0 if not relevant)
   32-35 - Request type - this is the request type (CRUD_REQUEST_TYPES)
   36-59 - Length - this is the size of the object in bytes
-  60-62 - Flags - these are flags for commands (UNUSED)
+  60-62 - Flags - these are flags for commands (CRUD_FLAG_TYPES)
      63 - R - this is the result bit (0 success, 1 is failure)
 
+ Extension requests (only sent when the server grants them at CRUD_INIT,
+ see crud_network.h):
+
+  CRUD_READ_RANGE - the header is followed by a 32-bit offset (network byte
+                    order).  Length is the number of bytes wanted starting at
+                    the offset.  The response length is the number of bytes
+                    actually returned (short at the end of the object), and
+                    that many bytes follow the response.
+
+  CRUD_BATCH      - Length is the number of requests that follow (at most
+                    CRUD_BATCH_MAX_OPS), each framed as it would be on its
+                    own (header, then any offset or payload).  The server
+                    reads the whole batch, runs the requests in order and
+                    answers with a CRUD_BATCH response (length is the count)
+                    followed by each response and any payload, in order.
+                    Only CREATE, READ, UPDATE, DELETE, READ_RANGE and
+                    WRITE_RANGE may be batched, anything else fails.
+
+  CRUD_WRITE_RANGE - the header is followed by a 32-bit offset (network
+                    byte order), then Length bytes to place in the object
+                    starting at the offset.  The range must lie within the
+                    object (its size does not change).  The response length
+                    is the number of bytes written.
+
+  CRUD_COMPRESSED - (flag) on a CREATE or UPDATE, the payload is sent
+                    compressed (crud_compress.h): a 32-bit compressed size
+                    (network byte order), then that many bytes.  Length is
+                    still the object size.  On a READ or READ_RANGE the flag
+                    says the client will take a compressed reply, and the
+                    server sets it on the response if it sent one (framed the
+                    same way).  Compression is never required, either side
+                    may send a payload raw.
+
+  CRUD_TAGGED     - (flag) the header is followed by a 32-bit tag (network
+                    byte order), ahead of any offset or payload.  The server
+                    sets the flag on the response and sends the same tag
+                    after it, so a client may have many requests in flight
+                    on one connection and match each response to its
+                    request.  A tagged CRUD_BATCH carries one tag for the
+                    whole batch, the requests in it are not tagged.
+
 */
 
 //
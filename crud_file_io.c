@@ -1,6 +1,6 @@
 ////////////////////////////////////////////////////////////////////////////////
 //
-//  File           : crud_file_io.h
+//  File           : crud_file_io.c
 //  Description    : This is the implementation of the standardized IO functions
 //                   for used to access the CRUD storage system.
 //
@@ -9,18 +9,39 @@
 //
 
 // Includes
+#include <stdio.h>
+#include <stdlib.h>
 #include <malloc.h>
 #include <string.h>
+#include <pthread.h>
 
 // Project Includes
 #include <crud_file_io.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 #include <crud_network.h>
+#include <crud_cache.h>
+#include <crud_buffer.h>
+#include <crud_dedup.h>
+#include <crud_pack.h>
 
 // Defines
 #define CIO_UNIT_TEST_MAX_WRITE_SIZE 1024
 #define CRUD_IO_UNIT_TEST_ITERATIONS 10240
+#define CRUD_PACK_UNIT_TEST_FILES 64  // Small files written by the packing test
+#define CRUD_PACK_UNIT_TEST_SIZE 4096 // Packing threshold used by the test
+#define CRUD_INLINE_UNIT_TEST_FILES 32 // Tiny files written by the inline test
+#define CRUD_INLINE_UNIT_TEST_SIZE 128 // Inline threshold used by the test
+#define CRUD_LIST_UNIT_TEST_FILES 48   // Files created in each directory by the listing test
+#define CRUD_THREAD_UNIT_TEST_THREADS 8  // Threads run at once by the threading test
+#define CRUD_THREAD_UNIT_TEST_RECORDS 64 // Records each thread appends to the shared file
+#define CRUD_THREAD_UNIT_TEST_RECORD 48  // Bytes in each record
+#define CRUD_NAME_POOL_INITIAL 4096 // Bytes first allocated to the name pool
+#define CRUD_TABLE_MIN_OBJECT 512   // Smallest table page/directory object
+#define CRUD_TABLE_ENTRY_MAX (2+CRUD_MAX_PATH_LENGTH+4+4+2+CRUD_MAX_FILE_EXTENTS*sizeof(CrudOID)+4+4+4+2+CRUD_INLINE_MAX)
+#define CRUD_TABLE_PAGE_MAX (sizeof(uint32_t)+CRUD_TABLE_PAGE_FILES*CRUD_TABLE_ENTRY_MAX)
+#define CRUD_FILE_NAME(fd) (&crud_name_pool[crud_file_table[fd].name])
+#define CRUD_LEGACY_UNIT_TEST_FILES 4  // Files in the first release table built by the upgrade test
 
 // Other definitions
 
@@ -34,7 +55,12 @@ typedef enum {
 
 // File system Static Data
 // This the definition of the file table
-CrudFileAllocationType crud_file_table[CRUD_MAX_TOTAL_FILES]; // The file handle table
+CrudFileAllocationType *crud_file_table = NULL; // The file handle table
+uint32_t crud_file_count = 0;                   // Entries in use
+uint32_t crud_file_slots = 0;                   // Entries allocated
+char *crud_name_pool = NULL;                    // The filenames, NUL terminated
+uint32_t crud_name_pool_used = 0;               // Bytes in use in the name pool
+uint32_t crud_name_pool_size = 0;               // Bytes allocated to the name pool
 
 // Pick up these definitions from the unit test of the crud driver
 CrudRequest construct_crud_request(CrudOID oid, CRUD_REQUEST_TYPES req,
@@ -55,12 +81,124 @@ struct GenResponse {
 	int succeed;
 };
 
+// This is one thread of the threading unit test
+typedef struct {
+	pthread_t thread; // The thread
+	uint16_t  id;     // Its number
+	int32_t   shared; // The handle of the file all the threads append to
+	uint32_t  length; // Bytes written to its own file
+	char     *data;   // What it wrote there
+	int       failed; // Flag indicating something went wrong
+} CrudThreadUnitTest;
+
 // Function prototypes
 CrudRequest create_crud_request(int32_t, int, int32_t, int, int);
+uint32_t crud_extent_span(uint32_t, uint32_t);
+uint32_t crud_extent_allocation(uint32_t, uint32_t);
+int crud_extent_read(int32_t, uint32_t, uint32_t, const struct iovec *, int, uint32_t, uint32_t);
+char *crud_scratch_buffer(uint32_t);
+int crud_extent_write(int32_t, uint32_t, uint32_t, const struct iovec *, int, uint32_t, uint32_t);
+void crud_extent_release(CrudOID);
+void crud_dedup_count(void);
+int crudDedupUnitTest(char *, char *);
+int crud_pack_ranged(void);
+int crud_pack_read(int32_t, uint32_t, const struct iovec *, int, uint32_t, uint32_t);
+int crud_pack_write(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+int crud_pack_store(CrudOID, uint32_t, char *, uint32_t);
+int crud_pack_slice(uint32_t, CrudOID *, uint32_t *);
+void crud_pack_release(CrudOID, uint32_t);
+void crud_pack_count(void);
+int crud_pack_repack(void);
+int crudPackUnitTest(char *, char *);
+int crud_inline_write(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+int crudInlineUnitTest(char *, char *);
+int crudListUnitTest(void);
+int crudThreadUnitTest(void);
+void *crud_thread_unit_test_worker(void *);
+int crud_list_unit_test_callback(const CrudFileStat *, void *);
+int crud_read_extents(int32_t, uint32_t, const struct iovec *, int, uint32_t, uint32_t);
+int crud_read_ahead(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+void crud_read_ahead_reset(int32_t);
+int crud_write_extents(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+int crud_flush_all(void);
+int crud_flush_all_locked(void);
+int16_t crud_flush_file(int32_t);
+int crud_flush_batchable(int32_t);
+int crud_flush_files(int32_t *, uint32_t);
+uint16_t crud_format_locked(void);
+uint16_t crud_mount_locked(void);
+uint16_t crud_checkpoint_locked(void);
+uint32_t crud_file_length(int32_t);
+int crud_dirty_insert(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+int crud_dirty_covers(int32_t, uint32_t, uint32_t);
+void crud_dirty_overlay(int32_t, uint32_t, const struct iovec *, int, uint32_t);
+void crud_iov_gather(const struct iovec *, int, uint32_t, char *, uint32_t);
+void crud_iov_scatter(const struct iovec *, int, uint32_t, char *, uint32_t);
+char *crud_iov_span(const struct iovec *, int, uint32_t, uint32_t);
+int32_t crud_iov_length(const struct iovec *, int);
+void crud_index_build(void);
+int32_t crud_index_find(char *);
+void crud_index_insert(int32_t);
+int crud_order_compare(const void *, const void *);
+void crud_order_build(void);
+uint32_t crud_order_lower(char *);
+void crud_order_insert(int32_t);
+void crud_stat_fill(int32_t, CrudFileStat *);
+void crud_table_touch(int32_t);
+int crud_table_grow(uint32_t);
+void crud_table_reset(void);
+int32_t crud_file_add(char *);
+int crud_extent_slot(int32_t, uint32_t);
+uint32_t crud_table_encode_page(uint32_t, char *);
+int crud_table_decode_page(uint32_t, char *, uint32_t);
+int crud_table_store(CrudOID *, uint32_t *, void *, uint32_t);
+int crud_table_load(void);
+int crud_table_load_legacy(void);
+int crud_table_retire(CrudOID);
+int crudLegacyUnitTest(char *, char *);
+int crud_legacy_unit_test_clear(void);
+int crud_legacy_unit_test_create(CrudOID *, void *, uint32_t, int);
+int crud_legacy_unit_test_check(uint32_t, uint32_t *, char *, char *);
+int crud_table_store_op(CrudBatchOp *, CrudOID, uint32_t, void *, uint32_t);
+int crud_table_store_done(CrudBatchOp *, CrudOID *, uint32_t *);
+CrudBatchOp *crud_batch_alloc(uint32_t);
+void crud_batch_free(CrudBatchOp *, uint32_t);
 void extract_crud_response(CrudResponse, int32_t*, int*, int32_t*, int*, int*);
 
+// A buffered write (write-back mode), kept per file sorted by offset
+typedef struct CrudDirtyRange {
+	uint32_t               offset; // Where in the file the bytes go
+	uint32_t               length; // The number of bytes
+	char                  *data;   // The bytes
+	struct CrudDirtyRange *next;   // The next range in the file
+} CrudDirtyRange;
+
 // Global Variables
 int isInit = 0;
+uint32_t crud_write_back_budget = 0;                  // Bytes to buffer before flushing (0 = off)
+uint32_t crud_inline_threshold = 0;                   // Largest file held in its table entry (0 = off)
+CrudInlineStats crud_inline_stats;                    // The inline file counters
+uint32_t crud_dirty_bytes = 0;                        // Bytes currently buffered
+CrudDirtyRange **crud_dirty_ranges = NULL;            // The buffered writes for each file
+CrudWriteBackStats crud_write_back_stats;             // The write-back counters
+int32_t *crud_path_index = NULL;                      // Path hash index (fd+1, 0 = empty)
+uint32_t crud_path_index_size = 0;                    // Power of two, twice the table slots
+int32_t *crud_name_order = NULL;                      // File handles sorted by filename
+uint32_t crud_name_ordered = 0;                       // Entries in the sorted order
+CrudTableSuperblock crud_table_super;                 // The stored table superblock
+CrudTablePage *crud_table_pages = NULL;               // The objects holding the table pages (directory)
+uint8_t *crud_table_dirty = NULL;                     // Pages changed since the last checkpoint
+uint32_t crud_table_stored = 0;                       // The size of the stored superblock (the priority object)
+uint8_t crud_table_upgrade = 0;                       // The stored table is the first release's, rewrite it whole
+CrudOID *crud_table_retired = NULL;                   // Objects only the older table used, deleted once it is replaced
+uint32_t crud_table_retired_count = 0;                // Entries in use
+uint32_t crud_table_retired_slots = 0;                // Entries allocated
+pthread_rwlock_t crud_table_lock = PTHREAD_RWLOCK_INITIALIZER; // Held shared by file operations, exclusive to change the table
+pthread_mutex_t crud_meta_mutex = PTHREAD_MUTEX_INITIALIZER;   // Guards the dirty byte count, counters and page flags
+pthread_mutex_t crud_pack_mutex = PTHREAD_MUTEX_INITIALIZER;   // Serializes whole container rewrites (no range extensions)
+CrudReadStats crud_read_stats;                        // The read path counters
+__thread char *crud_scratch = NULL;                   // This thread's buffer for reads that do not line up
+__thread uint32_t crud_scratch_size = 0;              // The size of the scratch buffer
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -72,19 +210,34 @@ int isInit = 0;
 // Outputs      : 0 if successful, -1 if failure
 
 uint16_t crud_format(void) {
+	uint16_t ret;
+
+	pthread_rwlock_wrlock(&crud_table_lock);
+	ret = crud_format_locked();
+	pthread_rwlock_unlock(&crud_table_lock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_format_locked
+// Description  : Format the drive and create an empty table (the caller holds the table
+//                write lock)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_format_locked(void) {
 	// Check if CRUD is initialized, if not, call CRUD_INIT
 	if(isInit == 0) {
 		CrudRequest initRequest = create_crud_request( 0, CRUD_INIT, 0, 0, 0 );
-		crud_client_operation( initRequest, NULL );
+		crud_cache_operation( initRequest, NULL );
 		isInit = 1;
 	}
-	
-	// Create temp buff
-	void* tempBuff = calloc(CRUD_MAX_TOTAL_FILES, sizeof(CrudFileAllocationType));
 
 	// Format priority object
 	CrudRequest formatRequest = create_crud_request( 0, CRUD_FORMAT, 0, CRUD_NULL_FLAG, 0 );
-	CrudResponse formatResponse = crud_client_operation( formatRequest, NULL );
+	CrudResponse formatResponse = crud_cache_operation( formatRequest, NULL );
 
 	struct GenResponse response;
 
@@ -92,33 +245,26 @@ uint16_t crud_format(void) {
 	extract_crud_response( formatResponse, &response.objectId, &response.request, &response.length,
 			&response.flag, &response.succeed );
 	if( response.succeed != 0 ) {
-		return -1;	
+		return -1;
 	}
 
-	// Empty table
-	int i=0;
-	for( i=0; i<CRUD_MAX_TOTAL_FILES; i++ ){
-		strcpy(crud_file_table[i].filename,"");
-		crud_file_table[i].object_id = 0;
-		crud_file_table[i].position = 0;
-		crud_file_table[i].length = 0;
-		crud_file_table[i].open = 0;
-	}
+	// Empty table, no pages are stored until files are created
+	crud_table_reset();
+	crud_table_super.magic = CRUD_TABLE_MAGIC;
+	crud_table_super.version = CRUD_TABLE_VERSION;
 
-	// Place new table in object store
-	CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, sizeof(CrudFileAllocationType)*CRUD_MAX_TOTAL_FILES,
+	// Place the superblock in object store
+	CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, sizeof(CrudTableSuperblock),
 			CRUD_PRIORITY_OBJECT, 0 );
-	CrudResponse createResponse = crud_client_operation( createRequest, tempBuff );
+	CrudResponse createResponse = crud_cache_operation( createRequest, &crud_table_super );
 
 	// Check to make sure that the CRUD_CREATE succeeded
-	extract_crud_response( createResponse, &response.objectId, &response.request, &response.length, 
+	extract_crud_response( createResponse, &response.objectId, &response.request, &response.length,
 			&response.flag, &response.succeed );
 	if(response.succeed != 0) {
 		return -1;
 	}
-
-	free(tempBuff);
-	tempBuff = NULL;
+	crud_table_stored = sizeof(CrudTableSuperblock);
 
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... formatting complete.");
@@ -135,39 +281,420 @@ uint16_t crud_format(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 uint16_t crud_mount(void) {
+	uint16_t ret;
+
+	pthread_rwlock_wrlock(&crud_table_lock);
+	ret = crud_mount_locked();
+	pthread_rwlock_unlock(&crud_table_lock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_mount_locked
+// Description  : Mount the file system and load the table (the caller holds the table
+//                write lock)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_mount_locked(void) {
+	uint32_t files, pages;
+
 	// Check if CRUD is initialized, if not, call CRUD_INIT
 	if(isInit == 0) {
 		CrudRequest initRequest = create_crud_request( 0, CRUD_INIT, 0, 0, 0 );
-		crud_client_operation( initRequest, NULL );
+		crud_cache_operation( initRequest, NULL );
 		isInit = 1;
 	}
 
-	// Create temp buffer
-	void* tempBuff = calloc(CRUD_MAX_TOTAL_FILES, sizeof(CrudFileAllocationType));
-
-	// Get table from priority object
-	CrudRequest pullRequest = create_crud_request( 0, CRUD_READ, sizeof(CrudFileAllocationType)*CRUD_MAX_TOTAL_FILES,
+	// Get superblock from priority object
+	crud_table_reset();
+	CrudRequest pullRequest = create_crud_request( 0, CRUD_READ, sizeof(CrudTableSuperblock),
 			CRUD_PRIORITY_OBJECT, 0 );
-	CrudResponse pullResponse = crud_client_operation( pullRequest, tempBuff );
+	CrudResponse pullResponse = crud_cache_operation( pullRequest, &crud_table_super );
 
 	struct GenResponse response;
 
-	// Check to make sure the CRUD_READ succeeded and extract the values
+	// Load the table this superblock locates, if it is one we can read, otherwise
+	// (the priority object is too large for a superblock) the first release's table
 	extract_crud_response( pullResponse, &response.objectId, &response.request, &response.length,
 			&response.flag, &response.succeed );
-	if( response.succeed != 0 ) {
+	if( (response.succeed == 0) && (response.length == sizeof(CrudTableSuperblock)) &&
+			(crud_table_super.magic == CRUD_TABLE_MAGIC) && (crud_table_super.version == CRUD_TABLE_VERSION) ) {
+		crud_table_stored = response.length;
+		if( crud_table_load() ) {
+			crud_table_reset();
+			return -1;
+		}
+	} else if( (response.succeed != 0) && (crud_table_load_legacy() == 0) ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD mount : read the first release's file table.");
+	} else {
+		logMessage(LOG_ERROR_LEVEL, "CRUD mount : no file table of version %d found, format needed.",
+				CRUD_TABLE_VERSION);
+		crud_table_reset();
+		return -1;
+	}
+	files = crud_file_count;
+
+	// Count the files sharing each object, so shared objects are copied on write,
+	// and the slices in use in each container
+	crud_dedup_count();
+	crud_pack_count();
+
+	// Sort the names once, crud_open keeps them sorted from here on
+	crud_order_build();
+
+	// Nothing has changed since the table was stored, unless it is the first
+	// release's, then every page is written (and the superblock replaced) next time
+	pages = (crud_file_slots + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES;
+	memset(crud_table_dirty, crud_table_upgrade, pages);
+	if( crud_table_upgrade ) {
+		logMessage(LOG_INFO_LEVEL, "CRUD mount : file table upgraded at the next checkpoint.");
+		crud_table_super.magic = CRUD_TABLE_MAGIC;
+		crud_table_super.version = CRUD_TABLE_VERSION;
+	}
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "... mount complete (%u files).", files);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_load
+// Description  : Read the directory and pages the superblock locates into the
+//                (empty) table
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_load(void) {
+	uint32_t page, files, count;
+	struct GenResponse response;
+	CrudBatchOp *ops;
+	char *tempBuff;
+
+	files = crud_table_super.files;
+	if( crud_table_grow(files) ) {
+		return -1;
+	}
+
+	// Get the page directory
+	if( crud_table_super.pages > 0 ) {
+		tempBuff = crud_buffer_alloc(crud_table_super.dir_size);
+		CrudRequest dirRequest = create_crud_request( crud_table_super.directory, CRUD_READ,
+				crud_table_super.dir_size, 0, 0 );
+		CrudResponse dirResponse = crud_cache_operation( dirRequest, tempBuff );
+		extract_crud_response( dirResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( (response.succeed != 0) || (crud_table_super.pages*sizeof(CrudTablePage) > response.length) ||
+				(crud_table_super.pages*CRUD_TABLE_PAGE_FILES < files) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD mount : failed to read file table directory.");
+			crud_buffer_free(tempBuff);
+			return -1;
+		}
+		memcpy(crud_table_pages, tempBuff, crud_table_super.pages*sizeof(CrudTablePage));
+		crud_buffer_free(tempBuff);
+	}
+
+	// Read all the pages (and the dedup index) in one batch, then add their files to the table
+	count = crud_table_super.pages + (crud_table_super.dedup != CRUD_NO_OBJECT);
+	if( (ops = crud_batch_alloc(count)) == NULL ) {
+		return -1;
+	}
+	for( page=0; page<crud_table_super.pages; page++ ) {
+		ops[page].request = create_crud_request( crud_table_pages[page].object, CRUD_READ,
+				crud_table_pages[page].size, 0, 0 );
+		if( (ops[page].buf = crud_buffer_alloc(crud_table_pages[page].size)) == NULL ) {
+			crud_batch_free(ops, count);
+			return -1;
+		}
+	}
+	if( crud_table_super.dedup != CRUD_NO_OBJECT ) {
+		ops[page].request = create_crud_request( crud_table_super.dedup, CRUD_READ, crud_table_super.dedup_size, 0, 0 );
+		if( (ops[page].buf = crud_buffer_alloc(crud_table_super.dedup_size)) == NULL ) {
+			crud_batch_free(ops, count);
+			return -1;
+		}
+	}
+	crud_cache_batch( ops, count );
+	for( page=0; page<crud_table_super.pages; page++ ) {
+		extract_crud_response( ops[page].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( (response.succeed != 0) || crud_table_decode_page(page, ops[page].buf, response.length) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD mount : failed to read file table page %u.", page);
+			crud_batch_free(ops, count);
+			return -1;
+		}
+	}
+	if( crud_table_super.dedup != CRUD_NO_OBJECT ) {
+		extract_crud_response( ops[page].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( (response.succeed != 0) || crud_dedup_load(ops[page].buf, response.length) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD mount : failed to read dedup index.");
+			crud_batch_free(ops, count);
+			return -1;
+		}
+	}
+	crud_batch_free(ops, count);
+	if( crud_file_count != files ) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD mount : file table holds %u files, expected %u.", crud_file_count, files);
+		return -1;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_load_legacy
+// Description  : Read the first release's fixed table from the priority
+//                object into the (empty) table.  A file of up to an extent
+//                keeps its object as its one extent, a larger one is copied
+//                into extents, and the objects no longer used are deleted
+//                once the upgraded table is stored.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure (or there is no such table)
+
+int crud_table_load_legacy(void) {
+	uint32_t size = CRUD_LEGACY_TABLE_FILES*sizeof(CrudLegacyFileEntry), i;
+	CrudLegacyFileEntry *table;
+	struct GenResponse response;
+	struct iovec iov;
+	int32_t fd;
+	int ret = 0;
+
+	// The table is the whole priority object
+	if( (table = crud_buffer_alloc(size)) == NULL ) {
+		return -1;
+	}
+	CrudRequest pullRequest = create_crud_request( 0, CRUD_READ, size, CRUD_PRIORITY_OBJECT, 0 );
+	CrudResponse pullResponse = crud_cache_operation( pullRequest, table );
+	extract_crud_response( pullResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if( (response.succeed != 0) || (response.length != size) ) {
+		crud_buffer_free(table);
+		return -1;
+	}
+	crud_table_stored = size;
+	crud_table_upgrade = 1;
+
+	// Add the files in order, up to the first empty entry
+	for( i=0; (i<CRUD_LEGACY_TABLE_FILES) && (table[i].filename[0] != '\0') && (ret == 0); i++ ) {
+		table[i].filename[CRUD_MAX_PATH_LENGTH-1] = '\0';
+		if( (table[i].length > CRUD_MAX_OBJECT_SIZE) || ((fd = crud_file_add(table[i].filename)) == -1) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD mount : bad first release table entry %u.", i);
+			ret = -1;
+		} else if( (table[i].length > 0) && (table[i].length <= CRUD_EXTENT_SIZE) ) {
+			if( crud_extent_slot(fd, 0) ) {
+				ret = -1;
+			} else {
+				crud_file_table[fd].extents[0] = table[i].object_id;
+				crud_file_table[fd].length = crud_file_table[fd].capacity = table[i].length;
+			}
+		} else if( crud_table_retire(table[i].object_id) ) {
+			ret = -1;
+		} else if( table[i].length > 0 ) {
+			if( (iov.iov_base = crud_buffer_alloc(table[i].length)) == NULL ) {
+				ret = -1;
+				continue;
+			}
+			iov.iov_len = table[i].length;
+			CrudRequest readRequest = create_crud_request( table[i].object_id, CRUD_READ, table[i].length, 0, 0 );
+			CrudResponse readResponse = crud_cache_operation( readRequest, iov.iov_base );
+			extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+					&response.flag, &response.succeed );
+			if( (response.succeed != 0) || (response.length != table[i].length) ||
+					crud_write_extents(fd, 0, &iov, 1, table[i].length) ) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD mount : failed to copy first release file [%s].",
+						table[i].filename);
+				ret = -1;
+			}
+			crud_buffer_free(iov.iov_base);
+		}
+	}
+	crud_buffer_free(table);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_retire
+// Description  : Remember an object the first release's table uses but the
+//                upgraded one does not, to delete once the upgrade is stored
+//
+// Inputs       : oid - the object
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_retire(CrudOID oid) {
+	uint32_t slots = crud_table_retired_slots;
+	CrudOID *retired;
+
+	if( crud_table_retired_count == slots ) {
+		slots = (slots == 0) ? CRUD_INITIAL_TABLE_FILES : slots*2;
+		if( (retired = realloc(crud_table_retired, slots*sizeof(CrudOID))) == NULL ) {
+			return -1;
+		}
+		crud_table_retired = retired;
+		crud_table_retired_slots = slots;
+	}
+	crud_table_retired[crud_table_retired_count++] = oid;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_checkpoint
+// Description  : This function writes the pages of the file allocation table
+//                changed since the last checkpoint to the object store (and
+//                the directory and superblock if they changed too).
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_checkpoint(void) {
+	uint16_t ret;
+
+	pthread_rwlock_wrlock(&crud_table_lock);
+	ret = crud_checkpoint_locked();
+	pthread_rwlock_unlock(&crud_table_lock);
+	return(ret);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_checkpoint_locked
+// Description  : Write the changed parts of the table (the caller holds the table
+//                write lock)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+uint16_t crud_checkpoint_locked(void) {
+	uint32_t page, pages, length, count, written = 0;
+	CrudBatchOp *ops = NULL;
+	int superDirty = 0, dirDirty = 0;
+	struct GenResponse response;
+	char *tempBuff;
+
+	// Write out anything still buffered so the table matches the store
+	if( crud_flush_all_locked() ) {
+		return -1;
+	}
+
+	// Repack the containers that are mostly dead space (on failure they are
+	// left as they were, to try again next time)
+	crud_pack_repack();
+
+	// Write the dirty pages in one batch, each in place if it still fits
+	pages = (crud_file_count + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES;
+	for( page=0; page<pages; page++ ) {
+		written += crud_table_dirty[page];
+	}
+	if( (written > 0) && ((ops = crud_batch_alloc(written)) == NULL) ) {
 		return -1;
 	}
-	
-	// Copy info to table
-	memcpy(crud_file_table, tempBuff, CRUD_MAX_TOTAL_FILES*sizeof(CrudFileAllocationType));
-	
-	// Free memory
-	free(tempBuff);
+	tempBuff = crud_buffer_alloc(CRUD_TABLE_PAGE_MAX);
+	for( page=0, count=0; (page<pages) && (count<written); page++ ) {
+		if( !crud_table_dirty[page] ) {
+			continue;
+		}
+		length = crud_table_encode_page(page, tempBuff);
+		if( crud_table_store_op(&ops[count++], crud_table_pages[page].object, crud_table_pages[page].size,
+				tempBuff, length) ) {
+			crud_buffer_free(tempBuff);
+			crud_batch_free(ops, written);
+			return -1;
+		}
+	}
+	crud_buffer_free(tempBuff);
 	tempBuff = NULL;
+	if( written > 0 ) {
+		crud_cache_batch( ops, written );
+	}
+
+	// Record where each page went, then drop the objects replaced
+	for( page=0, count=0; (page<pages) && (count<written); page++ ) {
+		if( !crud_table_dirty[page] ) {
+			continue;
+		}
+		CrudOID oid = crud_table_pages[page].object;
+		if( crud_table_store_done(&ops[count++], &crud_table_pages[page].object, &crud_table_pages[page].size) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD checkpoint : failed to write file table page %u.", page);
+			crud_batch_free(ops, written);
+			return -1;
+		}
+		dirDirty |= (crud_table_pages[page].object != oid);
+		crud_table_dirty[page] = 0;
+	}
+	if( written > 0 ) {
+		crud_batch_free(ops, written);
+	}
+
+	// Write the directory if pages were added or moved
+	if( dirDirty || (pages != crud_table_super.pages) ) {
+		if( crud_table_store(&crud_table_super.directory, &crud_table_super.dir_size, crud_table_pages,
+				pages*sizeof(CrudTablePage)) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD checkpoint : failed to write file table directory.");
+			return -1;
+		}
+		crud_table_super.pages = pages;
+		superDirty = 1;
+	}
+
+	// Write the dedup index if the hashed objects changed
+	if( crud_dedup_dirty() ) {
+		length = crud_dedup_encode(&tempBuff);
+		if( (tempBuff == NULL) || crud_table_store(&crud_table_super.dedup, &crud_table_super.dedup_size,
+				tempBuff, length) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD checkpoint : failed to write dedup index.");
+			crud_buffer_free(tempBuff);
+			return -1;
+		}
+		crud_buffer_free(tempBuff);
+		tempBuff = NULL;
+		superDirty = 1;
+	}
+
+	// Update the superblock if anything it holds changed (replacing the
+	// priority object if it holds the first release's table)
+	if( superDirty || crud_table_upgrade || (crud_table_super.files != crud_file_count) ) {
+		crud_table_super.files = crud_file_count;
+		if( crud_table_stored != sizeof(CrudTableSuperblock) ) {
+			CrudRequest deleteRequest = create_crud_request( 0, CRUD_DELETE, 0, CRUD_PRIORITY_OBJECT, 0 );
+			CrudResponse deleteResponse = crud_cache_operation( deleteRequest, NULL );
+			extract_crud_response( deleteResponse, &response.objectId, &response.request, &response.length,
+					&response.flag, &response.succeed );
+			if( response.succeed != 0 ) {
+				return -1;
+			}
+			crud_table_stored = 0;
+		}
+		CrudRequest updateRequest = create_crud_request( 0, (crud_table_stored == 0) ? CRUD_CREATE : CRUD_UPDATE,
+				sizeof(CrudTableSuperblock), CRUD_PRIORITY_OBJECT, 0 );
+		CrudResponse updateResponse = crud_cache_operation( updateRequest, &crud_table_super );
+		extract_crud_response( updateResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			return -1;
+		}
+		crud_table_stored = sizeof(CrudTableSuperblock);
+	}
+
+	// The upgraded table is stored, drop the objects only the older one used
+	if( crud_table_upgrade ) {
+		for( count=0; count<crud_table_retired_count; count++ ) {
+			CrudRequest deleteRequest = create_crud_request( crud_table_retired[count], CRUD_DELETE, 0, 0, 0 );
+			crud_cache_operation( deleteRequest, NULL );
+		}
+		logMessage(LOG_INFO_LEVEL, "CRUD checkpoint : first release file table upgraded.");
+		crud_table_retired_count = 0;
+		crud_table_upgrade = 0;
+	}
 
 	// Log, return successfully
-	logMessage(LOG_INFO_LEVEL, "... mount complete.");
+	logMessage(LOG_INFO_LEVEL, "... checkpoint complete (%u table pages written).", written);
 	return(0);
 }
 
@@ -181,38 +708,29 @@ uint16_t crud_mount(void) {
 // Outputs      : 0 if successful, -1 if failure
 
 uint16_t crud_unmount(void) {
-	// Create temp buffer
-	void* tempBuff = calloc(CRUD_MAX_TOTAL_FILES, sizeof(CrudFileAllocationType));
-	memcpy(tempBuff, crud_file_table, CRUD_MAX_TOTAL_FILES*sizeof(CrudFileAllocationType));
-
-	// Create CRUD_UPDATE request to write to file
-	CrudRequest updateRequest = create_crud_request( 0, CRUD_UPDATE, sizeof(CrudFileAllocationType)*CRUD_MAX_TOTAL_FILES,
-			CRUD_PRIORITY_OBJECT, 0 );
-	CrudResponse updateResponse = crud_client_operation( updateRequest, tempBuff );
-
 	struct GenResponse response;
 
-	// Check to make sure the CRUD_UPDATE succeeded and extract the values
-	extract_crud_response( updateResponse, &response.objectId, &response.request, &response.length,
-			&response.flag, &response.succeed );
-	if( response.succeed != 0 ) {
-		return -1;	
+	// Save the changed parts of the table
+	pthread_rwlock_wrlock(&crud_table_lock);
+	if( crud_checkpoint_locked() ) {
+		pthread_rwlock_unlock(&crud_table_lock);
+		return -1;
 	}
 
 	// Create CRUD_CLOSE request to save to file
 	CrudRequest closeRequest = create_crud_request( 0, CRUD_CLOSE, 0, CRUD_NULL_FLAG, 0 );
-	CrudResponse closeResponse = crud_client_operation( closeRequest, NULL );
+	CrudResponse closeResponse = crud_cache_operation( closeRequest, NULL );
+	pthread_rwlock_unlock(&crud_table_lock);
 
 	// Check to make sure the CRUD_CLOSE succeeded and extract the values
 	extract_crud_response( closeResponse, &response.objectId, &response.request, &response.length,
 			&response.flag, &response.succeed );
 	if( response.succeed != 0 ) {
-		return -1;	
+		return -1;
 	}
 
-	// Free memory
-	free(tempBuff);
-	tempBuff = NULL;
+	// Hand the idle buffers back now nothing is in flight
+	crud_buffer_trim();
 
 	// Log, return successfully
 	logMessage(LOG_INFO_LEVEL, "... unmount complete.");
@@ -227,245 +745,2666 @@ uint16_t crud_unmount(void) {
 // Inputs       : path - the path "in the storage array"
 // Outputs      : file handle if successful, -1 if failure
 
-int16_t crud_open(char *path) {
-	int i;
+int32_t crud_open(char *path) {
+	int32_t fd;
 
-	// Iterate through the table to see if file exists
-	for( i=0; i<CRUD_MAX_TOTAL_FILES; i++ ){
-		if(strcmp(path,crud_file_table[i].filename)==0){
-			crud_file_table[i].open = 1;
-			crud_file_table[i].position = 0;
-			return i;
-		} else if (strcmp("",crud_file_table[i].filename)==0){
-			break;
-		}
+	// Check the path will fit in the stored table
+	if( strlen(path) >= CRUD_MAX_PATH_LENGTH ) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD open : path [%s] too long.", path);
+		return -1;
 	}
 
-	// Create CRUD_CREATE request and call it to make a object of 0 size
-	CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, 0, 0, 0 );
-	CrudResponse createResponse = crud_client_operation( createRequest, NULL );
-	
-	struct GenResponse response;
-
-	// Check to make sure that the CRUD_CREATE succeeded
-	extract_crud_response( createResponse, &response.objectId, &response.request, &response.length, 
-			&response.flag, &response.succeed );
-	if(response.succeed == 0) { // If succeeded, assign values to objectId and length
-		int fd = i;
-		strcpy(crud_file_table[fd].filename,path);
+	// Look the file up in the path index
+	pthread_rwlock_rdlock(&crud_table_lock);
+	fd = crud_index_find(path);
+	if( fd != -1 ) {
+		pthread_rwlock_wrlock(crud_file_table[fd].lock);
 		crud_file_table[fd].open = 1;
-		crud_file_table[fd].object_id = response.objectId;
-		crud_file_table[fd].length = 0;
 		crud_file_table[fd].position = 0;
+		crud_read_ahead_reset(fd);
+		pthread_rwlock_unlock(crud_file_table[fd].lock);
+		pthread_rwlock_unlock(&crud_table_lock);
 		return fd;
-	} else { 
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+
+	// Not there, add it to the table (unless another thread just did)
+	pthread_rwlock_wrlock(&crud_table_lock);
+	fd = crud_index_find(path);
+	if( fd == -1 ) {
+		if( (fd = crud_file_add(path)) != -1 ) {
+			crud_order_insert(fd);
+		}
+	}
+	if( fd != -1 ) {
+		crud_file_table[fd].open = 1;
+		crud_file_table[fd].position = 0;
+		crud_read_ahead_reset(fd);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_add
+// Description  : Add a new (empty) file to the end of the table, the extents
+//                are created as the file is written
+//
+// Inputs       : path - the filename
+// Outputs      : the file handle, or -1 if failure
+
+int32_t crud_file_add(char *path) {
+	uint32_t length = strlen(path) + 1;
+	int32_t fd;
+	char *pool;
+
+	// Make room in the table and the name pool
+	if( crud_table_grow(crud_file_count + 1) ) {
+		return -1;
+	}
+	if( crud_name_pool_used + length > crud_name_pool_size ) {
+		uint32_t size = (crud_name_pool_size == 0) ? CRUD_NAME_POOL_INITIAL : crud_name_pool_size;
+		while( crud_name_pool_used + length > size ) {
+			size *= 2;
+		}
+		if( (pool = realloc(crud_name_pool, size)) == NULL ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD table : failed to grow name pool to %u bytes.", size);
+			return -1;
+		}
+		crud_name_pool = pool;
+		crud_name_pool_size = size;
+	}
+
+	// Fill in the entry, index it
+	fd = crud_file_count;
+	memset(&crud_file_table[fd], 0x0, sizeof(CrudFileAllocationType));
+	if( (crud_file_table[fd].lock = malloc(sizeof(pthread_rwlock_t))) == NULL ) {
+		return -1;
+	}
+	pthread_rwlock_init(crud_file_table[fd].lock, NULL);
+	if( (crud_file_table[fd].ahead = calloc(1, sizeof(CrudReadAhead))) == NULL ) {
+		pthread_rwlock_destroy(crud_file_table[fd].lock);
+		free(crud_file_table[fd].lock);
 		return -1;
 	}
+	pthread_mutex_init(&crud_file_table[fd].ahead->mutex, NULL);
+	crud_file_count++;
+	crud_file_table[fd].name = crud_name_pool_used;
+	memcpy(&crud_name_pool[crud_name_pool_used], path, length);
+	crud_name_pool_used += length;
+	crud_index_insert(fd);
+	crud_table_touch(fd);
+	return fd;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_close
-// Description  : This function closes the file
+// Function     : crud_table_grow
+// Description  : Make sure the table (and the structures sized with it) has
+//                room for a number of files, doubling the allocation
 //
-// Inputs       : fd - the file handle of the object to close
+// Inputs       : files - the number of files needed
 // Outputs      : 0 if successful, -1 if failure
 
-int16_t crud_close(int16_t fh) {
-	if (fh<0 || fh>=CRUD_MAX_TOTAL_FILES){
-		return -1;
-	} else {
-		crud_file_table[fh].open = 0;
+int crud_table_grow(uint32_t files) {
+	uint32_t slots, pages, oldPages;
+	void *table, *ranges, *dir, *dirty, *index, *order;
+
+	// Already big enough?
+	if( files <= crud_file_slots ) {
 		return 0;
 	}
+	slots = (crud_file_slots == 0) ? CRUD_INITIAL_TABLE_FILES : crud_file_slots;
+	while( slots < files ) {
+		slots *= 2;
+	}
+	pages = (slots + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES;
+	oldPages = (crud_file_slots + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES;
+
+	// Grow each array, the new parts start empty
+	table = realloc(crud_file_table, slots*sizeof(CrudFileAllocationType));
+	if( table != NULL ) {
+		crud_file_table = table;
+	}
+	ranges = realloc(crud_dirty_ranges, slots*sizeof(CrudDirtyRange *));
+	if( ranges != NULL ) {
+		crud_dirty_ranges = ranges;
+		memset(&crud_dirty_ranges[crud_file_slots], 0x0, (slots-crud_file_slots)*sizeof(CrudDirtyRange *));
+	}
+	dir = realloc(crud_table_pages, pages*sizeof(CrudTablePage));
+	if( dir != NULL ) {
+		crud_table_pages = dir;
+		memset(&crud_table_pages[oldPages], 0x0, (pages-oldPages)*sizeof(CrudTablePage));
+	}
+	dirty = realloc(crud_table_dirty, pages);
+	if( dirty != NULL ) {
+		crud_table_dirty = dirty;
+		memset(&crud_table_dirty[oldPages], 0x0, pages-oldPages);
+	}
+	index = realloc(crud_path_index, slots*2*sizeof(int32_t));
+	if( index != NULL ) {
+		crud_path_index = index;
+	}
+	order = realloc(crud_name_order, slots*sizeof(int32_t));
+	if( order != NULL ) {
+		crud_name_order = order;
+	}
+	if( (table == NULL) || (ranges == NULL) || (dir == NULL) || (dirty == NULL) || (index == NULL) ||
+			(order == NULL) ) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD table : failed to grow to %u files.", slots);
+		return -1;
+	}
+
+	// Rehash the names into the larger index
+	crud_file_slots = slots;
+	crud_path_index_size = slots*2;
+	crud_index_build();
+	return 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_read
-// Description  : Reads up to "count" bytes from the file handle "fh" into the
-//                buffer  "buf".
+// Function     : crud_table_reset
+// Description  : Empty the table, dropping any buffered writes (the memory
+//                already allocated is kept for reuse)
 //
-// Inputs       : fd - the file descriptor for the read
-//                buf - the buffer to place the bytes into
-//                count - the number of bytes to read
-// Outputs      : the number of bytes read or -1 if failures
+// Inputs       : none
+// Outputs      : none
+
+void crud_table_reset(void) {
+	CrudDirtyRange *range;
+	uint32_t i;
 
-int32_t crud_read(int16_t fd, void *buf, int32_t count) {
-	// Allocate memory to work with
-	char *tempBuffer = (char*) malloc( crud_file_table[fd].length*sizeof(char) );
+	for( i=0; i<crud_file_count; i++ ) {
+		while( (range = crud_dirty_ranges[i]) != NULL ) {
+			crud_dirty_ranges[i] = range->next;
+			crud_buffer_free(range->data);
+			crud_buffer_free(range);
+		}
+		free(crud_file_table[i].extents);
+		free(crud_file_table[i].inline_data);
+		pthread_rwlock_destroy(crud_file_table[i].lock);
+		free(crud_file_table[i].lock);
+		crud_buffer_free(crud_file_table[i].ahead->data);
+		pthread_mutex_destroy(&crud_file_table[i].ahead->mutex);
+		free(crud_file_table[i].ahead);
+	}
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_dirty_bytes = 0;
+	pthread_mutex_unlock(&crud_meta_mutex);
+	crud_file_count = 0;
+	crud_name_ordered = 0;
+	crud_name_pool_used = 0;
+	memset(&crud_table_super, 0x0, sizeof(CrudTableSuperblock));
+	crud_table_stored = 0;
+	crud_table_upgrade = 0;
+	crud_table_retired_count = 0;
+	crud_dedup_reset();
+	crud_pack_reset();
+	if( crud_file_slots > 0 ) {
+		memset(crud_table_pages, 0x0, (crud_file_slots + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES * sizeof(CrudTablePage));
+		memset(crud_table_dirty, 0x0, (crud_file_slots + CRUD_TABLE_PAGE_FILES - 1) / CRUD_TABLE_PAGE_FILES);
+		crud_index_build();
+	}
+}
 
-	// Create CRUD_READ request and call it
-	CrudRequest readRequest = create_crud_request( crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0 );
-	CrudResponse readResponse = crud_client_operation( readRequest, tempBuffer );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_slot
+// Description  : Make sure a file has room to record an extent's object
+//
+// Inputs       : fd - the file handle
+//                extent - the index of the extent in the file
+// Outputs      : 0 if successful, -1 if failure
 
-	struct GenResponse response;
+int crud_extent_slot(int32_t fd, uint32_t extent) {
+	uint32_t slots = crud_file_table[fd].extent_slots;
+	CrudOID *extents;
 
-	// Check to make sure the CRUD_READ succeeded and extract the values
-	extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
-			&response.flag, &response.succeed );
-	if( response.succeed == 0 ){
-		if( (count+crud_file_table[fd].position)>=crud_file_table[fd].length ){ // In the case that there are not enough bytes
-			memcpy( buf, &tempBuffer[crud_file_table[fd].position], (crud_file_table[fd].length-crud_file_table[fd].position));
-			int tempCount = crud_file_table[fd].length - crud_file_table[fd].position;
-			crud_file_table[fd].position = crud_file_table[fd].length;
-			free(tempBuffer);
-			tempBuffer = NULL;
-			return tempCount;
-		} else {
-			memcpy( buf, &tempBuffer[crud_file_table[fd].position], count );
-			crud_file_table[fd].position += count;
-			free(tempBuffer);
-			tempBuffer = NULL;
-			return count;
-		}
-	} else {
-		free(tempBuffer);
-		tempBuffer = NULL;
+	if( extent < slots ) {
+		return 0;
+	}
+	slots = (slots == 0) ? 1 : slots;
+	while( slots <= extent ) {
+		slots *= 2;
+	}
+	if( (extents = realloc(crud_file_table[fd].extents, slots*sizeof(CrudOID))) == NULL ) {
 		return -1;
 	}
+	memset(&extents[crud_file_table[fd].extent_slots], 0x0, (slots-crud_file_table[fd].extent_slots)*sizeof(CrudOID));
+	crud_file_table[fd].extents = extents;
+	crud_file_table[fd].extent_slots = slots;
+	return 0;
 }
 
-//////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_write
-// Description  : Writes "count" bytes to the file handle "fh" from the
-//                buffer  "buf"
+// Function     : crud_table_encode_page
+// Description  : Encode the entries of one page of the table for storage
 //
-// Inputs       : fd - the file descriptor for the file to write to
-//                buf - the buffer to write
-//                count - the number of bytes to write
-// Outputs      : the number of bytes written or -1 if failure
+// Inputs       : page - the page number
+//                buf - the buffer to encode into (CRUD_TABLE_PAGE_MAX bytes)
+// Outputs      : the number of bytes encoded
+
+uint32_t crud_table_encode_page(uint32_t page, char *buf) {
+	uint32_t fd, last, count, used = sizeof(uint32_t);
+	uint16_t nameLength, extents, inlineLength;
+
+	// The entry count, then each entry
+	last = (page+1)*CRUD_TABLE_PAGE_FILES;
+	last = (last < crud_file_count) ? last : crud_file_count;
+	count = last - page*CRUD_TABLE_PAGE_FILES;
+	memcpy(buf, &count, sizeof(uint32_t));
+	for( fd=page*CRUD_TABLE_PAGE_FILES; fd<last; fd++ ) {
+		nameLength = strlen(CRUD_FILE_NAME(fd));
+		extents = (crud_file_table[fd].capacity + CRUD_EXTENT_SIZE - 1) / CRUD_EXTENT_SIZE;
+		memcpy(&buf[used], &nameLength, sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		memcpy(&buf[used], CRUD_FILE_NAME(fd), nameLength);
+		used += nameLength;
+		memcpy(&buf[used], &crud_file_table[fd].length, sizeof(uint32_t));
+		used += sizeof(uint32_t);
+		memcpy(&buf[used], &crud_file_table[fd].capacity, sizeof(uint32_t));
+		used += sizeof(uint32_t);
+		memcpy(&buf[used], &extents, sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		memcpy(&buf[used], crud_file_table[fd].extents, extents*sizeof(CrudOID));
+		used += extents*sizeof(CrudOID);
+		memcpy(&buf[used], &crud_file_table[fd].pack, sizeof(CrudOID));
+		used += sizeof(CrudOID);
+		if( crud_file_table[fd].pack != CRUD_NO_OBJECT ) {
+			memcpy(&buf[used], &crud_file_table[fd].pack_offset, sizeof(uint32_t));
+			used += sizeof(uint32_t);
+			memcpy(&buf[used], &crud_file_table[fd].pack_size, sizeof(uint32_t));
+			used += sizeof(uint32_t);
+		}
+		inlineLength = (crud_file_table[fd].inline_data != NULL) ? crud_file_table[fd].length : 0;
+		memcpy(&buf[used], &inlineLength, sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		memcpy(&buf[used], crud_file_table[fd].inline_data, inlineLength);
+		used += inlineLength;
+	}
+	return used;
+}
 
-int32_t crud_write(int16_t fd, void *buf, int32_t count) {
-	// Allocate memory to work with
-	char *readBuffer = (char *)malloc(crud_file_table[fd].length*sizeof(char));
-	char *tempBuffer;
-	if (crud_file_table[fd].length >= (count+crud_file_table[fd].position)){
-		tempBuffer = (char *)malloc(crud_file_table[fd].length*sizeof(char));
-	} else {
-		tempBuffer = (char *)malloc((count+crud_file_table[fd].position)*sizeof(char));
-	}
-
-	// Must first read file to prepare for write
-	CrudRequest readRequest = create_crud_request( crud_file_table[fd].object_id, CRUD_READ, crud_file_table[fd].length, 0, 0 );
-	CrudResponse readResponse = crud_client_operation( readRequest, readBuffer );
-
-	struct GenResponse readResponseExtract;
-
-	// Check to make sure the file was read properly
-	extract_crud_response( readResponse, &readResponseExtract.objectId, &readResponseExtract.request,
-			&readResponseExtract.length, &readResponseExtract.flag, &readResponseExtract.succeed );
-	if( readResponseExtract.succeed == 0 ) {
-		// Check the length of the final file
-		if( crud_file_table[fd].length >= (count + crud_file_table[fd].position) ) { // If it is the same size
-			// Prepare buffer to be sent
-			memcpy( tempBuffer, readBuffer, crud_file_table[fd].length);
-			memcpy( &tempBuffer[crud_file_table[fd].position], buf, count );
-
-			// Create CRUD_UPDATE request to write to file
-			CrudRequest updateRequest = create_crud_request( crud_file_table[fd].object_id, CRUD_UPDATE,
-					crud_file_table[fd].length, 0, 0 );
-			CrudResponse updateResponse = crud_client_operation( updateRequest, tempBuffer );
-
-			struct GenResponse updateResponseExtract;
-
-			// Make sure write succeeded
-			extract_crud_response( updateResponse, &updateResponseExtract.objectId, &updateResponseExtract.request,
-					&updateResponseExtract.length, &updateResponseExtract.flag, &updateResponseExtract.succeed );
-			if( updateResponseExtract.succeed == 0 ) {
-				crud_file_table[fd].position += count;
-
-				free(tempBuffer);
-				free(readBuffer);
-				tempBuffer = NULL;
-				readBuffer = NULL;
-				return count;
-			} else {
-				free(readBuffer);
-				free(tempBuffer);
-				tempBuffer = NULL;
-				readBuffer = NULL;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_decode_page
+// Description  : Add the files in a stored page to the table
+//
+// Inputs       : page - the page number
+//                buf - the stored page
+//                length - the size of the stored page
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_decode_page(uint32_t page, char *buf, uint32_t length) {
+	uint32_t i, count, used = sizeof(uint32_t);
+	uint16_t nameLength, extents, inlineLength;
+	char name[CRUD_MAX_PATH_LENGTH];
+	int32_t fd;
+
+	// The page must hold the files that come next in the table
+	if( (length < sizeof(uint32_t)) || (crud_file_count != page*CRUD_TABLE_PAGE_FILES) ) {
+		return -1;
+	}
+	memcpy(&count, buf, sizeof(uint32_t));
+	if( count > CRUD_TABLE_PAGE_FILES ) {
+		return -1;
+	}
+
+	// Decode each entry, checking it lies within the page
+	for( i=0; i<count; i++ ) {
+		if( used + sizeof(uint16_t) > length ) {
+			return -1;
+		}
+		memcpy(&nameLength, &buf[used], sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		if( (nameLength >= CRUD_MAX_PATH_LENGTH) || (used + nameLength + 2*sizeof(uint32_t) + sizeof(uint16_t) > length) ) {
+			return -1;
+		}
+		memcpy(name, &buf[used], nameLength);
+		name[nameLength] = '\0';
+		used += nameLength;
+		if( (fd = crud_file_add(name)) == -1 ) {
+			return -1;
+		}
+		memcpy(&crud_file_table[fd].length, &buf[used], sizeof(uint32_t));
+		used += sizeof(uint32_t);
+		memcpy(&crud_file_table[fd].capacity, &buf[used], sizeof(uint32_t));
+		used += sizeof(uint32_t);
+		memcpy(&extents, &buf[used], sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		if( (extents > CRUD_MAX_FILE_EXTENTS) || (used + extents*sizeof(CrudOID) > length) ||
+				((extents > 0) && crud_extent_slot(fd, extents-1)) ) {
+			return -1;
+		}
+		memcpy(crud_file_table[fd].extents, &buf[used], extents*sizeof(CrudOID));
+		used += extents*sizeof(CrudOID);
+
+		// A packed file has no extents, and its slice must lie in the container
+		if( used + sizeof(CrudOID) > length ) {
+			return -1;
+		}
+		memcpy(&crud_file_table[fd].pack, &buf[used], sizeof(CrudOID));
+		used += sizeof(CrudOID);
+		if( crud_file_table[fd].pack != CRUD_NO_OBJECT ) {
+			if( used + 2*sizeof(uint32_t) > length ) {
 				return -1;
 			}
-		} else { // In the case size increases, we must delete the current file and make new one
-			// Create CRUD_DELETE request
-			memcpy(tempBuffer, readBuffer, (crud_file_table[fd].position + count));
-			CrudRequest deleteRequest = create_crud_request( crud_file_table[fd].object_id, CRUD_DELETE, 
-					0, 0, 0 );
-			CrudResponse deleteResponse = crud_client_operation( deleteRequest, NULL );
-
-			struct GenResponse deleteResponseExtract;
-
-			// Make sure delete succeeded
-			extract_crud_response( deleteResponse, &deleteResponseExtract.objectId, &deleteResponseExtract.request,
-					&deleteResponseExtract.length, &deleteResponseExtract.flag, &deleteResponseExtract.succeed );
-			if( deleteResponseExtract.succeed == 0 ){
-				// Prepare buffer for writing
-				memcpy( &tempBuffer[crud_file_table[fd].position], buf, count );
-
-				// Create CRUD_CREATE request
-				CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE,
-						(count + crud_file_table[fd].position), 0, 0 );
-				CrudResponse createResponse = crud_client_operation( createRequest, tempBuffer );
-
-				struct GenResponse createResponseExtract;
-
-				// Make sure the create succeeded
-				extract_crud_response( createResponse, &createResponseExtract.objectId, &createResponseExtract.request,
-						&createResponseExtract.length, &createResponseExtract.flag, &createResponseExtract.succeed );
-				if( createResponseExtract.succeed == 0 ) {
-					crud_file_table[fd].object_id = createResponseExtract.objectId;
-					crud_file_table[fd].length = createResponseExtract.length;
-					crud_file_table[fd].position += count;
-
-					free(tempBuffer);
-					free(readBuffer);
-					tempBuffer = NULL;
-					readBuffer = NULL;
-					return count;
-				} else {
-					free(readBuffer);
-					free(tempBuffer);
-					readBuffer = NULL;
-					tempBuffer = NULL;
-					return -1;
+			memcpy(&crud_file_table[fd].pack_offset, &buf[used], sizeof(uint32_t));
+			used += sizeof(uint32_t);
+			memcpy(&crud_file_table[fd].pack_size, &buf[used], sizeof(uint32_t));
+			used += sizeof(uint32_t);
+			if( (crud_file_table[fd].capacity != 0) || (crud_file_table[fd].pack_size > CRUD_PACK_CONTAINER_SIZE) ||
+					(crud_file_table[fd].pack_offset > CRUD_PACK_CONTAINER_SIZE - crud_file_table[fd].pack_size) ||
+					(crud_file_table[fd].length > crud_file_table[fd].pack_size) ) {
+				return -1;
+			}
+		}
+
+		// An inline file has its bytes here, and nothing stored elsewhere
+		if( used + sizeof(uint16_t) > length ) {
+			return -1;
+		}
+		memcpy(&inlineLength, &buf[used], sizeof(uint16_t));
+		used += sizeof(uint16_t);
+		if( inlineLength > 0 ) {
+			if( (inlineLength > CRUD_INLINE_MAX) || (inlineLength != crud_file_table[fd].length) ||
+					(used + inlineLength > length) || (crud_file_table[fd].capacity != 0) ||
+					(crud_file_table[fd].pack != CRUD_NO_OBJECT) ||
+					((crud_file_table[fd].inline_data = malloc(CRUD_INLINE_MAX)) == NULL) ) {
+				return -1;
+			}
+			memcpy(crud_file_table[fd].inline_data, &buf[used], inlineLength);
+			used += inlineLength;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_store
+// Description  : Store a table page or directory, updating its object in
+//                place if the encoding fits, otherwise moving it to a new
+//                (power of two sized) object
+//
+// Inputs       : oid - the object (CRUD_NO_OBJECT if none yet), updated
+//                size - the size of the object, updated
+//                buf - the encoding to store
+//                length - the length of the encoding
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_store(CrudOID *oid, uint32_t *size, void *buf, uint32_t length) {
+	CrudBatchOp op;
+	int ret;
+
+	// Send the update or create on its own, then tidy up after it
+	if( crud_table_store_op(&op, *oid, *size, buf, length) ) {
+		return -1;
+	}
+	crud_cache_batch( &op, 1 );
+	ret = crud_table_store_done(&op, oid, size);
+	crud_buffer_free(op.buf);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_store_op
+// Description  : Build the request that stores a table page or directory:
+//                an update of its object if the encoding fits, otherwise the
+//                creation of a new (power of two sized) object
+//
+// Inputs       : op - the batch entry to fill in (buf is from the pool)
+//                oid - the object (CRUD_NO_OBJECT if none yet)
+//                size - the size of the object
+//                buf - the encoding to store
+//                length - the length of the encoding
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_store_op(CrudBatchOp *op, CrudOID oid, uint32_t size, void *buf, uint32_t length) {
+	uint32_t newSize = size;
+
+	// Pick the object size, pad the encoding out to it
+	if( (oid == CRUD_NO_OBJECT) || (length > size) ) {
+		newSize = CRUD_TABLE_MIN_OBJECT;
+		while( newSize < length ) {
+			newSize *= 2;
+		}
+	}
+	if( (op->buf = crud_buffer_alloc(newSize)) == NULL ) {
+		return -1;
+	}
+	memcpy(op->buf, buf, length);
+	memset((char *)op->buf + length, 0x0, newSize - length);
+	op->offset = 0;
+	op->request = (newSize == size) ? create_crud_request( oid, CRUD_UPDATE, newSize, 0, 0 ) :
+			create_crud_request( 0, CRUD_CREATE, newSize, 0, 0 );
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_store_done
+// Description  : Finish storing a table page or directory once its request
+//                has been sent, deleting the old object if it moved
+//
+// Inputs       : op - the completed batch entry
+//                oid - the object, updated if it moved
+//                size - the size of the object, updated if it moved
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_table_store_done(CrudBatchOp *op, CrudOID *oid, uint32_t *size) {
+	struct GenResponse response;
+
+	// Check the store worked
+	extract_crud_response( op->response, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if( response.succeed != 0 ) {
+		return -1;
+	}
+
+	// Moved, the replacement exists so the old one can go
+	if( response.request == CRUD_CREATE ) {
+		if( *oid != CRUD_NO_OBJECT ) {
+			CrudRequest deleteRequest = create_crud_request( *oid, CRUD_DELETE, 0, 0, 0 );
+			crud_cache_operation( deleteRequest, NULL );
+		}
+		*oid = response.objectId;
+		*size = response.length;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_alloc
+// Description  : Allocate the entries of a batch of requests
+//
+// Inputs       : count - the number of requests
+// Outputs      : the (zeroed) entries, or NULL if failure
+
+CrudBatchOp *crud_batch_alloc(uint32_t count) {
+	return( calloc(count, sizeof(CrudBatchOp)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_batch_free
+// Description  : Release a batch of requests and the pool buffers they use
+//
+// Inputs       : ops - the batch
+//                count - the number of requests
+// Outputs      : none
+
+void crud_batch_free(CrudBatchOp *ops, uint32_t count) {
+	uint32_t i;
+
+	for( i=0; i<count; i++ ) {
+		crud_buffer_free(ops[i].buf);
+	}
+	free(ops);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_build
+// Description  : Rebuild the path index from the file table
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_index_build(void) {
+	uint32_t i;
+
+	memset(crud_path_index, 0x0, crud_path_index_size*sizeof(int32_t));
+	for( i=0; i<crud_file_count; i++ ) {
+		crud_index_insert(i);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_find
+// Description  : Look up a path in the index (linear probing)
+//
+// Inputs       : path - the path to find
+// Outputs      : the file handle, or -1 if the file does not exist
+
+int32_t crud_index_find(char *path) {
+	uint32_t slot;
+
+	if( crud_path_index_size == 0 ) {
+		return -1;
+	}
+	slot = stringHash(path) & (crud_path_index_size-1);
+	while( crud_path_index[slot] != 0 ) {
+		if( strcmp(CRUD_FILE_NAME(crud_path_index[slot]-1), path) == 0 ) {
+			return crud_path_index[slot]-1;
+		}
+		slot = (slot+1) & (crud_path_index_size-1);
+	}
+	return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_index_insert
+// Description  : Add a table entry to the path index
+//
+// Inputs       : fd - the file handle (its filename is the key)
+// Outputs      : none
+
+void crud_index_insert(int32_t fd) {
+	uint32_t slot = stringHash(CRUD_FILE_NAME(fd)) & (crud_path_index_size-1);
+
+	while( crud_path_index[slot] != 0 ) {
+		slot = (slot+1) & (crud_path_index_size-1);
+	}
+	crud_path_index[slot] = fd+1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_order_compare
+// Description  : Compare two file handles by filename (for qsort)
+//
+// Inputs       : a - the first file handle
+//                b - the second file handle
+// Outputs      : <0, 0 or >0 as the first name sorts before, with or after the second
+
+int crud_order_compare(const void *a, const void *b) {
+	return strcmp(CRUD_FILE_NAME(*(const int32_t *)a), CRUD_FILE_NAME(*(const int32_t *)b));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_order_build
+// Description  : Sort every file in the table by filename (once, at mount)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_order_build(void) {
+	uint32_t i;
+
+	for( i=0; i<crud_file_count; i++ ) {
+		crud_name_order[i] = i;
+	}
+	qsort(crud_name_order, crud_file_count, sizeof(int32_t), crud_order_compare);
+	crud_name_ordered = crud_file_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_order_lower
+// Description  : Find where a name falls in the sorted order (binary search)
+//
+// Inputs       : path - the name (or prefix) to look for
+// Outputs      : the position of the first file whose name is not below path
+
+uint32_t crud_order_lower(char *path) {
+	uint32_t low = 0, high = crud_name_ordered, mid;
+
+	while( low < high ) {
+		mid = low + (high - low) / 2;
+		if( strcmp(CRUD_FILE_NAME(crud_name_order[mid]), path) < 0 ) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_order_insert
+// Description  : Add a new file to the sorted order (the caller holds the
+//                table write lock)
+//
+// Inputs       : fd - the file handle (its filename is the key)
+// Outputs      : none
+
+void crud_order_insert(int32_t fd) {
+	uint32_t pos = crud_order_lower(CRUD_FILE_NAME(fd));
+
+	memmove(&crud_name_order[pos+1], &crud_name_order[pos], (crud_name_ordered-pos)*sizeof(int32_t));
+	crud_name_order[pos] = fd;
+	crud_name_ordered++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_table_touch
+// Description  : Note that a file's table entry changed, so its page is
+//                written at the next checkpoint
+//
+// Inputs       : fd - the file handle
+// Outputs      : none
+
+void crud_table_touch(int32_t fd) {
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_table_dirty[fd / CRUD_TABLE_PAGE_FILES] = 1;
+	pthread_mutex_unlock(&crud_meta_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_close
+// Description  : This function closes the file
+//
+// Inputs       : fd - the file handle of the object to close
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_close(int32_t fh) {
+	int16_t ret = -1;
+
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if (fh>=0 && fh<(int32_t)crud_file_count){
+		pthread_rwlock_wrlock(crud_file_table[fh].lock);
+		if (crud_flush_file(fh) == 0) {
+			crud_file_table[fh].open = 0;
+			ret = 0;
+		}
+		crud_read_ahead_reset(fh);
+		pthread_rwlock_unlock(crud_file_table[fh].lock);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read
+// Description  : Reads up to "count" bytes from the file handle "fh" into the
+//                buffer  "buf".
+//
+// Inputs       : fd - the file descriptor for the read
+//                buf - the buffer to place the bytes into
+//                count - the number of bytes to read
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_read(int32_t fd, void *buf, int32_t count) {
+	struct iovec iov;
+
+	// A read is a vectored read into a single buffer
+	if( count<0 ) {
+		return -1;
+	}
+	iov.iov_base = buf;
+	iov.iov_len = count;
+	return crud_readv(fd, &iov, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_readv
+// Description  : Reads from the file handle "fh" into a list of buffers,
+//                filling each in turn, as a single read
+//
+// Inputs       : fd - the file descriptor for the read
+//                iov - the buffers to place the bytes into
+//                iovcnt - the number of buffers
+// Outputs      : the number of bytes read or -1 if failures
+
+int32_t crud_readv(int32_t fd, const struct iovec *iov, int iovcnt) {
+	uint32_t position, stored, length;
+	int32_t wanted, count;
+
+	// Check the buffers and file handle, readers share the file
+	if( (wanted = crud_iov_length(iov, iovcnt)) < 0 ) {
+		return -1;
+	}
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if( fd<0 || fd>=(int32_t)crud_file_count ) {
+		pthread_rwlock_unlock(&crud_table_lock);
+		return -1;
+	}
+	pthread_rwlock_rdlock(crud_file_table[fd].lock);
+
+	// Claim the bytes up to the end of the file, so concurrent readers of the
+	// same handle each get their own part of the file
+	length = crud_file_length(fd);
+	position = __atomic_load_n(&crud_file_table[fd].position, __ATOMIC_RELAXED);
+	do {
+		count = (wanted > (int32_t)(length - position)) ? (int32_t)(length - position) : wanted;
+	} while( !__atomic_compare_exchange_n(&crud_file_table[fd].position, &position, position + count,
+			0, __ATOMIC_RELAXED, __ATOMIC_RELAXED) );
+
+	// Get the stored bytes from the server, unless buffered writes cover them
+	stored = crud_file_table[fd].length;
+	if( (position < stored) && !crud_dirty_covers(fd, position, (position+count < stored) ? position+count : stored) ) {
+		if( crud_read_ahead(fd, position, iov, iovcnt, ((position+count < stored) ? position+count : stored) - position) ) {
+			count = -1;
+		}
+	}
+
+	// Lay any buffered writes over the top
+	if( count > 0 ) {
+		crud_dirty_overlay(fd, position, iov, iovcnt, count);
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_read_stats.reads++;
+		crud_read_stats.bytes_read += count;
+		pthread_mutex_unlock(&crud_meta_mutex);
+	}
+	pthread_rwlock_unlock(crud_file_table[fd].lock);
+	pthread_rwlock_unlock(&crud_table_lock);
+	return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write
+// Description  : Writes "count" bytes to the file handle "fh" from the
+//                buffer  "buf"
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                buf - the buffer to write
+//                count - the number of bytes to write
+// Outputs      : the number of bytes written or -1 if failure
+
+int32_t crud_write(int32_t fd, void *buf, int32_t count) {
+	struct iovec iov;
+
+	// A write is a vectored write of a single buffer
+	if( count<0 ) {
+		return -1;
+	}
+	iov.iov_base = buf;
+	iov.iov_len = count;
+	return crud_writev(fd, &iov, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_writev
+// Description  : Writes a list of buffers to the file handle "fh", one after
+//                the other, as a single write.  The buffers are gathered
+//                straight into the extent objects sent to the server.
+//
+// Inputs       : fd - the file descriptor for the file to write to
+//                iov - the buffers to write
+//                iovcnt - the number of buffers
+// Outputs      : the number of bytes written or -1 if failure
+
+int32_t crud_writev(int32_t fd, const struct iovec *iov, int iovcnt) {
+	uint32_t position;
+	int32_t count;
+	int flush = 0;
+
+	// Check the buffers and file handle, writers have the file to themselves
+	if( (count = crud_iov_length(iov, iovcnt)) < 0 ) {
+		return -1;
+	}
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if( fd<0 || fd>=(int32_t)crud_file_count ) {
+		pthread_rwlock_unlock(&crud_table_lock);
+		return -1;
+	}
+	pthread_rwlock_wrlock(crud_file_table[fd].lock);
+
+	// Check that the file will not grow too large
+	position = crud_file_table[fd].position;
+	if( (uint64_t)position + count > CRUD_MAX_FILE_SIZE ) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD write : [%s] would exceed maximum file size %u.",
+				CRUD_FILE_NAME(fd), CRUD_MAX_FILE_SIZE);
+		count = -1;
+
+	// In write-back mode just buffer the write, flushing (below) if over budget
+	} else if( crud_write_back_budget > 0 ) {
+		if( crud_dirty_insert(fd, position, iov, iovcnt, count) ) {
+			count = -1;
+		} else {
+			crud_file_table[fd].position = position + count;
+			pthread_mutex_lock(&crud_meta_mutex);
+			flush = (crud_dirty_bytes > crud_write_back_budget);
+			pthread_mutex_unlock(&crud_meta_mutex);
+		}
+
+	// Otherwise write straight through to the extents
+	} else if( crud_write_extents(fd, position, iov, iovcnt, count) ) {
+		count = -1;
+	} else {
+		crud_file_table[fd].position = position + count;
+	}
+	pthread_rwlock_unlock(crud_file_table[fd].lock);
+	pthread_rwlock_unlock(&crud_table_lock);
+
+	// Flush once the file is released (the flush locks every file it writes)
+	if( flush && crud_flush_all() ) {
+		return -1;
+	}
+	return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush
+// Description  : Write any buffered writes for the file through to the
+//                server.
+//
+// Inputs       : fd - the file descriptor of the file to flush
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_flush(int32_t fd) {
+	int16_t ret = -1;
+
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if( fd>=0 && fd<(int32_t)crud_file_count ) {
+		pthread_rwlock_wrlock(crud_file_table[fd].lock);
+		ret = crud_flush_file(fd);
+		pthread_rwlock_unlock(crud_file_table[fd].lock);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_file
+// Description  : Write a file's buffered writes through to the server (the
+//                caller holds the file exclusively)
+//
+// Inputs       : fd - the file descriptor of the file to flush
+// Outputs      : 0 if successful, -1 if failure
+
+int16_t crud_flush_file(int32_t fd) {
+	CrudDirtyRange *range;
+	uint64_t requests = __atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED);
+	int16_t ret = 0;
+	struct iovec iov;
+
+	// Write each range in order (each starts within what is already stored)
+	while( (range = crud_dirty_ranges[fd]) != NULL ) {
+		iov.iov_base = range->data;
+		iov.iov_len = range->length;
+		if( crud_write_extents(fd, range->offset, &iov, 1, range->length) ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD flush : failed writing [%s] at %u.",
+					CRUD_FILE_NAME(fd), range->offset);
+			ret = -1;
+			break;
+		}
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_write_back_stats.ranges_flushed++;
+		crud_write_back_stats.bytes_flushed += range->length;
+		crud_dirty_bytes -= range->length;
+		pthread_mutex_unlock(&crud_meta_mutex);
+		crud_dirty_ranges[fd] = range->next;
+		crud_buffer_free(range->data);
+		crud_buffer_free(range);
+	}
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_write_back_stats.flush_requests += __atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED) - requests;
+	pthread_mutex_unlock(&crud_meta_mutex);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_batchable
+// Description  : Check if a file's buffered writes can go out in a batch:
+//                a single range rewriting the whole file, which fits in the
+//                first extent (with dedup on, writes go through
+//                crud_extent_write to be hashed).  Files held inline are
+//                written in memory, so are left to crud_flush_file.
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : 1 if the file can be batched, 0 if not
+
+int crud_flush_batchable(int32_t fd) {
+	CrudDirtyRange *range = crud_dirty_ranges[fd];
+
+	return( (range != NULL) && (range->next == NULL) && (range->offset == 0) &&
+			(range->length >= crud_file_table[fd].length) && (range->length <= CRUD_EXTENT_SIZE) &&
+			!crud_dedup_enabled() && (crud_file_table[fd].inline_data == NULL) &&
+			!((crud_file_table[fd].capacity == 0) && (crud_file_table[fd].pack == CRUD_NO_OBJECT) &&
+			(range->length <= crud_inline_threshold)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_files
+// Description  : Write the buffered writes of a set of files through to the
+//                server (the caller holds each file exclusively).  Small
+//                files rewritten whole are sent together in one batch (as
+//                range writes to their container slices if packed), with
+//                the objects they replace deleted in a second; the rest (and
+//                any whose batched write failed) are flushed one by one.
+//
+// Inputs       : fds - the files to flush
+//                count - the number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_flush_files(int32_t *fds, uint32_t count) {
+	uint64_t requests = __atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED);
+	uint32_t i, objectLength, newLength, offset, threshold, batched = 0, deletes = 0;
+	uint32_t *slices = NULL;
+	CrudBatchOp *ops = NULL, *dels = NULL;
+	CrudOID container;
+	int32_t *which = NULL;
+	CrudDirtyRange *range;
+	struct GenResponse response;
+	int ret = 0;
+
+	// Build a create or update of the first extent for each whole file rewrite
+	threshold = crud_pack_get_threshold();
+	if( (count > 1) && ((ops = crud_batch_alloc(count)) != NULL) &&
+			((dels = crud_batch_alloc(count)) != NULL) && ((which = calloc(count, sizeof(int32_t))) != NULL) &&
+			((slices = calloc(count, sizeof(uint32_t))) != NULL) ) {
+		for( i=0; i<count; i++ ) {
+			if( !crud_flush_batchable(fds[i]) ) {
+				continue;
+			}
+			range = crud_dirty_ranges[fds[i]];
+
+			// Packed, write its slice (placing a larger one if it has outgrown it)
+			if( (crud_file_table[fds[i]].pack != CRUD_NO_OBJECT) ||
+					((crud_file_table[fds[i]].capacity == 0) && (range->length <= threshold)) ) {
+				if( !crud_pack_ranged() || (range->length > threshold) ) {
+					continue;
+				}
+				container = crud_file_table[fds[i]].pack;
+				offset = crud_file_table[fds[i]].pack_offset;
+				if( (container == CRUD_NO_OBJECT) || (range->length > crud_file_table[fds[i]].pack_size) ) {
+					slices[batched] = crud_pack_slice_size(range->length);
+					if( crud_pack_slice(slices[batched], &container, &offset) ) {
+						slices[batched] = 0;
+						continue;
+					}
+				}
+				if( (ops[batched].buf = crud_buffer_alloc(range->length)) == NULL ) {
+					if( slices[batched] > 0 ) {
+						crud_pack_release(container, slices[batched]);
+						slices[batched] = 0;
+					}
+					continue;
+				}
+				memcpy( ops[batched].buf, range->data, range->length );
+				ops[batched].offset = offset;
+				ops[batched].request = create_crud_request( container, CRUD_WRITE_RANGE, range->length, 0, 0 );
+				which[batched++] = fds[i];
+				continue;
+			}
+			objectLength = crud_extent_span(crud_file_table[fds[i]].capacity, 0);
+			newLength = crud_extent_allocation(objectLength, range->length);
+			if( (ops[batched].buf = crud_buffer_alloc(newLength)) == NULL ) {
+				continue;
+			}
+			memcpy( ops[batched].buf, range->data, range->length );
+			memset( (char *)ops[batched].buf + range->length, 0x0, newLength - range->length );
+			ops[batched].request = ((objectLength > 0) && (newLength == objectLength) &&
+					!crud_dedup_claim(crud_file_table[fds[i]].extents[0])) ?
+					create_crud_request( crud_file_table[fds[i]].extents[0], CRUD_UPDATE, newLength, 0, 0 ) :
+					create_crud_request( 0, CRUD_CREATE, newLength, 0, 0 );
+			which[batched++] = fds[i];
+		}
+	}
+
+	// Send them together, then record the results as crud_extent_write would
+	if( batched > 0 ) {
+		crud_cache_batch( ops, batched );
+	}
+	for( i=0; i<batched; i++ ) {
+		int32_t fd = which[i];
+		range = crud_dirty_ranges[fd];
+		extract_crud_response( ops[i].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			if( (slices[i] > 0) && crud_pack_free(response.objectId, slices[i]) ) {
+				dels[deletes++].request = create_crud_request( response.objectId, CRUD_DELETE, 0, 0, 0 );
+			}
+			continue;
+		}
+		crud_file_table[fd].ahead->length = 0;
+		if( slices[i] > 0 ) {
+			if( crud_file_table[fd].pack != CRUD_NO_OBJECT ) {
+				if( crud_pack_free(crud_file_table[fd].pack, crud_file_table[fd].pack_size) ) {
+					dels[deletes++].request = create_crud_request( crud_file_table[fd].pack, CRUD_DELETE, 0, 0, 0 );
 				}
+				__atomic_add_fetch(&crud_pack_stats.moved, 1, __ATOMIC_RELAXED);
+			}
+			crud_file_table[fd].pack = response.objectId;
+			crud_file_table[fd].pack_offset = ops[i].offset;
+			crud_file_table[fd].pack_size = slices[i];
+			crud_table_touch(fd);
+		} else if( response.request == CRUD_CREATE ) {
+			if( crud_extent_slot(fd, 0) ) {
+				dels[deletes++].request = create_crud_request( response.objectId, CRUD_DELETE, 0, 0, 0 );
+				continue;
+			}
+			if( (crud_extent_span(crud_file_table[fd].capacity, 0) > 0) &&
+					(crud_dedup_release(crud_file_table[fd].extents[0]) == 0) ) {
+				dels[deletes++].request = create_crud_request( crud_file_table[fd].extents[0], CRUD_DELETE, 0, 0, 0 );
+			}
+			crud_file_table[fd].extents[0] = response.objectId;
+			if( response.length > crud_file_table[fd].capacity ) {
+				crud_file_table[fd].capacity = response.length;
+			}
+			crud_table_touch(fd);
+		}
+		if( range->length > crud_file_table[fd].length ) {
+			crud_file_table[fd].length = range->length;
+			crud_table_touch(fd);
+		}
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_write_back_stats.ranges_flushed++;
+		crud_write_back_stats.bytes_flushed += range->length;
+		crud_dirty_bytes -= range->length;
+		pthread_mutex_unlock(&crud_meta_mutex);
+		crud_dirty_ranges[fd] = NULL;
+		crud_buffer_free(range->data);
+		crud_buffer_free(range);
+	}
+	if( deletes > 0 ) {
+		crud_cache_batch( dels, deletes );
+		for( i=0; i<deletes; i++ ) {
+			extract_crud_response( dels[i].response, &response.objectId, &response.request, &response.length,
+					&response.flag, &response.succeed );
+			if( response.succeed != 0 ) {
+				logMessage(LOG_WARNING_LEVEL, "CRUD flush : failed to delete replaced extent [%u].", response.objectId);
+			}
+		}
+	}
+	if( ops != NULL ) {
+		crud_batch_free(ops, batched);
+	}
+	if( dels != NULL ) {
+		crud_batch_free(dels, 0);
+	}
+	free(which);
+	free(slices);
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_write_back_stats.flush_requests += __atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED) - requests;
+	pthread_mutex_unlock(&crud_meta_mutex);
+
+	// Whatever is left goes one file at a time
+	for( i=0; i<count; i++ ) {
+		if( (crud_dirty_ranges[fds[i]] != NULL) && crud_flush_file(fds[i]) ) {
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_all
+// Description  : Write the buffered writes of every file through to the
+//                server.  The dirty files are locked in ascending order a
+//                group at a time and each group flushed together.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_flush_all(void) {
+	int32_t fds[CRUD_FLUSH_GROUP];
+	uint32_t i, j, count = 0;
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&crud_table_lock);
+	for( i=0; i<=crud_file_count; i++ ) {
+
+		// Flush the group when it is full or there are no more files
+		if( (count == CRUD_FLUSH_GROUP) || ((i == crud_file_count) && (count > 0)) ) {
+			if( crud_flush_files(fds, count) ) {
+				ret = -1;
+			}
+			for( j=0; j<count; j++ ) {
+				pthread_rwlock_unlock(crud_file_table[fds[j]].lock);
+			}
+			count = 0;
+		}
+		if( i == crud_file_count ) {
+			break;
+		}
+
+		// Hold on to the file if it has anything to write
+		pthread_rwlock_wrlock(crud_file_table[i].lock);
+		if( crud_dirty_ranges[i] != NULL ) {
+			fds[count++] = i;
+		} else {
+			pthread_rwlock_unlock(crud_file_table[i].lock);
+		}
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_flush_all_locked
+// Description  : Write the buffered writes of every file through to the
+//                server (the caller holds the table write lock)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_flush_all_locked(void) {
+	int32_t fds[CRUD_FLUSH_GROUP];
+	uint32_t i, count = 0;
+	int ret = 0;
+
+	for( i=0; i<crud_file_count; i++ ) {
+		if( crud_dirty_ranges[i] != NULL ) {
+			fds[count++] = i;
+		}
+		if( (count == CRUD_FLUSH_GROUP) || ((i+1 == crud_file_count) && (count > 0)) ) {
+			if( crud_flush_files(fds, count) ) {
+				ret = -1;
+			}
+			count = 0;
+		}
+	}
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_write_back
+// Description  : Turn write-back buffering on or off.  Writes are held in
+//                per-file dirty ranges until the file is closed or flushed,
+//                the file system unmounted, or the buffered bytes exceed the
+//                budget.
+//
+// Inputs       : budget - the most bytes to hold before flushing (0 = off)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_set_write_back(uint32_t budget) {
+	// Anything buffered goes out before the mode changes
+	pthread_rwlock_wrlock(&crud_table_lock);
+	if( crud_flush_all_locked() ) {
+		pthread_rwlock_unlock(&crud_table_lock);
+		return -1;
+	}
+	crud_write_back_budget = budget;
+	pthread_rwlock_unlock(&crud_table_lock);
+	logMessage(LOG_INFO_LEVEL, "CRUD write-back %s (budget %u bytes).", (budget > 0) ? "enabled" : "disabled", budget);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_back_log_stats
+// Description  : Log the write-back counters, including an estimate of the
+//                server requests saved by coalescing writes.
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_write_back_log_stats(void) {
+	CrudWriteBackStats stats;
+
+	pthread_mutex_lock(&crud_meta_mutex);
+	stats = crud_write_back_stats;
+	pthread_mutex_unlock(&crud_meta_mutex);
+
+	uint64_t cycles = stats.writes_buffered - stats.ranges_flushed;
+	double perRange = (stats.ranges_flushed == 0) ? 0.0 :
+			(double)stats.flush_requests / stats.ranges_flushed;
+
+	logMessage(LOG_INFO_LEVEL, "CRUD write-back : %llu writes buffered (%llu bytes), %llu ranges flushed "
+			"(%llu bytes, %llu requests), ~%.0f requests saved",
+			(unsigned long long)stats.writes_buffered,
+			(unsigned long long)stats.bytes_buffered,
+			(unsigned long long)stats.ranges_flushed,
+			(unsigned long long)stats.bytes_flushed,
+			(unsigned long long)stats.flush_requests, cycles * perRange);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_log_stats
+// Description  : Log the read path counters, including the bytes that had to
+//                be copied through a scratch buffer rather than received in
+//                place.
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_read_log_stats(void) {
+	CrudReadStats stats;
+
+	pthread_mutex_lock(&crud_meta_mutex);
+	stats = crud_read_stats;
+	pthread_mutex_unlock(&crud_meta_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD read : %llu reads (%llu bytes), %llu bytes copied (%.1f per read), "
+			"%llu read-ahead fetches, %llu reads served ahead",
+			(unsigned long long)stats.reads, (unsigned long long)stats.bytes_read,
+			(unsigned long long)stats.bytes_copied,
+			(stats.reads == 0) ? 0.0 : (double)stats.bytes_copied / stats.reads,
+			(unsigned long long)stats.ahead_fetches, (unsigned long long)stats.ahead_hits);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_set_inline
+// Description  : Set the largest file held in its table entry.  Files
+//                already inline stay there until they grow past it.
+//
+// Inputs       : threshold - the largest file held inline (0 = off, at
+//                most CRUD_INLINE_MAX)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_set_inline(uint32_t threshold) {
+	if( threshold > CRUD_INLINE_MAX ) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD inline : threshold %u over the maximum %u.", threshold, CRUD_INLINE_MAX);
+		return -1;
+	}
+	pthread_rwlock_wrlock(&crud_table_lock);
+	crud_inline_threshold = threshold;
+	pthread_rwlock_unlock(&crud_table_lock);
+	logMessage(LOG_INFO_LEVEL, "CRUD inline files %s (threshold %u bytes).", (threshold > 0) ? "enabled" : "disabled", threshold);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_inline_log_stats
+// Description  : Log the inline file counters
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_inline_log_stats(void) {
+	CrudInlineStats stats;
+
+	pthread_mutex_lock(&crud_meta_mutex);
+	stats = crud_inline_stats;
+	pthread_mutex_unlock(&crud_meta_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD inline : %llu writes and %llu reads served from the table (%llu bytes), "
+			"%llu files promoted",
+			(unsigned long long)stats.writes, (unsigned long long)stats.reads,
+			(unsigned long long)stats.bytes, (unsigned long long)stats.promoted);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_file_length
+// Description  : The length of the file as seen by the caller, including any
+//                buffered writes past the stored length.
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : the length of the file
+
+uint32_t crud_file_length(int32_t fd) {
+	CrudDirtyRange *range = crud_dirty_ranges[fd];
+	uint32_t length = crud_file_table[fd].length;
+
+	// The ranges are sorted, so only the last can reach past the end
+	while( (range != NULL) && (range->next != NULL) ) {
+		range = range->next;
+	}
+	if( (range != NULL) && (range->offset + range->length > length) ) {
+		length = range->offset + range->length;
+	}
+	return length;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dirty_insert
+// Description  : Buffer a write, merging it with any dirty ranges of the file
+//                it overlaps or touches so the ranges stay sorted and apart.
+//
+// Inputs       : fd - the file descriptor
+//                position - where in the file the write goes
+//                iov - the buffers written
+//                iovcnt - the number of buffers
+//                count - the number of bytes written
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_dirty_insert(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	CrudDirtyRange **walk, *first, *range, *merged;
+	uint32_t start = position, end = position + count, released = 0;
+
+	// Find the first range that ends at or after the write
+	walk = &crud_dirty_ranges[fd];
+	while( (*walk != NULL) && ((*walk)->offset + (*walk)->length < start) ) {
+		walk = &(*walk)->next;
+	}
+
+	// Widen to cover every range the write touches
+	first = *walk;
+	for( range = first; (range != NULL) && (range->offset <= end); range = range->next ) {
+		if( range->offset < start ) {
+			start = range->offset;
+		}
+		if( range->offset + range->length > end ) {
+			end = range->offset + range->length;
+		}
+	}
+
+	// Build the merged range: old bytes first, the new write on top
+	merged = crud_buffer_alloc(sizeof(CrudDirtyRange));
+	if( merged == NULL || (merged->data = crud_buffer_alloc(end - start)) == NULL ) {
+		crud_buffer_free(merged);
+		return -1;
+	}
+	merged->offset = start;
+	merged->length = end - start;
+	while( (first != NULL) && (first->offset <= end) ) {
+		memcpy( &merged->data[first->offset - start], first->data, first->length );
+		released += first->length;
+		range = first->next;
+		crud_buffer_free(first->data);
+		crud_buffer_free(first);
+		first = range;
+	}
+	crud_iov_gather( iov, iovcnt, 0, &merged->data[position - start], count );
+
+	// Link it in where the old ranges were
+	merged->next = first;
+	*walk = merged;
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_dirty_bytes += merged->length - released;
+	crud_write_back_stats.writes_buffered++;
+	crud_write_back_stats.bytes_buffered += count;
+	pthread_mutex_unlock(&crud_meta_mutex);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dirty_covers
+// Description  : Check if a single dirty range holds every byte of a span
+//
+// Inputs       : fd - the file descriptor
+//                start - the first byte of the span
+//                end - one past the last byte of the span
+// Outputs      : 1 if covered, 0 if not
+
+int crud_dirty_covers(int32_t fd, uint32_t start, uint32_t end) {
+	CrudDirtyRange *range;
+
+	for( range = crud_dirty_ranges[fd]; (range != NULL) && (range->offset <= start); range = range->next ) {
+		if( range->offset + range->length >= end ) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dirty_overlay
+// Description  : Copy the buffered bytes that fall in a span of the file over
+//                the data read for it.
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position of the first byte read
+//                iov - the buffers holding the data read
+//                iovcnt - the number of buffers
+//                count - the number of bytes read
+// Outputs      : none
+
+void crud_dirty_overlay(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	CrudDirtyRange *range;
+	uint32_t start, end;
+
+	for( range = crud_dirty_ranges[fd]; (range != NULL) && (range->offset < position + count); range = range->next ) {
+		start = (range->offset > position) ? range->offset : position;
+		end = (range->offset + range->length < position + count) ? range->offset + range->length : position + count;
+		if( start < end ) {
+			crud_iov_scatter( iov, iovcnt, start - position, &range->data[start - range->offset], end - start );
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_length
+// Description  : Total the lengths of a list of buffers
+//
+// Inputs       : iov - the buffers
+//                iovcnt - the number of buffers
+// Outputs      : the total length, or -1 if the list is bad or too long
+
+int32_t crud_iov_length(const struct iovec *iov, int iovcnt) {
+	uint64_t total = 0;
+	int i;
+
+	if( (iovcnt < 0) || ((iov == NULL) && (iovcnt > 0)) ) {
+		return -1;
+	}
+	for( i=0; i<iovcnt; i++ ) {
+		total += iov[i].iov_len;
+		if( total > INT32_MAX ) {
+			return -1;
+		}
+	}
+	return total;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_gather
+// Description  : Copy bytes out of a list of buffers, as if the buffers were
+//                laid end to end
+//
+// Inputs       : iov - the buffers
+//                iovcnt - the number of buffers
+//                offset - where in the buffers to start
+//                dst - the place to copy the bytes to
+//                count - the number of bytes to copy
+// Outputs      : none
+
+void crud_iov_gather(const struct iovec *iov, int iovcnt, uint32_t offset, char *dst, uint32_t count) {
+	uint32_t bytes;
+	int i;
+
+	for( i=0; (i<iovcnt) && (count>0); i++ ) {
+		if( offset >= iov[i].iov_len ) {
+			offset -= iov[i].iov_len;
+			continue;
+		}
+		bytes = (iov[i].iov_len - offset < count) ? iov[i].iov_len - offset : count;
+		memcpy( dst, (char *)iov[i].iov_base + offset, bytes );
+		dst += bytes;
+		count -= bytes;
+		offset = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_scatter
+// Description  : Copy bytes into a list of buffers, as if the buffers were
+//                laid end to end
+//
+// Inputs       : iov - the buffers
+//                iovcnt - the number of buffers
+//                offset - where in the buffers to start
+//                src - the bytes to copy
+//                count - the number of bytes to copy
+// Outputs      : none
+
+void crud_iov_scatter(const struct iovec *iov, int iovcnt, uint32_t offset, char *src, uint32_t count) {
+	uint32_t bytes;
+	int i;
+
+	for( i=0; (i<iovcnt) && (count>0); i++ ) {
+		if( offset >= iov[i].iov_len ) {
+			offset -= iov[i].iov_len;
+			continue;
+		}
+		bytes = (iov[i].iov_len - offset < count) ? iov[i].iov_len - offset : count;
+		memcpy( (char *)iov[i].iov_base + offset, src, bytes );
+		src += bytes;
+		count -= bytes;
+		offset = 0;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_iov_span
+// Description  : Find a run of bytes in a list of buffers, if it lies within
+//                a single buffer
+//
+// Inputs       : iov - the buffers
+//                iovcnt - the number of buffers
+//                offset - where in the buffers the run starts
+//                count - the number of bytes in the run
+// Outputs      : a pointer to the run, or NULL if it crosses buffers
+
+char *crud_iov_span(const struct iovec *iov, int iovcnt, uint32_t offset, uint32_t count) {
+	int i;
+
+	for( i=0; i<iovcnt; i++ ) {
+		if( offset < iov[i].iov_len ) {
+			return( (offset + count <= iov[i].iov_len) ? (char *)iov[i].iov_base + offset : NULL );
+		}
+		offset -= iov[i].iov_len;
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_extents
+// Description  : Read a span of the stored file from its extents (or its
+//                table entry or container slice if it is small)
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at
+//                iov - the buffers to place the bytes into
+//                iovcnt - the number of buffers
+//                skip - where in the buffers the bytes go
+//                count - the number of bytes to read (all must be stored)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_read_extents(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t skip,
+		uint32_t count) {
+	uint32_t extent, offset, bytes, done = 0;
+
+	// An inline file is already here, a packed one is read from its slice
+	if( crud_file_table[fd].inline_data != NULL ) {
+		crud_iov_scatter(iov, iovcnt, skip, &crud_file_table[fd].inline_data[position], count);
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_inline_stats.reads++;
+		crud_inline_stats.bytes += count;
+		pthread_mutex_unlock(&crud_meta_mutex);
+		return 0;
+	} else if( crud_file_table[fd].pack != CRUD_NO_OBJECT ) {
+		return crud_pack_read(fd, position, iov, iovcnt, skip, count);
+	}
+
+	// Read the piece of each extent the range covers
+	while( done < count ) {
+		extent = position / CRUD_EXTENT_SIZE;
+		offset = position % CRUD_EXTENT_SIZE;
+		bytes = CRUD_EXTENT_SIZE - offset;
+		if( bytes > count - done ) {
+			bytes = count - done;
+		}
+		if( crud_extent_read(fd, extent, offset, iov, iovcnt, skip + done, bytes) ) {
+			return -1;
+		}
+		done += bytes;
+		position += bytes;
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_ahead
+// Description  : Read a span of the stored file, through the file's
+//                read-ahead.  Bytes already fetched ahead are copied out,
+//                and a sequential read smaller than the window fetches the
+//                rest of the window (to the end of its extent) in the same
+//                request, so a stream of small reads takes a request per
+//                window rather than one each.
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at
+//                iov - the buffers to place the bytes into
+//                iovcnt - the number of buffers
+//                count - the number of bytes to read (all must be stored)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_read_ahead(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	CrudReadAhead *ahead = crud_file_table[fd].ahead;
+	uint32_t done = 0, start, need, fetch;
+	struct iovec window;
+	int ret = 0;
+
+	// An inline file is in memory already, there is nothing to read ahead
+	if( crud_file_table[fd].inline_data != NULL ) {
+		return crud_read_extents(fd, position, iov, iovcnt, 0, count);
+	}
+
+	// Note whether the reads are sequential, opening the window if so
+	pthread_mutex_lock(&ahead->mutex);
+	if( position != ahead->next ) {
+		ahead->window = 0;
+	} else if( ahead->window == 0 ) {
+		ahead->window = CRUD_READ_AHEAD_MIN;
+	}
+	ahead->next = position + count;
+
+	// Copy out what has already been fetched
+	if( (position >= ahead->offset) && (position < ahead->offset + ahead->length) ) {
+		done = ahead->offset + ahead->length - position;
+		if( done > count ) {
+			done = count;
+		}
+		crud_iov_scatter(iov, iovcnt, 0, &ahead->data[position - ahead->offset], done);
+	}
+	start = position + done;
+	need = count - done;
+
+	// Fetch the window from where that left off, up to the end of the extent
+	fetch = (need < ahead->window) ? ahead->window : need;
+	if( fetch > crud_file_table[fd].length - start ) {
+		fetch = crud_file_table[fd].length - start;
+	}
+	if( fetch > CRUD_EXTENT_SIZE - (start % CRUD_EXTENT_SIZE) ) {
+		fetch = CRUD_EXTENT_SIZE - (start % CRUD_EXTENT_SIZE);
+	}
+	if( (need > 0) && (need < ahead->window) && (fetch >= need) ) {
+		if( (ahead->data == NULL) && ((ahead->data = crud_buffer_alloc(CRUD_READ_AHEAD_MAX)) == NULL) ) {
+			ret = -1;
+		} else {
+			window.iov_base = ahead->data;
+			window.iov_len = fetch;
+			ahead->length = 0;
+			if( crud_read_extents(fd, start, &window, 1, 0, fetch) ) {
+				ret = -1;
 			} else {
-				free(readBuffer);
-				free(tempBuffer);
-				readBuffer = NULL;
-				tempBuffer = NULL;
+				ahead->offset = start;
+				ahead->length = fetch;
+				crud_iov_scatter(iov, iovcnt, done, ahead->data, need);
+				if( ahead->window < CRUD_READ_AHEAD_MAX ) {
+					ahead->window *= 2;
+				}
+			}
+		}
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_read_stats.ahead_fetches++;
+		pthread_mutex_unlock(&crud_meta_mutex);
+
+	// Not worth reading ahead, read the rest straight into the buffers
+	} else if( need > 0 ) {
+		ret = crud_read_extents(fd, start, iov, iovcnt, done, need);
+	} else {
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_read_stats.ahead_hits++;
+		pthread_mutex_unlock(&crud_meta_mutex);
+	}
+	pthread_mutex_unlock(&ahead->mutex);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_read_ahead_reset
+// Description  : Forget a file's read pattern and release its read-ahead
+//                buffer (the caller holds the file exclusively)
+//
+// Inputs       : fd - the file descriptor
+// Outputs      : none
+
+void crud_read_ahead_reset(int32_t fd) {
+	CrudReadAhead *ahead = crud_file_table[fd].ahead;
+
+	crud_buffer_free(ahead->data);
+	ahead->data = NULL;
+	ahead->next = 0;
+	ahead->window = 0;
+	ahead->offset = 0;
+	ahead->length = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_write_extents
+// Description  : Write a span of the file through to its extents (or its
+//                table entry or container slice if it is small), growing the
+//                stored length as needed.
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at (within the file)
+//                iov - the buffers holding the bytes to write
+//                iovcnt - the number of buffers
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_write_extents(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	uint32_t extent, offset, bytes, done = 0;
+
+	// The stored bytes are changing, forget any read ahead of them
+	crud_file_table[fd].ahead->length = 0;
+
+	// Tiny files are held in the table entry, small ones go in a slice of a
+	// container, rather than extents of their own
+	if( (crud_file_table[fd].inline_data != NULL) || ((crud_file_table[fd].capacity == 0) &&
+			(crud_file_table[fd].pack == CRUD_NO_OBJECT) && (count > 0) && (position + count <= crud_inline_threshold)) ) {
+		return crud_inline_write(fd, position, iov, iovcnt, count);
+	}
+	if( (crud_file_table[fd].pack != CRUD_NO_OBJECT) || ((crud_file_table[fd].capacity == 0) && (count > 0) &&
+			(position + count <= crud_pack_get_threshold())) ) {
+		return crud_pack_write(fd, position, iov, iovcnt, count);
+	}
+
+	// Write the piece of each extent the range covers, only those extents change
+	while( done < count ) {
+		extent = position / CRUD_EXTENT_SIZE;
+		offset = position % CRUD_EXTENT_SIZE;
+		bytes = CRUD_EXTENT_SIZE - offset;
+		if( bytes > count - done ) {
+			bytes = count - done;
+		}
+		if( crud_extent_write(fd, extent, offset, iov, iovcnt, done, bytes) ) {
+			return -1;
+		}
+		done += bytes;
+		position += bytes;
+		if( position > crud_file_table[fd].length ) {
+			crud_file_table[fd].length = position;
+			crud_table_touch(fd);
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_span
+// Description  : Work out how many of the first "size" bytes of a file fall
+//                in an extent.  With the file length this is the data held by
+//                the extent, with the file capacity it is the object size.
+//
+// Inputs       : size - the file length or capacity
+//                extent - the index of the extent in the file
+// Outputs      : the number of bytes in the extent (0 if none)
+
+uint32_t crud_extent_span(uint32_t size, uint32_t extent) {
+	uint32_t start = extent * CRUD_EXTENT_SIZE;
+
+	if( size <= start ) {
+		return 0;
+	} else if( size - start >= CRUD_EXTENT_SIZE ) {
+		return CRUD_EXTENT_SIZE;
+	}
+	return size - start;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_read
+// Description  : Read bytes from a single extent of a file.  Uses
+//                CRUD_READ_RANGE when the server supports it, otherwise reads
+//                the whole extent.  The bytes are received straight into the
+//                caller's buffer when what comes back lines up with it,
+//                otherwise into the thread's scratch buffer and copied out.
+//
+// Inputs       : fd - the file descriptor
+//                extent - the index of the extent in the file
+//                offset - the offset within the extent
+//                iov - the buffers to place the bytes into
+//                iovcnt - the number of buffers
+//                skip - where in the buffers the bytes for this extent go
+//                count - the number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_extent_read(int32_t fd, uint32_t extent, uint32_t offset, const struct iovec *iov, int iovcnt,
+		uint32_t skip, uint32_t count) {
+	uint32_t length = crud_extent_span(crud_file_table[fd].capacity, extent);
+	CrudOID oid = crud_file_table[fd].extents[extent];
+	char *buf = crud_iov_span(iov, iovcnt, skip, count), *piece;
+	struct GenResponse response;
+
+	// Fetch only the bytes asked for if the server supports it
+	if( crud_server_capabilities & CRUD_CAP_READ_RANGE ) {
+		if( (buf == NULL) && ((buf = crud_scratch_buffer(count)) == NULL) ) {
+			return -1;
+		}
+		CrudRequest readRequest = create_crud_request( oid, CRUD_READ_RANGE, count, 0, 0 );
+		CrudResponse readResponse = crud_cache_read_range( readRequest, offset, buf );
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		piece = buf;
+
+	// Otherwise the whole extent comes back, which may be just what was wanted
+	} else {
+		if( (offset != 0) || (count != length) ) {
+			buf = NULL;
+		}
+		if( (buf == NULL) && ((buf = crud_scratch_buffer(length)) == NULL) ) {
+			return -1;
+		}
+		CrudRequest readRequest = create_crud_request( oid, CRUD_READ, length, 0, 0 );
+		CrudResponse readResponse = crud_cache_operation( readRequest, buf );
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		response.length = count;
+		piece = &buf[offset];
+	}
+	if( (response.succeed != 0) || (response.length != count) ) {
+		return -1;
+	}
+
+	// Copy out of the scratch buffer if we had to use it
+	if( buf == crud_scratch ) {
+		crud_iov_scatter(iov, iovcnt, skip, piece, count);
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_read_stats.bytes_copied += count;
+		pthread_mutex_unlock(&crud_meta_mutex);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_scratch_buffer
+// Description  : Get the calling thread's scratch buffer, growing it if it
+//                is smaller than needed (it is kept for the next read)
+//
+// Inputs       : size - the number of bytes needed
+// Outputs      : the buffer, or NULL if it could not be grown
+
+char *crud_scratch_buffer(uint32_t size) {
+	char *scratch;
+
+	if( size > crud_scratch_size ) {
+		if( (scratch = realloc(crud_scratch, size)) == NULL ) {
+			return NULL;
+		}
+		crud_scratch = scratch;
+		crud_scratch_size = size;
+	}
+	return crud_scratch;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_allocation
+// Description  : Work out the size of the object an extent needs to hold its
+//                bytes: the current one if they fit, otherwise doubled (from
+//                the smallest allocation) until they do, up to a full extent.
+//
+// Inputs       : objectLength - the size of the extent's object (0 if none)
+//                end - the end of the bytes the extent must hold
+// Outputs      : the object size
+
+uint32_t crud_extent_allocation(uint32_t objectLength, uint32_t end) {
+	uint32_t newLength = objectLength;
+
+	if( end > objectLength ) {
+		newLength = (objectLength > 0) ? objectLength : CRUD_MIN_EXTENT_ALLOCATION;
+		while( newLength < end ) {
+			newLength *= 2;
+		}
+		if( newLength > CRUD_EXTENT_SIZE ) {
+			newLength = CRUD_EXTENT_SIZE;
+		}
+	}
+	return newLength;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_write
+// Description  : Write bytes into a single extent of a file.  Extent objects
+//                are allocated with headroom past the data they hold, so the
+//                extent is updated in place while the write fits.  When it
+//                does not, a replacement of double the size (up to a full
+//                extent) is created and the old object released.  With
+//                dedup the new contents are hashed first, and an object
+//                already holding them is shared instead; an object shared
+//                with another file is never updated in place.
+//
+// Inputs       : fd - the file descriptor
+//                extent - the index of the extent in the file
+//                offset - the offset within the extent
+//                iov - the buffers holding the bytes to write
+//                iovcnt - the number of buffers
+//                skip - where in the buffers the bytes for this extent start
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_extent_write(int32_t fd, uint32_t extent, uint32_t offset, const struct iovec *iov, int iovcnt,
+		uint32_t skip, uint32_t count) {
+	uint32_t dataLength = crud_extent_span(crud_file_table[fd].length, extent);
+	uint32_t objectLength = crud_extent_span(crud_file_table[fd].capacity, extent);
+	uint32_t newLength;
+	CrudOID oid = (objectLength > 0) ? crud_file_table[fd].extents[extent] : CRUD_NO_OBJECT;
+	CrudOID shared = CRUD_NO_OBJECT;
+	unsigned char digestBuffer[CRUD_DEDUP_DIGEST_LENGTH], *digest = NULL;
+	struct GenResponse response;
+
+	// Grow the allocation geometrically if the write does not fit
+	newLength = crud_extent_allocation(objectLength, offset + count);
+
+	// Build the new extent contents, only reading the old ones if some survive
+	char *tempBuffer = crud_buffer_alloc( newLength );
+	uint32_t kept = 0;
+	if( tempBuffer == NULL ) {
+		return -1;
+	}
+	if( (oid != CRUD_NO_OBJECT) && ((offset > 0) || (offset + count < dataLength)) ) {
+		CrudRequest readRequest = create_crud_request( oid, CRUD_READ, objectLength, 0, 0 );
+		CrudResponse readResponse = crud_cache_operation( readRequest, tempBuffer );
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			crud_buffer_free(tempBuffer);
+			return -1;
+		}
+		kept = objectLength;
+	}
+	memset( &tempBuffer[kept], 0x0, newLength - kept );
+	crud_iov_gather( iov, iovcnt, skip, &tempBuffer[offset], count );
+
+	// With dedup, share an object already holding these contents if there is one
+	if( crud_dedup_enabled() && (crud_dedup_hash(tempBuffer, newLength, digestBuffer) == 0) ) {
+		digest = digestBuffer;
+		shared = crud_dedup_find(digest, newLength, oid);
+	}
+	if( shared != CRUD_NO_OBJECT ) {
+		crud_buffer_free(tempBuffer);
+		if( shared != oid ) {
+			if( crud_extent_slot(fd, extent) ) {
+				crud_extent_release(shared);
 				return -1;
 			}
+			crud_file_table[fd].extents[extent] = shared;
+			crud_table_touch(fd);
+			if( extent * CRUD_EXTENT_SIZE + newLength > crud_file_table[fd].capacity ) {
+				crud_file_table[fd].capacity = extent * CRUD_EXTENT_SIZE + newLength;
+			}
+		}
+		if( oid != CRUD_NO_OBJECT ) {
+			crud_extent_release(oid);
+		}
+		return 0;
+	}
+
+	// Still fits (and no other file shares it), update the object in place
+	if( (oid != CRUD_NO_OBJECT) && (newLength == objectLength) && !crud_dedup_claim(oid) ) {
+		CrudRequest updateRequest = create_crud_request( oid, CRUD_UPDATE, objectLength, 0, 0 );
+		CrudResponse updateResponse = crud_cache_operation( updateRequest, tempBuffer );
+		extract_crud_response( updateResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		crud_buffer_free(tempBuffer);
+		if( response.succeed != 0 ) {
+			return -1;
+		}
+		crud_dedup_rehash(oid, objectLength, digest);
+		return 0;
+	}
+
+	// Out of room (or new), create the replacement before deleting the old one
+	CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, newLength, 0, 0 );
+	CrudResponse createResponse = crud_cache_operation( createRequest, tempBuffer );
+	extract_crud_response( createResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	crud_buffer_free(tempBuffer);
+	tempBuffer = NULL;
+	if( response.succeed != 0 ) {
+		return -1;
+	}
+	if( crud_extent_slot(fd, extent) ) {
+		return -1;
+	}
+	crud_file_table[fd].extents[extent] = response.objectId;
+	crud_dedup_insert(response.objectId, newLength, digest);
+	crud_table_touch(fd);
+	if( extent * CRUD_EXTENT_SIZE + newLength > crud_file_table[fd].capacity ) {
+		crud_file_table[fd].capacity = extent * CRUD_EXTENT_SIZE + newLength;
+	}
+	if( oid != CRUD_NO_OBJECT ) {
+		crud_extent_release(oid);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_extent_release
+// Description  : Drop an extent's reference to its object, deleting the
+//                object unless another file still shares it
+//
+// Inputs       : oid - the object
+// Outputs      : none
+
+void crud_extent_release(CrudOID oid) {
+	struct GenResponse response;
+
+	if( crud_dedup_release(oid) > 0 ) {
+		return;
+	}
+	CrudRequest deleteRequest = create_crud_request( oid, CRUD_DELETE, 0, 0, 0 );
+	CrudResponse deleteResponse = crud_cache_operation( deleteRequest, NULL );
+	extract_crud_response( deleteResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if( response.succeed != 0 ) {
+		logMessage(LOG_WARNING_LEVEL, "CRUD write : failed to delete replaced extent [%u].", oid);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_dedup_count
+// Description  : Count the references to each extent object in the table,
+//                so objects shared by several files are known (the caller
+//                holds the table write lock)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_dedup_count(void) {
+	uint32_t fd, extent, extents;
+
+	for( fd=0; fd<crud_file_count; fd++ ) {
+		extents = (crud_file_table[fd].capacity + CRUD_EXTENT_SIZE - 1) / CRUD_EXTENT_SIZE;
+		for( extent=0; extent<extents; extent++ ) {
+			crud_dedup_reference(crud_file_table[fd].extents[extent],
+					crud_extent_span(crud_file_table[fd].capacity, extent));
+		}
+	}
+	crud_dedup_prune();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_inline_write
+// Description  : Write a span of a tiny file into its table entry, no server
+//                request is needed (the bytes are stored with the table at
+//                the next checkpoint).  A file that grows past the threshold
+//                is written out to a container slice or extents and the
+//                entry's copy dropped.
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at (within the file)
+//                iov - the buffers holding the bytes to write
+//                iovcnt - the number of buffers
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_inline_write(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	CrudFileAllocationType *file = &crud_file_table[fd];
+	uint32_t end = position + count, stored = file->length, length;
+	char *data = file->inline_data, *buf;
+	struct iovec whole;
+
+	// Still fits, write it into the entry
+	if( (end <= crud_inline_threshold) && (end <= CRUD_INLINE_MAX) ) {
+		if( (data == NULL) && ((data = file->inline_data = malloc(CRUD_INLINE_MAX)) == NULL) ) {
+			return -1;
+		}
+		crud_iov_gather( iov, iovcnt, 0, &data[position], count );
+		if( end > file->length ) {
+			file->length = end;
+		}
+		crud_table_touch(fd);
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_inline_stats.writes++;
+		crud_inline_stats.bytes += count;
+		pthread_mutex_unlock(&crud_meta_mutex);
+		return 0;
+	}
+
+	// Grown too large, write the whole file out where it now belongs
+	length = (end > stored) ? end : stored;
+	if( (buf = crud_buffer_alloc(length)) == NULL ) {
+		return -1;
+	}
+	if( stored > 0 ) {
+		memcpy( buf, data, stored );
+	}
+	memset( &buf[stored], 0x0, length - stored );
+	crud_iov_gather( iov, iovcnt, 0, &buf[position], count );
+	whole.iov_base = buf;
+	whole.iov_len = length;
+	file->inline_data = NULL;
+	file->length = 0;
+	if( crud_write_extents(fd, 0, &whole, 1, length) ) {
+		crud_buffer_free(buf);
+		file->inline_data = data;
+		file->length = stored;
+		return -1;
+	}
+	crud_buffer_free(buf);
+	free(data);
+	crud_table_touch(fd);
+	pthread_mutex_lock(&crud_meta_mutex);
+	crud_inline_stats.promoted++;
+	pthread_mutex_unlock(&crud_meta_mutex);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_ranged
+// Description  : Check if container slices can be read and written on their
+//                own, otherwise each rewrite is of the whole container
+//
+// Inputs       : none
+// Outputs      : 1 if the server supports both range extensions, 0 if not
+
+int crud_pack_ranged(void) {
+	return( (crud_server_capabilities & (CRUD_CAP_READ_RANGE|CRUD_CAP_WRITE_RANGE)) ==
+			(CRUD_CAP_READ_RANGE|CRUD_CAP_WRITE_RANGE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_read
+// Description  : Read bytes of a packed file from its slice of the container,
+//                as crud_extent_read does for an extent
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at
+//                iov - the buffers to place the bytes into
+//                iovcnt - the number of buffers
+//                skip - where in the buffers the bytes go
+//                count - the number of bytes to read (all must be stored)
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_read(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t skip,
+		uint32_t count) {
+	uint32_t offset = crud_file_table[fd].pack_offset + position;
+	CrudOID oid = crud_file_table[fd].pack;
+	char *buf = crud_iov_span(iov, iovcnt, skip, count), *piece;
+	struct GenResponse response;
+
+	// Fetch only the bytes asked for if the server supports it
+	if( crud_pack_ranged() ) {
+		if( (buf == NULL) && ((buf = crud_scratch_buffer(count)) == NULL) ) {
+			return -1;
 		}
+		CrudRequest readRequest = create_crud_request( oid, CRUD_READ_RANGE, count, 0, 0 );
+		CrudResponse readResponse = crud_cache_read_range( readRequest, offset, buf );
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		piece = buf;
+
+	// Otherwise the whole container comes back (not while it is being rewritten)
 	} else {
-		free(readBuffer);
-		free(tempBuffer);
-		readBuffer = NULL;
-		tempBuffer = NULL;
+		if( (buf = crud_scratch_buffer(CRUD_PACK_CONTAINER_SIZE)) == NULL ) {
+			return -1;
+		}
+		pthread_mutex_lock(&crud_pack_mutex);
+		CrudRequest readRequest = create_crud_request( oid, CRUD_READ, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+		CrudResponse readResponse = crud_cache_operation( readRequest, buf );
+		pthread_mutex_unlock(&crud_pack_mutex);
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		response.length = count;
+		piece = &buf[offset];
+	}
+	if( (response.succeed != 0) || (response.length != count) ) {
+		return -1;
+	}
+
+	// Copy out of the scratch buffer if we had to use it
+	if( buf == crud_scratch ) {
+		crud_iov_scatter(iov, iovcnt, skip, piece, count);
+		pthread_mutex_lock(&crud_meta_mutex);
+		crud_read_stats.bytes_copied += count;
+		pthread_mutex_unlock(&crud_meta_mutex);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_write
+// Description  : Write a span of a small file into its container slice.  A
+//                write that fits the slice is sent on its own; one that does
+//                not moves the file to a larger slice (up to the threshold)
+//                or out into extents of its own, the old slice being given
+//                back once the new copy is stored.
+//
+// Inputs       : fd - the file descriptor
+//                position - the file position to start at (within the file)
+//                iov - the buffers holding the bytes to write
+//                iovcnt - the number of buffers
+//                count - the number of bytes to write
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_write(int32_t fd, uint32_t position, const struct iovec *iov, int iovcnt, uint32_t count) {
+	CrudFileAllocationType *file = &crud_file_table[fd];
+	uint32_t end = position + count, stored = file->length, length, offset, size;
+	CrudOID container, old = file->pack;
+	struct iovec whole;
+	char *buf;
+	int ret;
+
+	// Nothing to write
+	if( count == 0 ) {
+		return 0;
+	}
+
+	// Still fits the slice, write just these bytes
+	if( (old != CRUD_NO_OBJECT) && (end <= file->pack_size) ) {
+		if( (buf = crud_iov_span(iov, iovcnt, 0, count)) == NULL ) {
+			if( (buf = crud_buffer_alloc(count)) == NULL ) {
+				return -1;
+			}
+			crud_iov_gather(iov, iovcnt, 0, buf, count);
+			ret = crud_pack_store(old, file->pack_offset + position, buf, count);
+			crud_buffer_free(buf);
+		} else {
+			ret = crud_pack_store(old, file->pack_offset + position, buf, count);
+		}
+		if( ret ) {
+			return -1;
+		}
+		if( end > file->length ) {
+			file->length = end;
+			crud_table_touch(fd);
+		}
+		return 0;
+	}
+
+	// Build the new contents: what is stored, with the write laid over it
+	length = (end > stored) ? end : stored;
+	if( (buf = crud_buffer_alloc(length)) == NULL ) {
+		return -1;
+	}
+	whole.iov_base = buf;
+	whole.iov_len = length;
+	if( (old != CRUD_NO_OBJECT) && (stored > 0) && crud_pack_read(fd, 0, &whole, 1, 0, stored) ) {
+		crud_buffer_free(buf);
+		return -1;
+	}
+	memset( &buf[stored], 0x0, length - stored );
+	crud_iov_gather( iov, iovcnt, 0, &buf[position], count );
+
+	// Grown past the threshold, the file gets extents of its own
+	if( length > crud_pack_get_threshold() ) {
+		size = file->pack_size;
+		offset = file->pack_offset;
+		file->pack = CRUD_NO_OBJECT;
+		file->pack_offset = 0;
+		file->pack_size = 0;
+		file->length = 0;
+		ret = crud_write_extents(fd, 0, &whole, 1, length);
+		crud_buffer_free(buf);
+		if( ret ) {
+			file->pack = old;
+			file->pack_offset = offset;
+			file->pack_size = size;
+			file->length = stored;
+			return -1;
+		}
+		if( old != CRUD_NO_OBJECT ) {
+			crud_pack_release(old, size);
+			__atomic_add_fetch(&crud_pack_stats.unpacked, 1, __ATOMIC_RELAXED);
+		}
+		return 0;
+	}
+
+	// Otherwise store it in a larger slice, then give the old one back
+	size = crud_pack_slice_size(length);
+	if( crud_pack_slice(size, &container, &offset) ) {
+		crud_buffer_free(buf);
+		return -1;
+	}
+	ret = crud_pack_store(container, offset, buf, length);
+	crud_buffer_free(buf);
+	if( ret ) {
+		crud_pack_release(container, size);
+		return -1;
+	}
+	if( old != CRUD_NO_OBJECT ) {
+		crud_pack_release(old, file->pack_size);
+		__atomic_add_fetch(&crud_pack_stats.moved, 1, __ATOMIC_RELAXED);
+	}
+	file->pack = container;
+	file->pack_offset = offset;
+	file->pack_size = size;
+	file->length = length;
+	crud_table_touch(fd);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_store
+// Description  : Write bytes into a container, with CRUD_WRITE_RANGE if the
+//                server supports it, otherwise by rewriting the container
+//                (one rewrite at a time, as other files share it)
+//
+// Inputs       : container - the container object
+//                offset - where in the container the bytes go
+//                buf - the bytes
+//                count - the number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_store(CrudOID container, uint32_t offset, char *buf, uint32_t count) {
+	struct GenResponse response;
+	char *data;
+
+	// Send just the bytes if we can
+	if( crud_pack_ranged() ) {
+		CrudRequest writeRequest = create_crud_request( container, CRUD_WRITE_RANGE, count, 0, 0 );
+		CrudResponse writeResponse = crud_cache_write_range( writeRequest, offset, buf );
+		extract_crud_response( writeResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		return( ((response.succeed != 0) || (response.length != count)) ? -1 : 0 );
+	}
+
+	// Otherwise read the container, lay the bytes in and write it back
+	if( (data = crud_buffer_alloc(CRUD_PACK_CONTAINER_SIZE)) == NULL ) {
 		return -1;
 	}
+	pthread_mutex_lock(&crud_pack_mutex);
+	CrudRequest readRequest = create_crud_request( container, CRUD_READ, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+	CrudResponse readResponse = crud_cache_operation( readRequest, data );
+	extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if( response.succeed == 0 ) {
+		memcpy( &data[offset], buf, count );
+		CrudRequest updateRequest = create_crud_request( container, CRUD_UPDATE, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+		CrudResponse updateResponse = crud_cache_operation( updateRequest, data );
+		extract_crud_response( updateResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+	}
+	pthread_mutex_unlock(&crud_pack_mutex);
+	crud_buffer_free(data);
+	return( (response.succeed != 0) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_slice
+// Description  : Get a slice for a file, creating a new (zeroed) container
+//                when none has room
+//
+// Inputs       : size - the slice size
+//                container - set to the container holding the slice
+//                offset - set to where the slice starts
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_slice(uint32_t size, CrudOID *container, uint32_t *offset) {
+	struct GenResponse response;
+	char *data;
+
+	while( crud_pack_place(size, container, offset) ) {
+		if( (data = crud_buffer_alloc(CRUD_PACK_CONTAINER_SIZE)) == NULL ) {
+			return -1;
+		}
+		memset( data, 0x0, CRUD_PACK_CONTAINER_SIZE );
+		CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+		CrudResponse createResponse = crud_cache_operation( createRequest, data );
+		extract_crud_response( createResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		crud_buffer_free(data);
+		if( response.succeed != 0 ) {
+			return -1;
+		}
+		crud_pack_add(response.objectId);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_release
+// Description  : Give a slice back, deleting the container with its last slice
+//
+// Inputs       : container - the container holding the slice
+//                size - the slice size
+// Outputs      : none
+
+void crud_pack_release(CrudOID container, uint32_t size) {
+	struct GenResponse response;
+
+	if( crud_pack_free(container, size) == 0 ) {
+		return;
+	}
+	CrudRequest deleteRequest = create_crud_request( container, CRUD_DELETE, 0, 0, 0 );
+	CrudResponse deleteResponse = crud_cache_operation( deleteRequest, NULL );
+	extract_crud_response( deleteResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if( response.succeed != 0 ) {
+		logMessage(LOG_WARNING_LEVEL, "CRUD write : failed to delete empty container [%u].", container);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_count
+// Description  : Count the slices of each container in the table (the
+//                caller holds the table write lock)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_pack_count(void) {
+	uint32_t fd;
+
+	for( fd=0; fd<crud_file_count; fd++ ) {
+		if( crud_file_table[fd].pack != CRUD_NO_OBJECT ) {
+			crud_pack_reference(crud_file_table[fd].pack, crud_file_table[fd].pack_offset,
+					crud_file_table[fd].pack_size);
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_repack
+// Description  : Copy the live slices of the containers that are mostly dead
+//                space into new containers, then delete the old ones.  The
+//                old containers are read in one batch, the new ones created
+//                in another and the old ones deleted in a third.  The caller
+//                holds the table write lock (and has flushed every file).
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_pack_repack(void) {
+	CrudOID old[CRUD_PACK_REPACK_MAX];
+	uint32_t i, k, count, images = 0, moved = 0, used = 0, size;
+	CrudBatchOp *reads = NULL, *creates = NULL;
+	struct GenResponse response;
+	int ret = -1;
+	struct {
+		int32_t  fd;     // The file moved
+		uint32_t image;  // The new container it goes in
+		uint32_t offset; // Where its slice starts
+		uint32_t size;   // The size of its slice
+	} *moves = NULL;
+
+	// Anything worth repacking?
+	if( (count = crud_pack_fragmented(old, CRUD_PACK_REPACK_MAX)) == 0 ) {
+		return 0;
+	}
+
+	// Read the containers together
+	if( ((reads = crud_batch_alloc(count)) == NULL) || ((creates = crud_batch_alloc(count)) == NULL) ||
+			((moves = calloc(crud_file_count, sizeof(*moves))) == NULL) ) {
+		goto done;
+	}
+	for( i=0; i<count; i++ ) {
+		reads[i].request = create_crud_request( old[i], CRUD_READ, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+		if( (reads[i].buf = crud_buffer_alloc(CRUD_PACK_CONTAINER_SIZE)) == NULL ) {
+			goto done;
+		}
+	}
+	crud_cache_batch( reads, count );
+	for( i=0; i<count; i++ ) {
+		extract_crud_response( reads[i].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD repack : failed to read container [%u].", old[i]);
+			goto done;
+		}
+	}
+
+	// Lay the live slices out one after another (each sized afresh) in new
+	// containers, at most half full between them so no more are needed
+	for( i=0; i<crud_file_count; i++ ) {
+		for( k=0; (k<count) && (crud_file_table[i].pack != old[k]); k++ );
+		if( k == count ) {
+			continue;
+		}
+		size = crud_pack_slice_size(crud_file_table[i].length);
+		if( (images == 0) || (used + size > CRUD_PACK_CONTAINER_SIZE) ) {
+			if( (images == count) || ((creates[images].buf = crud_buffer_alloc(CRUD_PACK_CONTAINER_SIZE)) == NULL) ) {
+				goto done;
+			}
+			memset( creates[images].buf, 0x0, CRUD_PACK_CONTAINER_SIZE );
+			creates[images].request = create_crud_request( 0, CRUD_CREATE, CRUD_PACK_CONTAINER_SIZE, 0, 0 );
+			images++;
+			used = 0;
+		}
+		memcpy( (char *)creates[images-1].buf + used,
+				(char *)reads[k].buf + crud_file_table[i].pack_offset, crud_file_table[i].length );
+		moves[moved].fd = i;
+		moves[moved].image = images-1;
+		moves[moved].offset = used;
+		moves[moved++].size = size;
+		used += size;
+	}
+
+	// Create the new containers, undoing them all if any fail
+	if( images > 0 ) {
+		crud_cache_batch( creates, images );
+	}
+	for( i=0; i<images; i++ ) {
+		extract_crud_response( creates[i].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD repack : failed to create container.");
+			for( k=0; k<images; k++ ) {
+				extract_crud_response( creates[k].response, &response.objectId, &response.request,
+						&response.length, &response.flag, &response.succeed );
+				if( response.succeed == 0 ) {
+					CrudRequest deleteRequest = create_crud_request( response.objectId, CRUD_DELETE, 0, 0, 0 );
+					crud_cache_operation( deleteRequest, NULL );
+				}
+			}
+			goto done;
+		}
+		crud_pack_add(response.objectId);
+	}
+
+	// Move the files over, then drop the old containers
+	for( i=0; i<moved; i++ ) {
+		extract_crud_response( creates[moves[i].image].response, &response.objectId, &response.request,
+				&response.length, &response.flag, &response.succeed );
+		crud_file_table[moves[i].fd].pack = response.objectId;
+		crud_file_table[moves[i].fd].pack_offset = moves[i].offset;
+		crud_file_table[moves[i].fd].pack_size = moves[i].size;
+		crud_pack_reference(response.objectId, moves[i].offset, moves[i].size);
+		crud_table_touch(moves[i].fd);
+	}
+	for( i=0; i<count; i++ ) {
+		crud_pack_drop(old[i]);
+		reads[i].request = create_crud_request( old[i], CRUD_DELETE, 0, 0, 0 );
+	}
+	crud_cache_batch( reads, count );
+	for( i=0; i<count; i++ ) {
+		extract_crud_response( reads[i].response, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if( response.succeed != 0 ) {
+			logMessage(LOG_WARNING_LEVEL, "CRUD repack : failed to delete container [%u].", old[i]);
+		}
+	}
+	logMessage(LOG_INFO_LEVEL, "CRUD repack : %u files moved from %u containers into %u.", moved, count, images);
+	ret = 0;
+
+done:
+	if( reads != NULL ) {
+		crud_batch_free(reads, count);
+	}
+	if( creates != NULL ) {
+		crud_batch_free(creates, count);
+	}
+	free(moves);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_seek
+// Description  : Seek to specific point in the file
+//
+// Inputs       : fd - the file descriptor for the file to seek
+//                loc - offset from beginning of file to seek to
+// Outputs      : 0 if successful or -1 if failure
+
+int32_t crud_seek(int32_t fd, uint32_t loc) {
+	int32_t ret = -1;
+
+	// Check the file handle and if the loc is a valid location
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if( fd>=0 && fd<(int32_t)crud_file_count ) {
+		pthread_rwlock_wrlock(crud_file_table[fd].lock);
+		if(loc <= crud_file_length(fd)) { // If yes, move position to loc
+			crud_file_table[fd].position = loc;
+			ret = 0;
+		}
+		pthread_rwlock_unlock(crud_file_table[fd].lock);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stat
+// Description  : Describe a file without opening it
+//
+// Inputs       : path - the path "in the storage array"
+//                stat - where to put the description
+// Outputs      : 0 if successful, -1 if there is no such file
+
+int crud_stat(char *path, CrudFileStat *stat) {
+	int32_t fd;
+
+	pthread_rwlock_rdlock(&crud_table_lock);
+	if( (fd = crud_index_find(path)) != -1 ) {
+		crud_stat_fill(fd, stat);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+	return (fd == -1) ? -1 : 0;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : crud_seek
-// Description  : Seek to specific point in the file
+// Function     : crud_list
+// Description  : Call back for each file whose name starts with a prefix, in
+//                name order.  The matching files are found by binary search
+//                in the sorted order, so the cost follows the number listed
+//                rather than the size of the table.  They are described
+//                under the table lock and the callbacks made after it is
+//                released, so a callback may use the rest of the file API.
 //
-// Inputs       : fd - the file descriptor for the file to seek
-//                loc - offset from beginning of file to seek to
-// Outputs      : 0 if successful or -1 if failure
-
-int32_t crud_seek(int16_t fd, uint32_t loc) {
-	// Check if the loc is a valid location
-	if(loc <= crud_file_table[fd].length) { // If yes, move position to loc
-		crud_file_table[fd].position = loc;
-		return 0;
-	} else { // Else, fail
+// Inputs       : prefix - the start of the names to list ("" for every file)
+//                callback - called with each file's description, returns
+//                           non-zero to stop the listing
+//                arg - passed through to the callback
+// Outputs      : the number of files listed, -1 if failure
+
+int32_t crud_list(char *prefix, CrudListCallback callback, void *arg) {
+	uint32_t first, last, i, length = strlen(prefix);
+	CrudFileStat *stats;
+
+	// Find the run of names starting with the prefix, describe each
+	pthread_rwlock_rdlock(&crud_table_lock);
+	first = crud_order_lower(prefix);
+	for( last=first; (last<crud_name_ordered) &&
+			(strncmp(CRUD_FILE_NAME(crud_name_order[last]), prefix, length) == 0); last++ );
+	if( (stats = malloc((last-first+1)*sizeof(CrudFileStat))) == NULL ) {
+		pthread_rwlock_unlock(&crud_table_lock);
+		logMessage(LOG_ERROR_LEVEL, "CRUD list : failed to allocate %u descriptions.", last-first);
 		return -1;
 	}
+	for( i=first; i<last; i++ ) {
+		crud_stat_fill(crud_name_order[i], &stats[i-first]);
+	}
+	pthread_rwlock_unlock(&crud_table_lock);
+
+	// Hand them to the caller until it has seen enough
+	for( i=0; i<last-first; i++ ) {
+		if( callback(&stats[i], arg) ) {
+			i++;
+			break;
+		}
+	}
+	free(stats);
+	return i;
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_stat_fill
+// Description  : Describe a file (the caller holds the table lock)
+//
+// Inputs       : fd - the file handle
+//                stat - where to put the description
+// Outputs      : none
+
+void crud_stat_fill(int32_t fd, CrudFileStat *stat) {
+	CrudFileAllocationType *file = &crud_file_table[fd];
+
+	pthread_rwlock_rdlock(file->lock);
+	strcpy(stat->path, CRUD_FILE_NAME(fd));
+	stat->length = crud_file_length(fd);
+	stat->open = file->open;
+	if( file->inline_data != NULL ) {
+		stat->storage = CRUD_STORED_INLINE;
+		stat->allocated = 0;
+	} else if( file->pack != CRUD_NO_OBJECT ) {
+		stat->storage = CRUD_STORED_PACKED;
+		stat->allocated = file->pack_size;
+	} else {
+		stat->storage = CRUD_STORED_EXTENTS;
+		stat->allocated = file->capacity;
+	}
+	pthread_rwlock_unlock(file->lock);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -534,16 +3473,18 @@ int crudIOUnitTest(void) {
 
 	// Local variables
 	uint8_t ch;
-	int16_t fh, i;
-	int32_t cio_utest_length, cio_utest_position, count, bytes, expected;
+	int32_t fh;
+	int16_t i;
+	int32_t cio_utest_length, cio_utest_position, count, bytes, expected, cut1, cut2;
+	struct iovec iov[3];
 	char *cio_utest_buffer, *tbuf;
 	CRUD_UNIT_TEST_TYPE cmd;
 	char lstr[1024];
 
 	// Setup some operating buffers, zero out the mirrored file contents
-	cio_utest_buffer = malloc(CRUD_MAX_OBJECT_SIZE);
-	tbuf = malloc(CRUD_MAX_OBJECT_SIZE);
-	memset(cio_utest_buffer, 0x0, CRUD_MAX_OBJECT_SIZE);
+	cio_utest_buffer = malloc(CRUD_MAX_FILE_SIZE);
+	tbuf = malloc(CRUD_MAX_FILE_SIZE);
+	memset(cio_utest_buffer, 0x0, CRUD_MAX_FILE_SIZE);
 	cio_utest_length = 0;
 	cio_utest_position = 0;
 
@@ -576,7 +3517,20 @@ int crudIOUnitTest(void) {
 		case CIO_UNIT_TEST_READ: // read a random set of data
 			count = getRandomValue(0, cio_utest_length);
 			logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : read %d at position %d", bytes, cio_utest_position);
-			bytes = crud_read(fh, tbuf, count);
+			if (getRandomValue(0, 1)) {
+				bytes = crud_read(fh, tbuf, count);
+			} else {
+				// Scatter the read over three pieces of the buffer
+				cut1 = getRandomValue(0, count);
+				cut2 = getRandomValue(cut1, count);
+				iov[0].iov_base = tbuf;
+				iov[0].iov_len = cut1;
+				iov[1].iov_base = &tbuf[cut1];
+				iov[1].iov_len = cut2 - cut1;
+				iov[2].iov_base = &tbuf[cut2];
+				iov[2].iov_len = count - cut2;
+				bytes = crud_readv(fh, iov, 3);
+			}
 			if (bytes == -1) {
 				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Read failure.");
 				return(-1);
@@ -613,7 +3567,7 @@ int crudIOUnitTest(void) {
 			// Create random block, check to make sure that the write is not too large
 			ch = getRandomValue(0, 0xff);
 			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
-			if (cio_utest_length+count >= CRUD_MAX_OBJECT_SIZE) {
+			if (cio_utest_length+count >= CRUD_MAX_FILE_SIZE) {
 
 				// Log, seek to end of file, create random value
 				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : append of %d bytes [%x]", count, ch);
@@ -639,11 +3593,24 @@ int crudIOUnitTest(void) {
 			ch = getRandomValue(0, 0xff);
 			count =  getRandomValue(1, CIO_UNIT_TEST_MAX_WRITE_SIZE);
 			// Check to make sure that the write is not too large
-			if (cio_utest_length+count < CRUD_MAX_OBJECT_SIZE) {
+			if (cio_utest_length+count < CRUD_MAX_FILE_SIZE) {
 				// Log the write, perform it
 				logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : write of %d bytes [%x]", count, ch);
 				memset(&cio_utest_buffer[cio_utest_position], ch, count);
-				bytes = crud_write(fh, &cio_utest_buffer[cio_utest_position], count);
+				if (getRandomValue(0, 1)) {
+					bytes = crud_write(fh, &cio_utest_buffer[cio_utest_position], count);
+				} else {
+					// Gather the write from three pieces (header, payload, trailer)
+					cut1 = getRandomValue(0, count);
+					cut2 = getRandomValue(cut1, count);
+					iov[0].iov_base = &cio_utest_buffer[cio_utest_position];
+					iov[0].iov_len = cut1;
+					iov[1].iov_base = &cio_utest_buffer[cio_utest_position+cut1];
+					iov[1].iov_len = cut2 - cut1;
+					iov[2].iov_base = &cio_utest_buffer[cio_utest_position+cut2];
+					iov[2].iov_len = count - cut2;
+					bytes = crud_writev(fh, iov, 3);
+				}
 				if (bytes!=count) {
 					logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : write failed [%d].", count);
 					return(-1);
@@ -680,20 +3647,25 @@ int crudIOUnitTest(void) {
 		uint32_t length;
 		uint8_t res, flags;
 
-		// Make a fake request to get file handle, then check it
-		request = construct_crud_request(crud_file_table[0].object_id, CRUD_READ, CRUD_MAX_OBJECT_SIZE, CRUD_NULL_FLAG, 0);
-		response = crud_client_operation(request, tbuf);
-		if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
-			logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
-			return(-1);
-		}
-		if ( (cio_utest_length != length) || (memcmp(cio_utest_buffer, tbuf, length)) ) {
-			logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
-			bufToString((unsigned char *)tbuf, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
-			bufToString((unsigned char *)cio_utest_buffer, length, (unsigned char *)lstr, 1024 );
-			logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
-			return(-1);
+		// Read each extent of the file straight from the store, then check it
+		uint32_t ext, extlen;
+		for (ext=0; ext*CRUD_EXTENT_SIZE<cio_utest_length; ext++) {
+			extlen = crud_extent_span(crud_file_table[0].length, ext);
+			request = construct_crud_request(crud_file_table[0].extents[ext], CRUD_READ,
+					crud_extent_span(crud_file_table[0].capacity, ext), CRUD_NULL_FLAG, 0);
+			response = crud_client_operation(request, tbuf);
+			if ((deconstruct_crud_request(response, &oid, &req, &length, &flags, &res) != 0) || (res != 0))  {
+				logMessage(LOG_ERROR_LEVEL, "Read failure, bad CRUD response [%x]", response);
+				return(-1);
+			}
+			if ( (extlen > length) || (memcmp(&cio_utest_buffer[ext*CRUD_EXTENT_SIZE], tbuf, extlen)) ) {
+				logMessage(LOG_ERROR_LEVEL, "Buffer/Object cross validation failed [%x]", response);
+				bufToString((unsigned char *)tbuf, extlen, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST VR: %s", lstr);
+				bufToString((unsigned char *)&cio_utest_buffer[ext*CRUD_EXTENT_SIZE], extlen, (unsigned char *)lstr, 1024 );
+				logMessage(LOG_INFO_LEVEL, "CIO_UTEST VU: %s", lstr);
+				return(-1);
+			}
 		}
 
 		// Print out the buffer
@@ -708,6 +3680,18 @@ int crudIOUnitTest(void) {
 		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : Failure read comparison block.", fh);
 		return(-1);
 	}
+	if (crudDedupUnitTest(cio_utest_buffer, tbuf)) {
+		return(-1);
+	}
+	if (crudPackUnitTest(cio_utest_buffer, tbuf) || crudInlineUnitTest(cio_utest_buffer, tbuf) ||
+			crudListUnitTest() || crudThreadUnitTest()) {
+		return(-1);
+	}
+
+	// Check the first release's table is still mounted (and upgraded)
+	if (crudLegacyUnitTest(cio_utest_buffer, tbuf)) {
+		return(-1);
+	}
 	free(cio_utest_buffer);
 	free(tbuf);
 
@@ -721,35 +3705,660 @@ int crudIOUnitTest(void) {
 	return(0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudDedupUnitTest
+// Description  : Check that files with the same contents share their extent
+//                objects, that changing one copies the shared object rather
+//                than touching the other file, and that sharing survives a
+//                remount.
+//
+// Inputs       : data - a scratch buffer of CRUD_MAX_FILE_SIZE bytes
+//                check - another scratch buffer of the same size
+// Outputs      : 0 if successful, -1 if failure
+
+int crudDedupUnitTest(char *data, char *check) {
+	int32_t fa, fb, fc, length = CRUD_EXTENT_SIZE + CRUD_EXTENT_SIZE / 2;
+	int enabled = crud_dedup_enabled(), i;
+
+	// Write two files with the same contents
+	crud_dedup_enable(1);
+	for (i=0; i<length; i++) {
+		data[i] = (char)getRandomValue(0, 255);
+	}
+	fa = crud_open("dedup_a.txt");
+	fb = crud_open("dedup_b.txt");
+	if ((fa == -1) || (fb == -1) || (crud_write(fa, data, length) != length) ||
+			(crud_write(fb, data, length) != length) || crud_close(fa) || crud_close(fb)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup file write failed.");
+		return(-1);
+	}
+	if ((crud_file_table[fa].extents[0] != crud_file_table[fb].extents[0]) ||
+			(crud_file_table[fa].extents[1] != crud_file_table[fb].extents[1])) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : identical files do not share objects.");
+		return(-1);
+	}
+
+	// Change one, the other must keep its contents
+	if ((crud_open("dedup_b.txt") != fb) || crud_seek(fb, 10) || (crud_write(fb, "X", 1) != 1) ||
+			crud_close(fb) || (crud_open("dedup_a.txt") != fa) ||
+			(crud_read(fa, check, CRUD_MAX_FILE_SIZE) != length) || crud_close(fa)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup copy on write failed.");
+		return(-1);
+	}
+	if ((crud_file_table[fa].extents[0] == crud_file_table[fb].extents[0]) ||
+			(crud_file_table[fa].extents[1] != crud_file_table[fb].extents[1]) || memcmp(check, data, length)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : shared object changed under another file.");
+		return(-1);
+	}
+
+	// The index is stored with the table, a new copy after a remount still shares
+	if (crud_unmount() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup remount failed.");
+		return(-1);
+	}
+	fc = crud_open("dedup_c.txt");
+	if ((fc == -1) || (crud_write(fc, data, length) != length) || crud_close(fc) ||
+			(crud_file_table[fc].extents[0] != crud_file_table[fa].extents[0])) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : dedup lost across remount.");
+		return(-1);
+	}
+
+	// Log, return successfully
+	crud_dedup_enable(enabled);
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : dedup sharing and copy on write successful.");
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudPackUnitTest
+// Description  : Check that small files written a piece at a time share a
+//                few containers, that one grown past the threshold moves
+//                into extents, and that the rest survive repacking and a
+//                remount.
+//
+// Inputs       : data - a scratch buffer of CRUD_MAX_FILE_SIZE bytes
+//                check - another scratch buffer of the same size
+// Outputs      : 0 if successful, -1 if failure
+
+int crudPackUnitTest(char *data, char *check) {
+	int32_t fds[CRUD_PACK_UNIT_TEST_FILES], lengths[CRUD_PACK_UNIT_TEST_FILES], fd, done, piece, f, i;
+	CrudOID containers[CRUD_PACK_UNIT_TEST_FILES];
+	uint32_t threshold = crud_pack_get_threshold(), distinct = 0;
+	uint64_t repacked;
+	char name[32];
+
+	// Write the files a piece at a time, so each moves to larger slices as it grows
+	crud_pack_set_threshold(CRUD_PACK_UNIT_TEST_SIZE);
+	for (f=0; f<CRUD_PACK_UNIT_TEST_FILES; f++) {
+		snprintf(name, sizeof(name), "pack_%d.txt", f);
+		lengths[f] = getRandomValue(1, CRUD_PACK_UNIT_TEST_SIZE);
+		for (i=0; i<lengths[f]; i++) {
+			data[f*CRUD_PACK_UNIT_TEST_SIZE*2+i] = (char)getRandomValue(0, 255);
+		}
+		if ((fds[f] = crud_open(name)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : pack file open failed.");
+			return(-1);
+		}
+		for (done=0; done<lengths[f]; done+=piece) {
+			piece = getRandomValue(1, CRUD_PACK_UNIT_TEST_SIZE/8);
+			piece = (piece > lengths[f]-done) ? lengths[f]-done : piece;
+			if (crud_write(fds[f], &data[f*CRUD_PACK_UNIT_TEST_SIZE*2+done], piece) != piece) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : pack file write failed.");
+				return(-1);
+			}
+		}
+		if (crud_close(fds[f]) || (crud_file_table[fds[f]].pack == CRUD_NO_OBJECT) ||
+				(crud_file_table[fds[f]].capacity != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : small file not packed.");
+			return(-1);
+		}
+	}
+
+	// They should share a handful of containers
+	for (f=0; f<CRUD_PACK_UNIT_TEST_FILES; f++) {
+		for (i=0; (i<(int32_t)distinct) && (containers[i] != crud_file_table[fds[f]].pack); i++);
+		if (i == (int32_t)distinct) {
+			containers[distinct++] = crud_file_table[fds[f]].pack;
+		}
+	}
+	if (distinct > CRUD_PACK_UNIT_TEST_FILES/4) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : %u files packed into %u containers.",
+				CRUD_PACK_UNIT_TEST_FILES, distinct);
+		return(-1);
+	}
+
+	// Grow every other file past the threshold, leaving its slice dead
+	for (f=0; f<CRUD_PACK_UNIT_TEST_FILES; f+=2) {
+		fd = fds[f];
+		piece = CRUD_PACK_UNIT_TEST_SIZE*2 - lengths[f];
+		for (i=0; i<piece; i++) {
+			data[f*CRUD_PACK_UNIT_TEST_SIZE*2+lengths[f]+i] = (char)getRandomValue(0, 255);
+		}
+		if ((crud_open(CRUD_FILE_NAME(fd)) != fd) || crud_seek(fd, lengths[f]) ||
+				(crud_write(fd, &data[f*CRUD_PACK_UNIT_TEST_SIZE*2+lengths[f]], piece) != piece) ||
+				crud_close(fd) || (crud_file_table[fd].pack != CRUD_NO_OBJECT) ||
+				(crud_file_table[fd].capacity == 0)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : grown file not unpacked.");
+			return(-1);
+		}
+		lengths[f] = CRUD_PACK_UNIT_TEST_SIZE*2;
+	}
+
+	// The containers are now mostly dead space, the checkpoint repacks them
+	repacked = crud_pack_stats.repacked;
+	if (crud_unmount() || (crud_pack_stats.repacked == repacked) || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : pack repack or remount failed.");
+		return(-1);
+	}
+
+	// Every file must read back as written
+	for (f=0; f<CRUD_PACK_UNIT_TEST_FILES; f++) {
+		snprintf(name, sizeof(name), "pack_%d.txt", f);
+		if (((fd = crud_open(name)) == -1) || (crud_read(fd, check, CRUD_MAX_FILE_SIZE) != lengths[f]) ||
+				crud_close(fd) || memcmp(check, &data[f*CRUD_PACK_UNIT_TEST_SIZE*2], lengths[f]) ||
+				((f % 2 == 1) && (crud_file_table[fd].pack == CRUD_NO_OBJECT))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : packed file [%s] mismatch after remount.", name);
+			return(-1);
+		}
+	}
+
+	// Log, return successfully
+	crud_pack_set_threshold(threshold);
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : small file packing and repacking successful.");
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudInlineUnitTest
+// Description  : Check that tiny files are written and read without any
+//                server requests, that one grown past the threshold is
+//                promoted, and that the rest survive a remount.
+//
+// Inputs       : data - a scratch buffer of CRUD_MAX_FILE_SIZE bytes
+//                check - another scratch buffer of the same size
+// Outputs      : 0 if successful, -1 if failure
+
+int crudInlineUnitTest(char *data, char *check) {
+	int32_t lengths[CRUD_INLINE_UNIT_TEST_FILES], fd, done, piece, f, i;
+	uint32_t threshold = crud_inline_threshold;
+	uint64_t requests;
+	char name[32];
+
+	// Write the files a piece at a time, then read them back, all without the server
+	if (crud_set_inline(CRUD_INLINE_UNIT_TEST_SIZE)) {
+		return(-1);
+	}
+	requests = __atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED);
+	for (f=0; f<CRUD_INLINE_UNIT_TEST_FILES; f++) {
+		snprintf(name, sizeof(name), "inline_%d.txt", f);
+		lengths[f] = getRandomValue(1, CRUD_INLINE_UNIT_TEST_SIZE);
+		for (i=0; i<lengths[f]; i++) {
+			data[f*CRUD_INLINE_UNIT_TEST_SIZE*2+i] = (char)getRandomValue(0, 255);
+		}
+		if ((fd = crud_open(name)) == -1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline file open failed.");
+			return(-1);
+		}
+		for (done=0; done<lengths[f]; done+=piece) {
+			piece = getRandomValue(1, CRUD_INLINE_UNIT_TEST_SIZE/4);
+			piece = (piece > lengths[f]-done) ? lengths[f]-done : piece;
+			if (crud_write(fd, &data[f*CRUD_INLINE_UNIT_TEST_SIZE*2+done], piece) != piece) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline file write failed.");
+				return(-1);
+			}
+		}
+		if (crud_seek(fd, 0) || (crud_read(fd, check, CRUD_MAX_FILE_SIZE) != lengths[f]) ||
+				memcmp(check, &data[f*CRUD_INLINE_UNIT_TEST_SIZE*2], lengths[f]) || crud_close(fd) ||
+				(crud_file_table[fd].inline_data == NULL)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline file [%s] mismatch.", name);
+			return(-1);
+		}
+	}
+	if (__atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED) != requests) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline files sent %llu requests.",
+				(unsigned long long)(__atomic_load_n(&crud_client_requests, __ATOMIC_RELAXED) - requests));
+		return(-1);
+	}
+
+	// Grow the first past the threshold, it must move out of its entry
+	piece = CRUD_INLINE_UNIT_TEST_SIZE*2 - lengths[0];
+	for (i=0; i<piece; i++) {
+		data[lengths[0]+i] = (char)getRandomValue(0, 255);
+	}
+	if (((fd = crud_open("inline_0.txt")) == -1) || crud_seek(fd, lengths[0]) ||
+			(crud_write(fd, &data[lengths[0]], piece) != piece) || crud_close(fd) ||
+			(crud_file_table[fd].inline_data != NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : grown inline file not promoted.");
+		return(-1);
+	}
+	lengths[0] = CRUD_INLINE_UNIT_TEST_SIZE*2;
+
+	// The bytes are stored with the table, every file must survive a remount
+	if (crud_unmount() || crud_mount()) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline remount failed.");
+		return(-1);
+	}
+	for (f=0; f<CRUD_INLINE_UNIT_TEST_FILES; f++) {
+		snprintf(name, sizeof(name), "inline_%d.txt", f);
+		if (((fd = crud_open(name)) == -1) || (crud_read(fd, check, CRUD_MAX_FILE_SIZE) != lengths[f]) ||
+				crud_close(fd) || memcmp(check, &data[f*CRUD_INLINE_UNIT_TEST_SIZE*2], lengths[f]) ||
+				((f > 0) && (crud_file_table[fd].inline_data == NULL))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : inline file [%s] mismatch after remount.", name);
+			return(-1);
+		}
+	}
+
+	// Log, return successfully
+	crud_set_inline(threshold);
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : inline files served without server requests.");
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudListUnitTest
+// Description  : Check that a prefix listing returns exactly the files under
+//                it, in name order, that stat agrees with what was written,
+//                and that both survive a remount.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
+int crudListUnitTest(void) {
+	char names[CRUD_LIST_UNIT_TEST_FILES][32], *seen[CRUD_LIST_UNIT_TEST_FILES+1];
+	int32_t order[CRUD_LIST_UNIT_TEST_FILES], fd, f, i, t, pass;
+	CrudFileStat stat;
 
+	// Create files in two directories, in shuffled order, the length of each its number
+	for (f=0; f<CRUD_LIST_UNIT_TEST_FILES; f++) {
+		order[f] = f;
+	}
+	for (f=CRUD_LIST_UNIT_TEST_FILES-1; f>0; f--) {
+		i = getRandomValue(0, f);
+		t = order[f];
+		order[f] = order[i];
+		order[i] = t;
+	}
+	for (f=0; f<CRUD_LIST_UNIT_TEST_FILES; f++) {
+		snprintf(names[order[f]], sizeof(names[0]), "list/a/%03d", order[f]);
+		if (((fd = crud_open(names[order[f]])) == -1) || (crud_write(fd, names[0], order[f] % 32) != order[f] % 32) ||
+				crud_close(fd)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : list file create failed.");
+			return(-1);
+		}
+		snprintf(names[order[f]], sizeof(names[0]), "list/b/%03d", order[f]);
+		if (((fd = crud_open(names[order[f]])) == -1) || crud_close(fd)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : list file create failed.");
+			return(-1);
+		}
+		snprintf(names[order[f]], sizeof(names[0]), "list/a/%03d", order[f]);
+	}
 
+	for (pass=0; pass<2; pass++) {
 
+		// The "list/a/" files only, sorted, and a listing stopped early
+		memset(seen, 0x0, sizeof(seen));
+		if ((crud_list("list/a/", crud_list_unit_test_callback, seen) != CRUD_LIST_UNIT_TEST_FILES) ||
+				(crud_list("list/a", crud_list_unit_test_callback, NULL) != 1) ||
+				(crud_list("list/c/", crud_list_unit_test_callback, seen) != 0)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : list returned the wrong number of files.");
+			return(-1);
+		}
+		for (f=0; f<CRUD_LIST_UNIT_TEST_FILES; f++) {
+			if ((seen[f] == NULL) || strcmp(seen[f], names[f])) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : list entry %d is [%s], expected [%s].", f,
+						(seen[f] == NULL) ? "" : seen[f], names[f]);
+				return(-1);
+			}
+			free(seen[f]);
+			if (crud_stat(names[f], &stat) || (stat.length != (uint32_t)f % 32) || stat.open) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : stat of [%s] wrong.", names[f]);
+				return(-1);
+			}
+		}
+		if (crud_stat("list/a/none", &stat) != -1) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : stat found a missing file.");
+			return(-1);
+		}
 
+		// The order is rebuilt from the stored table
+		if ((pass == 0) && (crud_unmount() || crud_mount())) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : list remount failed.");
+			return(-1);
+		}
+	}
 
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : prefix listing and stat successful.");
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_list_unit_test_callback
+// Description  : Record the names listed, in order (stops at once if there
+//                is nowhere to record them)
+//
+// Inputs       : stat - the file listed
+//                arg - the array of names seen so far (NULL terminated), or NULL
+// Outputs      : 0 to continue the listing, 1 to stop
 
+int crud_list_unit_test_callback(const CrudFileStat *stat, void *arg) {
+	char **seen = arg;
+	int i;
 
+	if (seen == NULL) {
+		return(1);
+	}
+	for (i=0; (i<CRUD_LIST_UNIT_TEST_FILES) && (seen[i] != NULL); i++);
+	if (i < CRUD_LIST_UNIT_TEST_FILES) {
+		seen[i] = strdup(stat->path);
+	}
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudThreadUnitTest
+// Description  : Run threads that each write, read back and close a file of
+//                their own while all of them append records to one shared
+//                file, then check every file holds what was written to it
+//                (the shared one every record once, each thread's in order).
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
+int crudThreadUnitTest(void) {
+	CrudThreadUnitTest tests[CRUD_THREAD_UNIT_TEST_THREADS];
+	uint8_t seen[CRUD_THREAD_UNIT_TEST_THREADS][CRUD_THREAD_UNIT_TEST_RECORDS];
+	uint32_t length = CRUD_THREAD_UNIT_TEST_THREADS*CRUD_THREAD_UNIT_TEST_RECORDS*CRUD_THREAD_UNIT_TEST_RECORD;
+	uint16_t t, r, next[CRUD_THREAD_UNIT_TEST_THREADS];
+	int32_t fd, i, j, started, failed = 0;
+	char name[32], *check, *record;
+
+	// Start the threads on the shared file
+	if ((fd = crud_open("thread_shared.txt")) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : shared file open failed.");
+		return(-1);
+	}
+	memset(tests, 0x0, sizeof(tests));
+	for (started=0; started<CRUD_THREAD_UNIT_TEST_THREADS; started++) {
+		tests[started].id = started;
+		tests[started].shared = fd;
+		if (pthread_create(&tests[started].thread, NULL, crud_thread_unit_test_worker, &tests[started]) != 0) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : thread create failed.");
+			failed = 1;
+			break;
+		}
+	}
+	for (i=0; i<started; i++) {
+		pthread_join(tests[i].thread, NULL);
+		failed |= tests[i].failed;
+	}
 
+	// Each thread's file holds what it wrote
+	check = malloc(CRUD_MAX_FILE_SIZE);
+	for (i=0; (i<started) && !failed; i++) {
+		snprintf(name, sizeof(name), "thread_%d.txt", i);
+		if (((j = crud_open(name)) == -1) || (crud_read(j, check, CRUD_MAX_FILE_SIZE) != (int32_t)tests[i].length) ||
+				memcmp(check, tests[i].data, tests[i].length) || crud_close(j)) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : thread file [%s] mismatch.", name);
+			failed = 1;
+		}
+	}
 
+	// The shared file has every record whole, once, and each thread's in the order written
+	memset(seen, 0x0, sizeof(seen));
+	memset(next, 0x0, sizeof(next));
+	if (!failed && (crud_seek(fd, 0) || (crud_read(fd, check, CRUD_MAX_FILE_SIZE) != (int32_t)length))) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : shared file is the wrong length.");
+		failed = 1;
+	}
+	for (i=0; (i<(int32_t)length) && !failed; i+=CRUD_THREAD_UNIT_TEST_RECORD) {
+		record = &check[i];
+		memcpy(&t, record, sizeof(t));
+		memcpy(&r, &record[sizeof(t)], sizeof(r));
+		for (j=sizeof(t)+sizeof(r); (j<CRUD_THREAD_UNIT_TEST_RECORD) && (t<CRUD_THREAD_UNIT_TEST_THREADS) &&
+				(record[j] == (char)(t*CRUD_THREAD_UNIT_TEST_RECORDS + r + j)); j++);
+		if ((j < CRUD_THREAD_UNIT_TEST_RECORD) || (r != next[t]) || seen[t][r]) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : shared file record at %d is torn or out of order.", i);
+			failed = 1;
+			break;
+		}
+		seen[t][r] = 1;
+		next[t]++;
+	}
+	if (crud_close(fd)) {
+		failed = 1;
+	}
 
+	// Cleanup, return
+	for (i=0; i<started; i++) {
+		free(tests[i].data);
+	}
+	free(check);
+	if (failed) {
+		return(-1);
+	}
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : %d threads on separate and shared files successful.",
+			CRUD_THREAD_UNIT_TEST_THREADS);
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_thread_unit_test_worker
+// Description  : One thread of the threading test, writing its own file in
+//                random pieces between appends to the shared file, then
+//                reading it back before and after closing it
+//
+// Inputs       : arg - the thread's CrudThreadUnitTest
+// Outputs      : NULL
+
+void *crud_thread_unit_test_worker(void *arg) {
+	CrudThreadUnitTest *test = arg;
+	char name[32], record[CRUD_THREAD_UNIT_TEST_RECORD], *check;
+	int32_t fd, count, pass, i;
+	uint16_t r;
+
+	// Open a file of our own, pick its contents
+	snprintf(name, sizeof(name), "thread_%d.txt", test->id);
+	test->length = getRandomValue(1, 3*CRUD_EXTENT_SIZE);
+	test->data = malloc(test->length);
+	check = malloc(test->length);
+	for (i=0; i<(int32_t)test->length; i++) {
+		test->data[i] = (char)getRandomValue(0, 255);
+	}
+	if ((fd = crud_open(name)) == -1) {
+		test->failed = 1;
+		free(check);
+		return(NULL);
+	}
 
+	// Write it in pieces, appending a record to the shared file after each
+	for (r=0, i=0; (r<CRUD_THREAD_UNIT_TEST_RECORDS) && !test->failed; r++) {
+		count = test->length / CRUD_THREAD_UNIT_TEST_RECORDS + ((r == 0) ? test->length % CRUD_THREAD_UNIT_TEST_RECORDS : 0);
+		if ((count > 0) && (crud_write(fd, &test->data[i], count) != count)) {
+			test->failed = 1;
+		}
+		i += count;
+		memcpy(record, &test->id, sizeof(test->id));
+		memcpy(&record[sizeof(test->id)], &r, sizeof(r));
+		for (count=sizeof(test->id)+sizeof(r); count<CRUD_THREAD_UNIT_TEST_RECORD; count++) {
+			record[count] = (char)(test->id*CRUD_THREAD_UNIT_TEST_RECORDS + r + count);
+		}
+		if (crud_write(test->shared, record, CRUD_THREAD_UNIT_TEST_RECORD) != CRUD_THREAD_UNIT_TEST_RECORD) {
+			test->failed = 1;
+		}
+	}
 
+	// Read it back from the start, then again after closing and reopening
+	for (pass=0; (pass<2) && !test->failed; pass++) {
+		if (crud_seek(fd, 0) || (crud_read(fd, check, test->length) != (int32_t)test->length) ||
+				memcmp(check, test->data, test->length) || crud_close(fd) ||
+				((pass == 0) && ((fd = crud_open(name)) == -1))) {
+			test->failed = 1;
+		}
+	}
+	if (test->failed) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : thread %d failed on [%s].", test->id, name);
+	}
+	free(check);
+	return(NULL);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudLegacyUnitTest
+// Description  : Check that a first release table, built by hand, is mounted
+//                with its files intact, and that the next checkpoint upgrades
+//                it (deleting the objects the files no longer need).  This
+//                formats the store.
+//
+// Inputs       : data - a scratch buffer of CRUD_MAX_FILE_SIZE bytes
+//                check - another scratch buffer of the same size
+// Outputs      : 0 if successful, -1 if failure
 
+int crudLegacyUnitTest(char *data, char *check) {
+	uint32_t lengths[CRUD_LEGACY_UNIT_TEST_FILES] = { 0, 1000, CRUD_EXTENT_SIZE, 3*CRUD_EXTENT_SIZE+100 };
+	CrudOID oids[CRUD_LEGACY_UNIT_TEST_FILES];
+	CrudLegacyFileEntry *table;
+	struct GenResponse response;
+	uint32_t i, f;
 
+	// File f holds the bytes from data[f], one object each
+	for (i=0; i<CRUD_MAX_OBJECT_SIZE; i++) {
+		data[i] = (char)getRandomValue(0, 255);
+	}
+	if (crud_legacy_unit_test_clear() ||
+			((table = calloc(CRUD_LEGACY_TABLE_FILES, sizeof(CrudLegacyFileEntry))) == NULL)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : legacy store setup failed.");
+		return(-1);
+	}
+	for (f=0; f<CRUD_LEGACY_UNIT_TEST_FILES; f++) {
+		snprintf(table[f].filename, CRUD_MAX_PATH_LENGTH, "legacy_%u.txt", f);
+		table[f].length = lengths[f];
+		if (crud_legacy_unit_test_create(&oids[f], &data[f], lengths[f], 0)) {
+			free(table);
+			return(-1);
+		}
+		table[f].object_id = oids[f];
+	}
+	if (crud_legacy_unit_test_create(NULL, table, CRUD_LEGACY_TABLE_FILES*sizeof(CrudLegacyFileEntry),
+			CRUD_PRIORITY_OBJECT)) {
+		free(table);
+		return(-1);
+	}
+	free(table);
+
+	// Mount it, then upgrade it, the files must read back the same each time
+	if (crud_mount() || (crud_table_upgrade == 0) ||
+			crud_legacy_unit_test_check(CRUD_LEGACY_UNIT_TEST_FILES, lengths, data, check) ||
+			crud_unmount() || crud_mount() || crud_table_upgrade ||
+			(crud_table_stored != sizeof(CrudTableSuperblock)) ||
+			crud_legacy_unit_test_check(CRUD_LEGACY_UNIT_TEST_FILES, lengths, data, check)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : first release table not upgraded.");
+		return(-1);
+	}
 
+	// The empty and the copied file's objects are gone, the others are extents now
+	for (f=0; f<CRUD_LEGACY_UNIT_TEST_FILES; f++) {
+		CrudRequest readRequest = create_crud_request( oids[f], CRUD_READ, CRUD_MAX_OBJECT_SIZE, 0, 0 );
+		CrudResponse readResponse = crud_cache_operation( readRequest, check );
+		extract_crud_response( readResponse, &response.objectId, &response.request, &response.length,
+				&response.flag, &response.succeed );
+		if ((response.succeed == 0) != ((lengths[f] > 0) && (lengths[f] <= CRUD_EXTENT_SIZE))) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : first release object [%u] not retired.", oids[f]);
+			return(-1);
+		}
+	}
 
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_IO_UNIT_TEST : first release file table mounted and upgraded.");
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_legacy_unit_test_clear
+// Description  : Format the store and delete the superblock, to put a hand
+//                built table in its place
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
+int crud_legacy_unit_test_clear(void) {
+	struct GenResponse response;
 
+	if (crud_format()) {
+		return(-1);
+	}
+	CrudRequest deleteRequest = create_crud_request( 0, CRUD_DELETE, 0, CRUD_PRIORITY_OBJECT, 0 );
+	CrudResponse deleteResponse = crud_cache_operation( deleteRequest, NULL );
+	extract_crud_response( deleteResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	return((response.succeed != 0) ? -1 : 0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_legacy_unit_test_create
+// Description  : Create an object for a hand built table
+//
+// Inputs       : oid - where to return the new object (NULL if not needed)
+//                buf - the contents
+//                length - the size of the object
+//                flags - CRUD_PRIORITY_OBJECT for the priority object, else 0
+// Outputs      : 0 if successful, -1 if failure
 
+int crud_legacy_unit_test_create(CrudOID *oid, void *buf, uint32_t length, int flags) {
+	struct GenResponse response;
 
+	CrudRequest createRequest = create_crud_request( 0, CRUD_CREATE, length, flags, 0 );
+	CrudResponse createResponse = crud_cache_operation( createRequest, buf );
+	extract_crud_response( createResponse, &response.objectId, &response.request, &response.length,
+			&response.flag, &response.succeed );
+	if (response.succeed != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : legacy object create failed.");
+		return(-1);
+	}
+	if (oid != NULL) {
+		*oid = response.objectId;
+	}
+	return(0);
+}
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_legacy_unit_test_check
+// Description  : Check the files of a hand built table read back as written
+//                (file f, named "legacy_<f>.txt", holding the bytes from
+//                data[f], the empty ones not checked)
+//
+// Inputs       : files - the number of files
+//                lengths - the length of each file
+//                data - the bytes written
+//                check - a scratch buffer of CRUD_MAX_FILE_SIZE bytes
+// Outputs      : 0 if successful, -1 if failure
 
+int crud_legacy_unit_test_check(uint32_t files, uint32_t *lengths, char *data, char *check) {
+	char name[32];
+	int32_t fd;
+	uint32_t f;
 
+	for (f=0; f<files; f++) {
+		if (lengths[f] == 0) {
+			continue;
+		}
+		snprintf(name, sizeof(name), "legacy_%u.txt", f);
+		if (((fd = crud_open(name)) == -1) || (crud_read(fd, check, CRUD_MAX_FILE_SIZE) != lengths[f]) ||
+				crud_close(fd) || memcmp(check, &data[f], lengths[f])) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD_IO_UNIT_TEST : legacy file [%s] mismatch.", name);
+			return(-1);
+		}
+	}
+	return(0);
+}
@@ -13,24 +13,154 @@
 
 // Include files
 #include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 // Project include files
 #include <crud_driver.h>
 
 // Defines
-#define CRUD_MAX_TOTAL_FILES 1024
+#define CRUD_INITIAL_TABLE_FILES 64 // File table entries allocated at first, doubled as needed
 #define CRUD_MAX_PATH_LENGTH 128
+#define CRUD_EXTENT_SIZE 0x10000  // Bytes of the file held in each object
+#define CRUD_MAX_FILE_EXTENTS 64  // Extents per file (4 MB files)
+#define CRUD_MAX_FILE_SIZE (CRUD_EXTENT_SIZE*CRUD_MAX_FILE_EXTENTS)
+#define CRUD_MIN_EXTENT_ALLOCATION 512 // Smallest extent object created
+#define CRUD_TABLE_PAGE_FILES 64  // File table entries stored in each table page object
+#define CRUD_TABLE_MAGIC 0x43525544 // Marks a stored file table ("CRUD")
+#define CRUD_TABLE_VERSION 1      // Version of the stored file table encoding
+#define CRUD_LEGACY_TABLE_FILES 1024 // Entries in the first release's fixed table
+#define CRUD_READ_AHEAD_MIN 0x2000 // First read-ahead window, doubled as sequential reads use it up
+#define CRUD_READ_AHEAD_MAX CRUD_EXTENT_SIZE // Largest read-ahead window
+#define CRUD_FLUSH_GROUP 256 // Dirty files locked and flushed together by a full flush
+#define CRUD_INLINE_MAX 256  // Largest file that may be held inline in its table entry
 
 // Type definitions
 
+// This is a file's read-ahead state.  A read starting where the last one
+// ended is taken as sequential, and while reads stay sequential the bytes
+// past them are fetched in the same request (the window doubling each
+// fetch).  The buffer holds stored bytes only, buffered writes are laid
+// over reads served from it as they are over any other.
+typedef struct {
+	pthread_mutex_t mutex;  // Guards the rest, as readers share the file lock
+	uint32_t        next;   // Where the next sequential read would start
+	uint32_t        window; // Bytes to fetch ahead (0 if reads are not sequential)
+	uint32_t        offset; // File position of the buffered bytes
+	uint32_t        length; // Bytes buffered (0 if none)
+	char           *data;   // The buffer (CRUD_READ_AHEAD_MAX bytes, from the pool)
+} CrudReadAhead;
+
 // This is the basic file handle structure (note: index into file table is fh)
+// The file is stored as a list of extent objects, extent i holding bytes
+// [i*CRUD_EXTENT_SIZE, (i+1)*CRUD_EXTENT_SIZE) of the file.  Every extent but
+// the last is full, and the last object may be larger than the data in it
+// (capacity >= length), so the object sizes follow from the capacity.  The
+// filenames are kept together in a string pool, the table grows as files
+// are created.  A small file may instead be packed into a slice of a shared
+// container object (see crud_pack.h), and a tiny one held inline in its
+// table entry (stored with the table), in either case it has no extents
+// (capacity is 0).  File operations hold the table lock shared and the
+// file's own lock, changing the table itself takes the table lock
+// exclusively.
+typedef struct {
+	uint32_t  name;         // Offset of the filename in the name pool
+	uint32_t  position;     // This is the position of the file
+	uint32_t  length;       // This is the length of the file
+	uint32_t  capacity;     // Bytes allocated in the extent objects
+	uint16_t  extent_slots; // Entries allocated in extents
+	CrudOID   pack;         // The container holding the file (CRUD_NO_OBJECT if not packed)
+	uint32_t  pack_offset;  // Where the file's slice starts in the container
+	uint32_t  pack_size;    // The size of the slice
+	char     *inline_data;  // The file contents (CRUD_INLINE_MAX bytes, NULL if not inline)
+	uint8_t   open;         // Flag indicating the file is currently open
+	CrudOID  *extents;      // The objects holding the file contents
+	pthread_rwlock_t *lock; // Shared by readers, held alone by writers
+	CrudReadAhead *ahead;   // Read-ahead for sequential readers
+} CrudFileAllocationType;
+
+// The table is stored in pages of CRUD_TABLE_PAGE_FILES entries, each page
+// its own object, listed in a directory object.  The priority object holds
+// this (fixed size) superblock locating the directory.  Page entries are
+// encoded as [name length (16), name, length (32), capacity (32), extent
+// count (16), extent OIDs (32 each), container OID (32)], followed by the
+// slice offset (32) and size (32) if the file is packed, then [inline
+// length (16), inline bytes] (0 and none if the file is not inline).  The
+// superblock also locates the dedup index (see crud_dedup.h).  The first
+// release's fixed array of CrudLegacyFileEntry in the priority object is
+// still mounted, and rewritten in this encoding at the next checkpoint.
+typedef struct {
+	uint32_t  magic;     // CRUD_TABLE_MAGIC
+	uint32_t  version;   // CRUD_TABLE_VERSION
+	uint32_t  files;     // The number of files in the table
+	uint32_t  pages;     // The number of pages in the directory
+	CrudOID   directory; // The directory object (CRUD_NO_OBJECT if no pages)
+	uint32_t  dir_size;  // The size of the directory object
+	CrudOID   dedup;     // The dedup index object (CRUD_NO_OBJECT if none)
+	uint32_t  dedup_size; // The size of the dedup index object
+} CrudTableSuperblock;
+
+// This is a directory entry, locating one page of the table
+typedef struct {
+	CrudOID   object; // The object holding the page
+	uint32_t  size;   // The size of the object (the encoding may be shorter)
+} CrudTablePage;
+
+// This is an entry of the first release's table, CRUD_LEGACY_TABLE_FILES of
+// them filled in order (the first with an empty name ends the table), each
+// file held whole in one object of its length
 typedef struct {
 	char      filename[CRUD_MAX_PATH_LENGTH]; // The filename of the data to be manipulated
 	CrudOID   object_id;                      // The handle of the object
 	uint32_t  position;                       // This is the position of the file
 	uint32_t  length;                         // This is the length of the file
 	uint8_t   open;                           // Flag indicating the file is currently open
-} CrudFileAllocationType;
+} CrudLegacyFileEntry;
+
+// This is how a file's contents are stored
+typedef enum {
+	CRUD_STORED_EXTENTS = 0, // In extent objects of its own (or nowhere yet)
+	CRUD_STORED_PACKED  = 1, // In a slice of a shared container
+	CRUD_STORED_INLINE  = 2, // In its table entry
+} CRUD_STORAGE_TYPES;
+
+// This is what crud_stat reports about a file
+typedef struct {
+	char     path[CRUD_MAX_PATH_LENGTH]; // The filename
+	uint32_t length;     // The length of the file (including buffered writes)
+	uint32_t allocated;  // Bytes allocated to it in server objects
+	CRUD_STORAGE_TYPES storage; // How its contents are stored
+	uint8_t  open;       // Flag indicating the file is currently open
+} CrudFileStat;
+
+// Called by crud_list for each file, returns non-zero to stop the listing
+typedef int (*CrudListCallback)(const CrudFileStat *stat, void *arg);
+
+// These are the write-back statistics
+typedef struct {
+	uint64_t writes_buffered; // Writes held in dirty ranges
+	uint64_t bytes_buffered;  // Bytes written into dirty ranges
+	uint64_t ranges_flushed;  // Coalesced ranges written through
+	uint64_t bytes_flushed;   // Bytes written through by flushes
+	uint64_t flush_requests;  // Server requests made by flushes
+} CrudWriteBackStats;
+
+// These are the read path statistics
+typedef struct {
+	uint64_t reads;         // Reads that returned data
+	uint64_t bytes_read;    // Bytes returned to callers
+	uint64_t bytes_copied;  // Bytes staged in a scratch buffer, not received in place
+	uint64_t ahead_fetches; // Read-ahead fetches sent to the server
+	uint64_t ahead_hits;    // Reads served entirely from read-ahead
+} CrudReadStats;
+
+// These are the inline file statistics
+typedef struct {
+	uint64_t writes;   // Writes held in table entries
+	uint64_t reads;    // Reads served from table entries
+	uint64_t bytes;    // Bytes written and read inline (no server traffic)
+	uint64_t promoted; // Files grown out of their table entries
+} CrudInlineStats;
 
 //
 // Management operations
@@ -44,24 +174,69 @@ uint16_t crud_mount(void);
 uint16_t crud_unmount(void);
 	// This function unmounts the current crud file system and saves the file allocation table.
 
+uint16_t crud_checkpoint(void);
+	// This function saves the changed pages of the file allocation table.
+
 //
 // Interface functions
 
-int16_t crud_open(char *path);
+int32_t crud_open(char *path);
 	// This function opens the file and returns a file handle
 
-int16_t crud_close(int16_t fd);
+int16_t crud_close(int32_t fd);
 	// This function closes the file
 
-int32_t crud_read(int16_t fd, void *buf, int32_t count);
+int32_t crud_read(int32_t fd, void *buf, int32_t count);
 	// Reads "count" bytes from the file handle "fh" into the buffer  "buf"
 
-int32_t crud_write(int16_t fd, void *buf, int32_t count);
+int32_t crud_write(int32_t fd, void *buf, int32_t count);
 	// Writes "count" bytes to the file handle "fh" from the buffer  "buf"
 
-int32_t crud_seek(int16_t fd, uint32_t loc);
+int32_t crud_readv(int32_t fd, const struct iovec *iov, int iovcnt);
+	// Reads from the file handle "fh" into each of the "iovcnt" buffers in turn
+
+int32_t crud_writev(int32_t fd, const struct iovec *iov, int iovcnt);
+	// Writes the "iovcnt" buffers to the file handle "fh" as a single write
+
+int32_t crud_seek(int32_t fd, uint32_t loc);
 	// Seek to specific point in the file
 
+int16_t crud_flush(int32_t fd);
+	// Write any buffered writes for the file through to the server
+
+int crud_stat(char *path, CrudFileStat *stat);
+	// Describe the file "path" (without opening it), -1 if there is no such file
+
+int32_t crud_list(char *prefix, CrudListCallback callback, void *arg);
+	// Call back for each file whose name starts with "prefix", in name order
+
+//
+// Write-back buffering
+
+int crud_set_write_back(uint32_t budget);
+	// Buffer writes until close/flush/unmount or budget bytes are held (0 = off)
+
+void crud_write_back_log_stats(void);
+	// Log the write-back counters
+
+extern CrudWriteBackStats crud_write_back_stats; // The write-back counters
+
+void crud_read_log_stats(void);
+	// Log the read path counters
+
+extern CrudReadStats crud_read_stats; // The read path counters
+
+//
+// Inline files
+
+int crud_set_inline(uint32_t threshold);
+	// Hold files of at most threshold bytes in their table entries (0 = off)
+
+void crud_inline_log_stats(void);
+	// Log the inline file counters
+
+extern CrudInlineStats crud_inline_stats; // The inline file counters
+
 //
 // Unit testing for the module
 
@@ -20,6 +20,45 @@
 #define CRUD_NET_HEADER_SIZE sizeof(CrudResponse)
 #define CRUD_DEFAULT_IP "127.0.0.1"
 #define CRUD_DEFAULT_PORT 19876
+#define CRUD_RANGE_HEADER_SIZE sizeof(uint32_t)
+#define CRUD_BATCH_MAX_OPS 4096 // Most requests sent in a single CRUD_BATCH
+#define CRUD_BATCH_MAX_BYTES 0x100000 // Request bytes the client frames into one CRUD_BATCH
+#define CRUD_MAX_CONNECTIONS 16 // Most connections the client keeps open to the server
+#define CRUD_PIPELINE_MAX_WINDOW 64 // Most tagged requests in flight on one connection
+#define CRUD_TAG_SIZE sizeof(uint32_t)
+#define CRUD_RECEIVE_BUFFER_SIZE 0x10000 // Bytes the client reads from a connection at once
+
+// Protocol extensions, requested by the client with the CRUD_NEGOTIATE flag on
+// a zero length CRUD_INIT and granted in the length field of the response.  The
+// server must set CRUD_CAP_ACK in the response for any grant to count, so an
+// older server that echoes the request back is treated as granting nothing.
+#define CRUD_CAP_READ_RANGE 0x000001 // Server understands CRUD_READ_RANGE
+#define CRUD_CAP_BATCH      0x000002 // Server understands CRUD_BATCH
+#define CRUD_CAP_COMPRESS   0x000004 // Server understands CRUD_COMPRESSED payloads
+#define CRUD_CAP_WRITE_RANGE 0x000008 // Server understands CRUD_WRITE_RANGE
+#define CRUD_CAP_PIPELINE   0x000010 // Server understands CRUD_TAGGED requests
+#define CRUD_CAP_ACK        0x800000 // Server understood the negotiation
+#define CRUD_CLIENT_CAPABILITIES (CRUD_CAP_READ_RANGE|CRUD_CAP_BATCH|CRUD_CAP_COMPRESS|CRUD_CAP_WRITE_RANGE|\
+		CRUD_CAP_PIPELINE)
+
+// Type definitions
+
+// This is one request of a batch (see crud_client_batch)
+typedef struct {
+	CrudRequest  request;  // The request
+	uint32_t     offset;   // The offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+	void        *buf;      // The bytes to send, or the buffer to read into
+	CrudResponse response; // The response, once the batch completes
+} CrudBatchOp;
+
+// These are the client's transport counters (see crud_client_log_stats)
+typedef struct {
+	uint64_t operations; // Requests made of the client, each request of a batch counts
+	uint64_t writes;     // write/writev calls
+	uint64_t reads;      // read calls
+	uint64_t sent;       // Bytes written
+	uint64_t received;   // Bytes read
+} CrudTransportStats;
 
 //
 // Functional Prototypes
@@ -27,6 +66,18 @@
 CrudResponse crud_client_operation(CrudRequest op, void *buf);
     // This is the implementation of the client operation (crud_client.c)
 
+CrudResponse crud_client_read_range(CrudRequest op, uint32_t offset, void *buf);
+    // Read length bytes of an object starting at offset (CRUD_READ_RANGE)
+
+CrudResponse crud_client_write_range(CrudRequest op, uint32_t offset, void *buf);
+    // Write length bytes of an object starting at offset (CRUD_WRITE_RANGE)
+
+int crud_client_batch(CrudBatchOp *ops, uint32_t count);
+    // Send a list of requests in one exchange (CRUD_BATCH), filling in each response
+
+void crud_client_log_stats(void);
+    // Log the syscalls and bytes the client transport has used
+
 int crud_server( void );
     // This is the implementation of the server application (crud_server.c)
 
@@ -36,5 +87,12 @@ int crud_server( void );
 extern int            crud_network_shutdown; // Flag indicating shutdown
 extern unsigned char *crud_network_address;  // Address of CRUD server 
 extern unsigned short crud_network_port;     // Port of CRUD server
+extern char          *crud_network_path;     // Unix domain socket of CRUD server, NULL for TCP
+extern char          *crud_network_shm;      // Shared memory region of CRUD server, NULL for sockets (see crud_shm.h)
+extern uint32_t       crud_network_connections; // Connections the client spreads requests over (client only)
+extern uint32_t       crud_pipeline_window;     // Tagged requests in flight per connection, 0 for lock-step (client only)
+extern uint32_t       crud_server_capabilities; // Extensions granted at CRUD_INIT
+extern uint64_t       crud_client_requests;     // Exchanges with the server, a batch counts once (updated atomically)
+extern CrudTransportStats crud_transport_stats; // Syscalls and bytes on the wire (client only, updated atomically)
 
 #endif
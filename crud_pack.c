@@ -0,0 +1,352 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_pack.c
+//  Description   : This is the implementation of the CRUD small-file packing
+//                  layer.  The containers are kept in an array in the order
+//                  they were added, new slices going in the first one with
+//                  room at its end.  Nothing is stored for the layer, the
+//                  containers are counted from the file table at mount.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 19:22:03 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_pack.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define CRUD_PACK_INITIAL_CONTAINERS 16 // Containers allocated at first, doubled as needed
+
+//
+// Global Data
+
+CrudPackStats crud_pack_stats; // The packing statistics
+
+// Module local data
+static uint32_t           pack_threshold = 0;       // Largest file packed (0 = off)
+static CrudPackContainer *pack_containers = NULL;   // The containers tracked
+static uint32_t           pack_count = 0;           // Containers in use
+static uint32_t           pack_slots = 0;           // Containers allocated
+static pthread_mutex_t    pack_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards everything above
+
+//
+// Module local functions
+
+static CrudPackContainer *pack_find(CrudOID container);
+static CrudPackContainer *pack_append(CrudOID container);
+static void pack_remove(CrudPackContainer *entry);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_set_threshold
+// Description  : Set the largest file packed into a container.  Files
+//                already packed stay packed until they grow past it.
+//
+// Inputs       : threshold - the largest file packed (0 turns packing off)
+// Outputs      : none
+
+void crud_pack_set_threshold(uint32_t threshold) {
+	if (threshold > CRUD_PACK_MAX_THRESHOLD) {
+		threshold = CRUD_PACK_MAX_THRESHOLD;
+	}
+	pthread_mutex_lock(&pack_mutex);
+	pack_threshold = threshold;
+	pthread_mutex_unlock(&pack_mutex);
+	logMessage(LOG_INFO_LEVEL, "CRUD packing threshold set to %u bytes.", threshold);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_get_threshold
+// Description  : Get the largest file packed into a container
+//
+// Inputs       : none
+// Outputs      : the threshold (0 if packing is off)
+
+uint32_t crud_pack_get_threshold(void) {
+	uint32_t threshold;
+
+	pthread_mutex_lock(&pack_mutex);
+	threshold = pack_threshold;
+	pthread_mutex_unlock(&pack_mutex);
+	return(threshold);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_slice_size
+// Description  : Work out the slice to hand out for a file, doubling from
+//                the smallest slice so a growing file moves only a few times
+//
+// Inputs       : length - the length of the file
+// Outputs      : the slice size
+
+uint32_t crud_pack_slice_size(uint32_t length) {
+	uint32_t size = CRUD_PACK_MIN_SLICE;
+
+	while (size < length) {
+		size *= 2;
+	}
+	return(size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_place
+// Description  : Hand out a slice from the first container with room for it
+//
+// Inputs       : size - the slice size
+//                container - set to the container holding the slice
+//                offset - set to where the slice starts in the container
+// Outputs      : 0 if placed, 1 if no container has room
+
+int crud_pack_place(uint32_t size, CrudOID *container, uint32_t *offset) {
+	uint32_t i;
+
+	pthread_mutex_lock(&pack_mutex);
+	for (i=0; i<pack_count; i++) {
+		if (CRUD_PACK_CONTAINER_SIZE - pack_containers[i].used >= size) {
+			*container = pack_containers[i].object_id;
+			*offset = pack_containers[i].used;
+			pack_containers[i].used += size;
+			pack_containers[i].live += size;
+			pack_containers[i].slices++;
+			crud_pack_stats.placed++;
+			pthread_mutex_unlock(&pack_mutex);
+			return(0);
+		}
+	}
+	pthread_mutex_unlock(&pack_mutex);
+	return(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_add
+// Description  : Start tracking a newly created (empty) container
+//
+// Inputs       : container - the container object
+// Outputs      : none
+
+void crud_pack_add(CrudOID container) {
+	pthread_mutex_lock(&pack_mutex);
+	if (pack_append(container) != NULL) {
+		crud_pack_stats.containers++;
+	}
+	pthread_mutex_unlock(&pack_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_free
+// Description  : Give a slice back.  Its space is dead until the container
+//                is repacked, or the container goes with its last slice.
+//
+// Inputs       : container - the container holding the slice
+//                size - the slice size
+// Outputs      : 1 if the container is now empty (the caller deletes it), 0 if not
+
+int crud_pack_free(CrudOID container, uint32_t size) {
+	CrudPackContainer *entry;
+	int empty = 0;
+
+	pthread_mutex_lock(&pack_mutex);
+	if ((entry = pack_find(container)) != NULL) {
+		entry->live -= (size < entry->live) ? size : entry->live;
+		if (entry->slices > 0) {
+			entry->slices--;
+		}
+		if (entry->slices == 0) {
+			pack_remove(entry);
+			empty = 1;
+		}
+	}
+	pthread_mutex_unlock(&pack_mutex);
+	return(empty);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_reference
+// Description  : Count a slice found in the file table, tracking its
+//                container if it is new to us
+//
+// Inputs       : container - the container holding the slice
+//                offset - where the slice starts
+//                size - the slice size
+// Outputs      : none
+
+void crud_pack_reference(CrudOID container, uint32_t offset, uint32_t size) {
+	CrudPackContainer *entry;
+
+	pthread_mutex_lock(&pack_mutex);
+	if (((entry = pack_find(container)) != NULL) || ((entry = pack_append(container)) != NULL)) {
+		if (offset + size > entry->used) {
+			entry->used = offset + size;
+		}
+		entry->live += size;
+		entry->slices++;
+	}
+	pthread_mutex_unlock(&pack_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_fragmented
+// Description  : List the containers worth repacking: those with at least
+//                half a container of dead space
+//
+// Inputs       : containers - filled in with the containers
+//                max - the most to list
+// Outputs      : the number listed
+
+uint32_t crud_pack_fragmented(CrudOID *containers, uint32_t max) {
+	uint32_t i, count = 0;
+
+	pthread_mutex_lock(&pack_mutex);
+	for (i=0; (i<pack_count) && (count<max); i++) {
+		if (pack_containers[i].used - pack_containers[i].live >= CRUD_PACK_CONTAINER_SIZE/2) {
+			containers[count++] = pack_containers[i].object_id;
+		}
+	}
+	pthread_mutex_unlock(&pack_mutex);
+	return(count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_drop
+// Description  : Forget a container whose slices have been repacked into
+//                others, counting the dead space reclaimed
+//
+// Inputs       : container - the container object
+// Outputs      : none
+
+void crud_pack_drop(CrudOID container) {
+	CrudPackContainer *entry;
+
+	pthread_mutex_lock(&pack_mutex);
+	if ((entry = pack_find(container)) != NULL) {
+		crud_pack_stats.repacked++;
+		crud_pack_stats.reclaimed += entry->used - entry->live;
+		pack_remove(entry);
+	}
+	pthread_mutex_unlock(&pack_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_reset
+// Description  : Forget every container (the array is kept for reuse)
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_pack_reset(void) {
+	pthread_mutex_lock(&pack_mutex);
+	pack_count = 0;
+	pthread_mutex_unlock(&pack_mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_pack_log_stats
+// Description  : Log the packing counters
+//
+// Inputs       : none
+// Outputs      : none
+
+void crud_pack_log_stats(void) {
+	CrudPackStats stats;
+	uint64_t slices = 0, live = 0, used = 0;
+	uint32_t i, count;
+
+	pthread_mutex_lock(&pack_mutex);
+	stats = crud_pack_stats;
+	count = pack_count;
+	for (i=0; i<pack_count; i++) {
+		slices += pack_containers[i].slices;
+		live += pack_containers[i].live;
+		used += pack_containers[i].used;
+	}
+	pthread_mutex_unlock(&pack_mutex);
+
+	logMessage(LOG_INFO_LEVEL, "CRUD pack : %llu files in %u containers (%llu of %llu bytes live), "
+			"%llu slices placed, %llu moved, %llu unpacked, %llu containers created, "
+			"%llu repacked (%llu bytes reclaimed)",
+			(unsigned long long)slices, count, (unsigned long long)live, (unsigned long long)used,
+			(unsigned long long)stats.placed, (unsigned long long)stats.moved,
+			(unsigned long long)stats.unpacked, (unsigned long long)stats.containers,
+			(unsigned long long)stats.repacked, (unsigned long long)stats.reclaimed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_find
+// Description  : Find a container being tracked (the caller holds pack_mutex)
+//
+// Inputs       : container - the container object
+// Outputs      : the entry, or NULL if not tracked
+
+static CrudPackContainer *pack_find(CrudOID container) {
+	uint32_t i;
+
+	for (i=0; i<pack_count; i++) {
+		if (pack_containers[i].object_id == container) {
+			return(&pack_containers[i]);
+		}
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_append
+// Description  : Add an empty entry for a container, growing the array as
+//                needed (the caller holds pack_mutex)
+//
+// Inputs       : container - the container object
+// Outputs      : the entry, or NULL if the array could not grow
+
+static CrudPackContainer *pack_append(CrudOID container) {
+	CrudPackContainer *grown;
+	uint32_t slots;
+
+	if (pack_count == pack_slots) {
+		slots = (pack_slots == 0) ? CRUD_PACK_INITIAL_CONTAINERS : pack_slots*2;
+		if ((grown = realloc(pack_containers, slots*sizeof(CrudPackContainer))) == NULL) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD pack : failed to grow to %u containers.", slots);
+			return(NULL);
+		}
+		pack_containers = grown;
+		pack_slots = slots;
+	}
+	memset(&pack_containers[pack_count], 0x0, sizeof(CrudPackContainer));
+	pack_containers[pack_count].object_id = container;
+	return(&pack_containers[pack_count++]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pack_remove
+// Description  : Stop tracking a container, keeping the rest in order (the
+//                caller holds pack_mutex)
+//
+// Inputs       : entry - the entry to remove
+// Outputs      : none
+
+static void pack_remove(CrudPackContainer *entry) {
+	uint32_t i = entry - pack_containers;
+
+	memmove(entry, entry+1, (pack_count-i-1)*sizeof(CrudPackContainer));
+	pack_count--;
+}
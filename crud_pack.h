@@ -0,0 +1,96 @@
+#ifndef CRUD_PACK_INCLUDED
+#define CRUD_PACK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_pack.h
+//  Description   : This is the small-file packing layer for the CRUD file
+//                  interface.  Files no larger than the packing threshold
+//                  are stored as slices of shared container objects rather
+//                  than in extent objects of their own.  Slices are handed
+//                  out from the front of a container and never reused in
+//                  place; a container is deleted when its last slice goes,
+//                  and one that is mostly dead space is repacked (its live
+//                  slices copied into new containers) at checkpoint.  The
+//                  layer only keeps the container accounting, the file
+//                  table records where each file's slice is.  It may be
+//                  used from several threads at once.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 19:22:03 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_PACK_CONTAINER_SIZE 0x10000 // Size of every container object
+#define CRUD_PACK_MIN_SLICE 64           // Smallest slice handed out
+#define CRUD_PACK_MAX_THRESHOLD (CRUD_PACK_CONTAINER_SIZE/4) // Largest file that may be packed
+#define CRUD_PACK_REPACK_MAX 16          // Containers repacked at one checkpoint
+
+// Type definitions
+
+// This is a container the layer is tracking
+typedef struct {
+	CrudOID  object_id; // The container object
+	uint32_t used;      // Bytes handed out (from the front)
+	uint32_t live;      // Bytes in slices still in use
+	uint32_t slices;    // Slices still in use
+} CrudPackContainer;
+
+// These are the packing statistics
+typedef struct {
+	uint64_t placed;     // Slices handed out
+	uint64_t moved;      // Files moved to a larger slice as they grew (updated atomically)
+	uint64_t unpacked;   // Files grown past the threshold into extents (updated atomically)
+	uint64_t containers; // Containers created
+	uint64_t repacked;   // Containers repacked
+	uint64_t reclaimed;  // Dead bytes reclaimed by repacking
+} CrudPackStats;
+
+//
+// Functional Prototypes
+
+void crud_pack_set_threshold(uint32_t threshold);
+	// Pack files of at most threshold bytes (0 = packing off)
+
+uint32_t crud_pack_get_threshold(void);
+	// Get the packing threshold
+
+uint32_t crud_pack_slice_size(uint32_t length);
+	// Work out the slice to hand out for a file of length bytes
+
+int crud_pack_place(uint32_t size, CrudOID *container, uint32_t *offset);
+	// Find room for a slice, 0 if placed, 1 if a new container is needed
+
+void crud_pack_add(CrudOID container);
+	// Start tracking a new (empty) container
+
+int crud_pack_free(CrudOID container, uint32_t size);
+	// Give a slice back, returns 1 if the container is now empty (and forgotten)
+
+void crud_pack_reference(CrudOID container, uint32_t offset, uint32_t size);
+	// Count a slice found in the file table (while mounting or repacking)
+
+uint32_t crud_pack_fragmented(CrudOID *containers, uint32_t max);
+	// List the containers worth repacking, returns how many
+
+void crud_pack_drop(CrudOID container);
+	// Forget a container once its slices have been repacked elsewhere
+
+void crud_pack_reset(void);
+	// Forget every container
+
+void crud_pack_log_stats(void);
+	// Log the packing counters
+
+//
+// Pack Global Data
+
+extern CrudPackStats crud_pack_stats; // The packing statistics
+
+#endif
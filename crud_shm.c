@@ -0,0 +1,492 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_shm.c
+//  Description   : This is the implementation of the CRUD shared memory
+//                  transport.  Each ring has one producer and one consumer,
+//                  so an entry is published by filling it and then moving
+//                  head (release), and taken by reading it and then moving
+//                  tail (release), with no lock.  The consumer polls for a
+//                  while before sleeping on the ring's semaphore, which
+//                  only costs a syscall when someone is actually asleep.
+//                  A client's claim is recorded as its pid, so a region left
+//                  claimed by a client that died can be taken over, and the
+//                  server empties the rings (the only time they are reset)
+//                  while the new client waits on a flag rather than on them.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 11:40:12 EDT 2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Project Include Files
+#include <crud_shm.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_SHM_UNIT_TEST_ROUNDS 64
+#define CRUD_SHM_UNIT_TEST_SIZE 0x10000
+
+//
+// Functional Prototypes
+static void *shm_unit_test_echo(void *arg);
+static int shm_unit_test_claims(CrudShmRegion *region, const char *name);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_create
+// Description  : Create (or replace) the named region with empty rings
+//
+// Inputs       : name - the name of the region (e.g., "/crud")
+// Outputs      : the mapped region, or NULL if failure
+
+CrudShmRegion *crud_shm_create(const char *name) {
+	CrudShmRegion *region;
+	int fd;
+
+	// Start from a fresh object, one left behind by an earlier run is dropped
+	shm_unlink(name);
+	if ((fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : create of [%s] failed [%s].", name, strerror(errno));
+		return(NULL);
+	}
+	if (ftruncate(fd, sizeof(CrudShmRegion)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : sizing [%s] failed [%s].", name, strerror(errno));
+		close(fd);
+		shm_unlink(name);
+		return(NULL);
+	}
+	region = mmap(NULL, sizeof(CrudShmRegion), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : mapping [%s] failed [%s].", name, strerror(errno));
+		shm_unlink(name);
+		return(NULL);
+	}
+
+	// Set up the rings (the new object is all zeros), then mark it ready
+	if ((sem_init(&region->requests.ready, 1, 0) == -1) || (sem_init(&region->responses.ready, 1, 0) == -1)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : semaphore setup failed [%s].", strerror(errno));
+		munmap(region, sizeof(CrudShmRegion));
+		shm_unlink(name);
+		return(NULL);
+	}
+	__atomic_store_n(&region->magic, CRUD_SHM_MAGIC, __ATOMIC_RELEASE);
+	return(region);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_destroy
+// Description  : Unmap the region and remove its name (a client still mapped
+//                keeps its mapping until it lets go)
+//
+// Inputs       : region - the region
+//                name - the name it was created with
+// Outputs      : none
+
+void crud_shm_destroy(CrudShmRegion *region, const char *name) {
+	if (region != NULL) {
+		munmap(region, sizeof(CrudShmRegion));
+	}
+	shm_unlink(name);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_reset
+// Description  : Empty both rings and set up their semaphores again for a
+//                new claim.  Only the server calls this, between requests,
+//                and the claiming client waits on the reset flag, so no one
+//                is waiting on the semaphores.
+//
+// Inputs       : region - the region
+// Outputs      : none
+
+void crud_shm_reset(CrudShmRegion *region) {
+	CrudShmRing *rings[2] = { &region->requests, &region->responses };
+	int i;
+
+	for (i=0; i<2; i++) {
+		sem_destroy(&rings[i]->ready);
+		rings[i]->head = 0;
+		rings[i]->tail = 0;
+		sem_init(&rings[i]->ready, 1, 0);
+	}
+	__atomic_store_n(&region->reset, 0, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_attach
+// Description  : Map the named region and claim it for this process, taking
+//                it over if the client holding it has exited, then wait for
+//                the server to empty the rings
+//
+// Inputs       : name - the name of the region
+// Outputs      : the mapped region, or NULL if failure (not there, not
+//                ready, another client has it, or the server did not answer)
+
+CrudShmRegion *crud_shm_attach(const char *name) {
+	CrudShmRegion *region;
+	pid_t owner;
+	uint32_t waited;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDWR, 0)) == -1) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : open of [%s] failed [%s].", name, strerror(errno));
+		return(NULL);
+	}
+	region = mmap(NULL, sizeof(CrudShmRegion), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (region == MAP_FAILED) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : mapping [%s] failed [%s].", name, strerror(errno));
+		return(NULL);
+	}
+	if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != CRUD_SHM_MAGIC) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : region [%s] is not ready.", name);
+		munmap(region, sizeof(CrudShmRegion));
+		return(NULL);
+	}
+
+	// Claim it if no one has, or the one who did is gone
+	owner = __atomic_load_n(&region->owner, __ATOMIC_ACQUIRE);
+	if (((owner != 0) && ((kill(owner, 0) == 0) || (errno != ESRCH))) ||
+			!__atomic_compare_exchange_n(&region->owner, &owner, getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD shm : region [%s] is in use by another client.", name);
+		munmap(region, sizeof(CrudShmRegion));
+		return(NULL);
+	}
+	if (owner != 0) {
+		logMessage(LOG_WARNING_LEVEL, "CRUD shm : took over region [%s] from exited client %d.", name, (int)owner);
+	}
+
+	// Have the server empty the rings (waking it if it sleeps on them) before using them
+	__atomic_store_n(&region->reset, 1, __ATOMIC_RELEASE);
+	sem_post(&region->requests.ready);
+	for (waited=0; __atomic_load_n(&region->reset, __ATOMIC_ACQUIRE); waited+=CRUD_SHM_CLAIM_POLL) {
+		if (waited >= CRUD_SHM_TIMEOUT*1000000) {
+			logMessage(LOG_ERROR_LEVEL, "CRUD shm : server did not reset region [%s].", name);
+			crud_shm_detach(region);
+			return(NULL);
+		}
+		usleep(CRUD_SHM_CLAIM_POLL);
+	}
+	return(region);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_detach
+// Description  : Give up the claim on the region and unmap it
+//
+// Inputs       : region - the region
+// Outputs      : none
+
+void crud_shm_detach(CrudShmRegion *region) {
+	pid_t owner = getpid();
+
+	if (region != NULL) {
+		__atomic_compare_exchange_n(&region->owner, &owner, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		munmap(region, sizeof(CrudShmRegion));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_push
+// Description  : Add an entry to a ring, waking the consumer if it sleeps
+//
+// Inputs       : ring - the ring (this side is its producer)
+//                entry - the entry to add
+// Outputs      : 0 if successful, -1 if the ring is full
+
+int crud_shm_push(CrudShmRing *ring, CrudShmEntry *entry) {
+	uint32_t head = ring->head;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= CRUD_SHM_RING_SLOTS) {
+		return(-1);
+	}
+	ring->entries[head & (CRUD_SHM_RING_SLOTS - 1)] = *entry;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	sem_post(&ring->ready);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_pop
+// Description  : Take the next entry from a ring, polling for it first and
+//                then sleeping until it is published
+//
+// Inputs       : ring - the ring (this side is its consumer)
+//                entry - set to the entry taken
+//                timeout - seconds to wait (0 waits forever)
+// Outputs      : 0 if successful, -1 if none came in time
+
+int crud_shm_pop(CrudShmRing *ring, CrudShmEntry *entry, uint32_t timeout) {
+	struct timespec until;
+	uint32_t spin, tail = ring->tail;
+	int ret = -1;
+
+	// The semaphore counts published entries, one is ours once it is taken
+	for (spin=0; (spin<CRUD_SHM_SPIN) && (ret != 0); spin++) {
+		ret = sem_trywait(&ring->ready);
+	}
+	if (ret != 0) {
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += timeout;
+		do {
+			ret = (timeout == 0) ? sem_wait(&ring->ready) : sem_timedwait(&ring->ready, &until);
+		} while ((ret == -1) && (errno == EINTR));
+		if (ret == -1) {
+			return(-1);
+		}
+	}
+
+	// Take the entry, then hand the slot back to the producer (the head moves
+	// before the post, so an empty ring means this was only a wake-up)
+	if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+		return(-1);
+	}
+	*entry = ring->entries[tail & (CRUD_SHM_RING_SLOTS - 1)];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_shm_span
+// Description  : Work out the arena bytes a request needs, its payload going
+//                out or room for the bytes coming back (cache line aligned)
+//
+// Inputs       : request - the request
+// Outputs      : the number of bytes
+
+uint32_t crud_shm_span(CrudRequest request) {
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+
+	deconstruct_crud_request(request, &oid, &req, &length, &flags, &res);
+	if ((req != CRUD_CREATE) && (req != CRUD_READ) && (req != CRUD_UPDATE) &&
+			(req != CRUD_READ_RANGE) && (req != CRUD_WRITE_RANGE)) {
+		return(0);
+	}
+	return((length + CRUD_SHM_ALIGN - 1) & ~(CRUD_SHM_ALIGN - 1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crudShmUnitTest
+// Description  : Pass rounds of requests through a region to an echo thread
+//                standing in for the server.  Each round fills up to a ring
+//                of writes and reads, the thread checks the bytes of each
+//                write in place and fills in the bytes of each read, and the
+//                responses must come back in order.  Then check the claims
+//                made on the region.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crudShmUnitTest(void) {
+	CrudShmRegion *region;
+	CrudShmEntry entry;
+	CrudRequest request;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint8_t flags, res;
+	pthread_t echo;
+	uint32_t round, count, i, j, length, used, sent = 0;
+	char name[64];
+	int failed = 0;
+
+	// Make a region of our own, and a thread to answer on it
+	snprintf(name, sizeof(name), "/crud_shm_unit_test.%d", (int)getpid());
+	if ((region = crud_shm_create(name)) == NULL) {
+		return(-1);
+	}
+	if (pthread_create(&echo, NULL, shm_unit_test_echo, region) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : failed to start echo thread.");
+		crud_shm_destroy(region, name);
+		return(-1);
+	}
+
+	// Send rounds of requests (odd ones read), each filled with bytes the echo can check
+	for (round=0; (round<CRUD_SHM_UNIT_TEST_ROUNDS) && !failed; round++) {
+		count = getRandomValue(1, CRUD_SHM_RING_SLOTS);
+		for (i=0, used=0; i<count; i++) {
+			length = getRandomValue(0, CRUD_SHM_UNIT_TEST_SIZE);
+			request = construct_crud_request(sent + i, (i % 2) ? CRUD_READ : CRUD_UPDATE, length, 0, 0);
+			entry.request = request;
+			entry.offset = 0;
+			entry.data = used;
+			for (j=0; (i % 2 == 0) && (j<length); j++) {
+				region->arena[used + j] = (uint8_t)(sent + i + j);
+			}
+			used += crud_shm_span(request);
+			if (crud_shm_push(&region->requests, &entry)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : ring full at %u of %u entries.", i, count);
+				failed = 1;
+				break;
+			}
+		}
+
+		// The responses come back in order, reads with the bytes the echo wrote
+		for (i=0, used=0; (i<count) && !failed; i++) {
+			if (crud_shm_pop(&region->responses, &entry, CRUD_SHM_TIMEOUT)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : no response %u of round %u.", i, round);
+				failed = 1;
+				break;
+			}
+			deconstruct_crud_request(entry.request, &oid, &req, &length, &flags, &res);
+			if ((oid != sent + i) || (req != ((i % 2) ? CRUD_READ : CRUD_UPDATE)) || res || (entry.data != used)) {
+				logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : bad response %u of round %u.", i, round);
+				failed = 1;
+				break;
+			}
+			for (j=0; (i % 2) && (j<length); j++) {
+				if (region->arena[used + j] != (uint8_t)~(sent + i + j)) {
+					logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : bad read bytes, round %u.", round);
+					failed = 1;
+					break;
+				}
+			}
+			used += crud_shm_span(entry.request);
+		}
+		sent += count;
+	}
+	if (!failed && shm_unit_test_claims(region, name)) {
+		failed = 1;
+	}
+
+	// Stop the echo, then cleanup
+	entry.request = construct_crud_request(0, CRUD_CLOSE, 0, 0, 0);
+	crud_shm_push(&region->requests, &entry);
+	pthread_join(echo, NULL);
+	crud_shm_destroy(region, name);
+	if (failed) {
+		return(-1);
+	}
+
+	// Return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_SHM_UNIT_TEST : %u requests through the rings successful.", sent);
+	return(0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_unit_test_echo
+// Description  : Answer requests on a region until a CRUD_CLOSE, checking
+//                the bytes of an update and writing the bytes of a read
+//                (a bad update fails its response), and empty the rings for
+//                each claim as the server does
+//
+// Inputs       : arg - the region
+// Outputs      : NULL
+
+static void *shm_unit_test_echo(void *arg) {
+	CrudShmRegion *region = arg;
+	CrudShmEntry entry;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, j;
+	uint8_t flags, res;
+
+	while (1) {
+		if (__atomic_load_n(&region->reset, __ATOMIC_ACQUIRE)) {
+			crud_shm_reset(region);
+		}
+		if (crud_shm_pop(&region->requests, &entry, 0)) {
+			continue;
+		}
+		deconstruct_crud_request(entry.request, &oid, &req, &length, &flags, &res);
+		if (req == CRUD_CLOSE) {
+			break;
+		}
+		for (j=0; j<length; j++) {
+			if (req == CRUD_READ) {
+				region->arena[entry.data + j] = (uint8_t)~(oid + j);
+			} else if (region->arena[entry.data + j] != (uint8_t)(oid + j)) {
+				res = 1;
+			}
+		}
+		entry.request = construct_crud_request(oid, req, length, flags, res);
+		crud_shm_push(&region->responses, &entry);
+	}
+	return(NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shm_unit_test_claims
+// Description  : Check that a claim empties the rings, that a region held by
+//                a live process cannot be claimed, and that one held by a
+//                process that exited is taken over
+//
+// Inputs       : region - the region (served by the echo thread)
+//                name - its name
+// Outputs      : 0 if successful, -1 if failure
+
+static int shm_unit_test_claims(CrudShmRegion *region, const char *name) {
+	CrudShmRegion *mine, *again;
+	CrudShmEntry entry;
+	pid_t child;
+
+	// A response left by an earlier client must be gone once the region is claimed
+	entry.request = construct_crud_request(1, CRUD_READ, 0, 0, 0);
+	entry.offset = entry.data = 0;
+	crud_shm_push(&region->responses, &entry);
+	if (((mine = crud_shm_attach(name)) == NULL) || (region->owner != getpid()) ||
+			(region->responses.head != region->responses.tail)) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : claim did not empty the rings.");
+		crud_shm_detach(mine);
+		return(-1);
+	}
+
+	// No second claim while this process holds it, but one once it lets go
+	if ((again = crud_shm_attach(name)) != NULL) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : region claimed twice.");
+		crud_shm_detach(again);
+		crud_shm_detach(mine);
+		return(-1);
+	}
+	crud_shm_detach(mine);
+	if (region->owner != 0) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : claim not released.");
+		return(-1);
+	}
+
+	// The claim of a process that exited is taken over
+	if ((child = fork()) == 0) {
+		_exit(0);
+	}
+	waitpid(child, NULL, 0);
+	region->owner = child;
+	if (((mine = crud_shm_attach(name)) == NULL) || (region->owner != getpid())) {
+		logMessage(LOG_ERROR_LEVEL, "CRUD_SHM_UNIT_TEST : exited client's claim not taken over.");
+		crud_shm_detach(mine);
+		return(-1);
+	}
+	crud_shm_detach(mine);
+
+	// Log, return successfully
+	logMessage(LOG_INFO_LEVEL, "CRUD_SHM_UNIT_TEST : region claims successful.");
+	return(0);
+}
@@ -0,0 +1,109 @@
+#ifndef CRUD_SHM_INCLUDED
+#define CRUD_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_shm.h
+//  Description   : This is the shared memory transport for a CRUD server on
+//                  the same host.  The server creates a named region holding
+//                  two single-producer/single-consumer rings of request
+//                  headers (client to server, and server to client) and an
+//                  arena the payloads pass through.  The client copies the
+//                  bytes of a request into the arena and the server copies
+//                  them into its store (and the bytes of a reply the other
+//                  way), one memory copy on each side with no socket or
+//                  syscall in between.  A region serves one client process
+//                  at a time.  Each claim of it has the server empty the
+//                  rings first, so nothing a previous client left behind
+//                  (it may have exited without letting go, or given up
+//                  waiting on a response) reaches the new one.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 11:40:12 EDT 2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+// Project Include Files
+#include <crud_driver.h>
+
+// Defines
+#define CRUD_SHM_MAGIC 0x43525544       // Set once the server has the region ready ("CRUD")
+#define CRUD_SHM_RING_SLOTS 256         // Entries in each ring (a power of two)
+#define CRUD_SHM_ARENA_SIZE 0x1000000   // Payload bytes, more than any one request can carry
+#define CRUD_SHM_ALIGN 64               // Payloads start on a cache line
+#define CRUD_SHM_SPIN 4096              // Polls of an empty ring before sleeping on it
+#define CRUD_SHM_TIMEOUT 30             // Seconds the client waits for a response (or a claim)
+#define CRUD_SHM_CLAIM_POLL 100         // Microseconds between checks that the rings are emptied for a claim
+
+// Type definitions
+
+// This is one entry of a ring, a request going to the server or its
+// response coming back (the response keeps the request's arena bytes)
+typedef struct {
+	CrudRequest request; // The request or response (host byte order)
+	uint32_t    offset;  // The offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+	uint32_t    data;    // Where the request's bytes (or room for the reply's) start in the arena
+} CrudShmEntry;
+
+// This is a ring, the producer only moves head and the consumer only moves
+// tail (each on its own cache line), the semaphore wakes a sleeping consumer
+typedef struct {
+	uint32_t     head;      // Next entry to fill
+	uint8_t      head_pad[CRUD_SHM_ALIGN - sizeof(uint32_t)];
+	uint32_t     tail;      // Next entry to take
+	uint8_t      tail_pad[CRUD_SHM_ALIGN - sizeof(uint32_t)];
+	sem_t        ready;     // Posted for every entry filled
+	CrudShmEntry entries[CRUD_SHM_RING_SLOTS]; // The entries
+} CrudShmRing;
+
+// This is the shared region.  A client claims it by setting owner to its
+// pid (taking it over if that process is gone), then sets reset and waits
+// for the server to empty the rings and clear it.
+typedef struct {
+	uint32_t    magic;     // CRUD_SHM_MAGIC once ready
+	pid_t       owner;     // The client using the region (0 if none)
+	uint32_t    reset;     // Flag asking the server to empty the rings for a new claim
+	CrudShmRing requests;  // Client to server
+	CrudShmRing responses; // Server to client
+	uint8_t     arena[CRUD_SHM_ARENA_SIZE] __attribute__((aligned(CRUD_SHM_ALIGN))); // The payloads
+} CrudShmRegion;
+
+//
+// Functional Prototypes
+
+CrudShmRegion *crud_shm_create(const char *name);
+	// Create (or replace) the named region with empty rings (server side)
+
+void crud_shm_destroy(CrudShmRegion *region, const char *name);
+	// Unmap the region and remove its name (server side)
+
+void crud_shm_reset(CrudShmRegion *region);
+	// Empty the rings for a new claim (server side, when not waiting on them)
+
+CrudShmRegion *crud_shm_attach(const char *name);
+	// Map the named region and claim it for this process (client side)
+
+void crud_shm_detach(CrudShmRegion *region);
+	// Give up the claim on the region and unmap it (client side)
+
+int crud_shm_push(CrudShmRing *ring, CrudShmEntry *entry);
+	// Add an entry to a ring (producer only), 0 if successful, -1 if full
+
+int crud_shm_pop(CrudShmRing *ring, CrudShmEntry *entry, uint32_t timeout);
+	// Take the next entry (consumer only), waiting up to timeout seconds
+	// (0 = forever), 0 if successful, -1 if none came (or only a wake-up)
+
+uint32_t crud_shm_span(CrudRequest request);
+	// The arena bytes a request needs (its payload, or room for the reply)
+
+//
+// Unit testing for the module
+
+int crudShmUnitTest(void);
+	// Pass requests and payloads through a region to an echo thread
+
+#endif
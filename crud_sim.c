@@ -25,23 +25,41 @@
 #include <crud_driver.h>
 #include <crud_network.h>
 #include <crud_file_io.h>
+#include <crud_cache.h>
+#include <crud_buffer.h>
+#include <crud_async.h>
+#include <crud_dedup.h>
+#include <crud_compress.h>
+#include <crud_pack.h>
+#include <crud_shm.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define CRUD_SIM_MAX_OPEN_FILES 128
-#define CRUD_ARGUMENTS "hvul:x:a:p:"
+#define CRUD_ARGUMENTS "hvul:c:w:dz:s:i:k:x:a:p:U:m:n:q:"
 #define USAGE \
-	"USAGE: crud [-h] [-v] [-l <logfile>] [-c <sz>] [-x <file>] [-a <ip addr>] [-p <port>] <workload-file>\n" \
+	"USAGE: crud [-h] [-v] [-l <logfile>] [-c <sz>] [-w <bytes>] [-d] [-z <bytes>] [-s <bytes>] [-i <bytes>] [-k <ops>] [-x <file>] [-a <ip addr>] [-p <port>] [-U <socket>] [-m <region>] [-n <conns>] [-q <depth>] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -u - run the unit tests instead of the simulator\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -c - size the client object cache to <sz> lines (0 disables)\n" \
+	"    -w - buffer writes, flushing once <bytes> are held (write-back mode)\n" \
+	"    -d - share one object between extents with identical contents (dedup)\n" \
+	"    -z - compress payloads of at least <bytes> on the wire (0 disables)\n" \
+	"    -s - pack files of at most <bytes> into shared container objects (0 disables)\n" \
+	"    -i - hold files of at most <bytes> inline in the file table (0 disables)\n" \
+	"    -k - checkpoint the file table every <ops> file operations\n" \
 	"    -x - extract a file <file> from the crud filesystem\n" \
 	"    -a - IP address of server to connect to.\n" \
 	"    -p - port number of server to connect to.\n" \
+	"    -U - unix domain socket of a server on this host to connect to (instead of -a/-p).\n" \
+	"    -m - shared memory region of a server on this host to use (instead of sockets).\n" \
+	"    -n - spread requests over <conns> connections to the server\n" \
+	"    -q - keep up to <depth> tagged requests in flight on each connection (0 = lock-step)\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -49,12 +67,13 @@
 // This is the file table
 typedef struct {
 	char     *filename;  // This is the filename for the test file
-	int16_t   fhandle;   // This is a file handle for the opened file
+	int32_t   fhandle;   // This is a file handle for the opened file
 } CrudSimulationTable;
 
 //
 // Global Data
 int verbose;
+uint32_t checkpoint_interval = 0; // File operations between checkpoints (0 = never)
 
 //
 // Functional Prototypes
@@ -76,8 +95,11 @@ int extract_file_from_crud(char *ex_file);
 
 int main( int argc, char *argv[] ) {
 	// Local variables
-	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0;
-	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
+	int ch, verbose = 0, unit_tests = 0, log_initialized = 0, extract_file = 0, dedup = 0;
+	uint32_t cache_size = CRUD_CACHE_DEFAULT_LINES; // Defaults to 1024 cache lines
+	uint32_t write_back = 0; // Defaults to writing through
+	uint32_t pack_threshold = 0; // Defaults to an object per extent
+	uint32_t inline_threshold = 0; // Defaults to no files held in the table
 	char *ex_file = NULL;
 
 	// Process the command line parameters
@@ -113,6 +135,45 @@ int main( int argc, char *argv[] ) {
 			}
 			break;
 
+		case 'w': // Set the write-back budget
+			if ( sscanf( optarg, "%u", &write_back ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  write-back budget [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'd': // Deduplicate identical extents
+			dedup = 1;
+			break;
+
+		case 'z': // Set the compression threshold
+			if ( sscanf( optarg, "%u", &crud_compress_threshold ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  compression threshold [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 's': // Set the packing threshold
+			if ( sscanf( optarg, "%u", &pack_threshold ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  packing threshold [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'i': // Set the inline threshold
+			if ( sscanf( optarg, "%u", &inline_threshold ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  inline threshold [%s]", optarg );
+                return(-1);
+			}
+			break;
+
+		case 'k': // Set the checkpoint interval
+			if ( sscanf( optarg, "%u", &checkpoint_interval ) != 1 ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  checkpoint interval [%s]", optarg );
+                return(-1);
+			}
+			break;
+
         case 'a': // Get the IP address
             if (inet_addr(optarg) == INADDR_NONE) {
 			    logMessage( LOG_ERROR_LEVEL, "Bad  cache size [%s]", argv[optind] );
@@ -128,6 +189,30 @@ int main( int argc, char *argv[] ) {
 			}
             break;
 
+		case 'U': // Set the unix domain socket path
+			crud_network_path = strdup( optarg );
+			break;
+
+		case 'm': // Set the shared memory region name
+			crud_network_shm = strdup( optarg );
+			break;
+
+		case 'n': // Set the number of connections
+			if ( (sscanf( optarg, "%u", &crud_network_connections ) != 1) ||
+					(crud_network_connections == 0) || (crud_network_connections > CRUD_MAX_CONNECTIONS) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  connection count [%s] (1 to %d)", optarg, CRUD_MAX_CONNECTIONS );
+                return(-1);
+			}
+			break;
+
+		case 'q': // Set the pipeline depth
+			if ( (sscanf( optarg, "%u", &crud_pipeline_window ) != 1) ||
+					(crud_pipeline_window > CRUD_PIPELINE_MAX_WINDOW) ) {
+			    logMessage( LOG_ERROR_LEVEL, "Bad  pipeline depth [%s] (0 to %d)", optarg, CRUD_PIPELINE_MAX_WINDOW );
+                return(-1);
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -141,13 +226,20 @@ int main( int argc, char *argv[] ) {
 	if ( verbose ) {
 		enableLogLevels( LOG_INFO_LEVEL );
 	}
+	crud_cache_init( cache_size );
+	crud_set_write_back( write_back );
+	crud_dedup_enable( dedup );
+	crud_pack_set_threshold( pack_threshold );
+	if ( crud_set_inline( inline_threshold ) ) {
+		return( -1 );
+	}
 
 	// If we are running the unit tests, do that
 	if ( unit_tests ) {
 
 		// Enable verbose, run the tests and check the results
 		enableLogLevels( LOG_INFO_LEVEL );
-		if ( b64UnitTest() || crudIOUnitTest() ) {
+		if ( b64UnitTest() || crudCompressUnitTest() || crudShmUnitTest() || crudIOUnitTest() || crudAsyncUnitTest() ) {
 			logMessage( LOG_ERROR_LEVEL, "CRUD unit tests failed.\n\n" );
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD unit tests completed successfully.\n\n" );
@@ -179,6 +271,15 @@ int main( int argc, char *argv[] ) {
 		} else {
 			logMessage( LOG_INFO_LEVEL, "CRUD simulation failed.\n\n" );
 		}
+		crud_cache_log_stats();
+		crud_write_back_log_stats();
+		crud_read_log_stats();
+		crud_dedup_log_stats();
+		crud_compress_log_stats();
+		crud_pack_log_stats();
+		crud_inline_log_stats();
+		crud_buffer_log_stats();
+		crud_client_log_stats();
 	}
 
 	// Return successfully
@@ -200,6 +301,7 @@ int simulate_CRUD( char *wload ) {
 	char line[2048], fname[128], command[128], text[2048], *sep, *rbuf;
 	FILE *fhandle = NULL;
 	int32_t err=0, len, off, fields, linecount;
+	uint32_t fileops = 0;
 	CrudSimulationTable ftable[CRUD_SIM_MAX_OPEN_FILES];
 	int idx, i;
 
@@ -296,26 +398,19 @@ int simulate_CRUD( char *wload ) {
 				//
 				// File operations
 
-				// Now walk the the table looking for the file
-				idx = -1;
-				i = 0;
-				while ( (i < CRUD_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-					if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-						idx = i;
-					}
-					i++;
+				// Now find the file in the table (probing from the filename hash)
+				idx = stringHash(fname) % CRUD_SIM_MAX_OPEN_FILES;
+				for (i=0; (i<CRUD_SIM_MAX_OPEN_FILES) && (ftable[idx].filename != NULL) &&
+						(strcmp(ftable[idx].filename,fname) != 0); i++) {
+					idx = (idx+1) % CRUD_SIM_MAX_OPEN_FILES;
 				}
+				CMPSC_ASSERT1(i<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", i);
 
 				// File is not found, open the file
-				if (idx == -1) {
+				if (ftable[idx].filename == NULL) {
 
-					// Log message, find unused index and save filename for later use
+					// Log message, save filename for later use
 					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Opening file [%s]", fname);
-					idx = 0;
-					while ((ftable[idx].filename != NULL) && (idx < CRUD_SIM_MAX_OPEN_FILES)) {
-						idx++;
-					}
-					CMPSC_ASSERT1(idx<CRUD_SIM_MAX_OPEN_FILES, "Too many open files on CRUD sim [%d]", idx);
 					ftable[idx].filename = strdup(fname);
 
 					// Now perform the open
@@ -400,13 +495,13 @@ int simulate_CRUD( char *wload ) {
 					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Reading %d bytes from file [%s]", len, fname);
 
 					// Now perform the read
-					rbuf = malloc(len);
+					rbuf = crud_buffer_alloc(len);
 					if (crud_read(ftable[idx].fhandle, rbuf, len) != len) {
 						// Failed, error out
 						logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
 						return(-1);
 					}
-					free(rbuf);
+					crud_buffer_free(rbuf);
 					rbuf = NULL;
 
 				} else {
@@ -415,6 +510,17 @@ int simulate_CRUD( char *wload ) {
 					CMPSC_ASSERT1(0, "CRUD_SIM : Failed, unknown command [%s]", command);
 
 				}
+
+				// Periodically save the file table
+				fileops ++;
+				if ( (checkpoint_interval > 0) && ((fileops % checkpoint_interval) == 0) ) {
+					logMessage(LOG_INFO_LEVEL, "CRUD_SIM : Checkpointing CRUD filesystem");
+					if (crud_checkpoint()) {
+						// Failed, error out
+						logMessage(LOG_ERROR_LEVEL, "Checkpoint failed, aborting simulation.");
+						return(-1);
+					}
+				}
 			}
 
 			// Check for the virtual level failing
@@ -442,17 +548,18 @@ int simulate_CRUD( char *wload ) {
 int extract_file_from_crud(char *ex_file) {
 
 	// Local variables
-	int16_t fd;
+	int32_t fd;
 	int32_t len;
-	char buf[CRUD_MAX_OBJECT_SIZE];
+	char *buf = malloc(CRUD_MAX_FILE_SIZE);
     int fhandle, flags;
     mode_t mode;
 	// Open the file, read from it, close it
 	if ( (crud_mount()) || ((fd = crud_open(ex_file)) == -1) ||
-		 ((len = crud_read(fd, buf, CRUD_MAX_OBJECT_SIZE)) == -1) ||
+		 ((len = crud_read(fd, buf, CRUD_MAX_FILE_SIZE)) == -1) ||
 		 (crud_close(fd) == -1)	) {
 		// Error out
 		logMessage(LOG_INFO_LEVEL, "CRUD : extraction failed on crud interface [%s].", ex_file);
+		free(buf);
 		return(-1);
 	}
 
@@ -462,15 +569,18 @@ int extract_file_from_crud(char *ex_file) {
     fhandle = open(ex_file, flags, mode);
     if ( fhandle == -1 ) {
         fprintf( stderr, "CRUD: extraction open() failed, error=%s\n", strerror(errno) );
+        free( buf );
         return( -1 );
     }
 
     // Now write the read bytes to the file, then close
     if (write(fhandle, buf, len) != len) {
         fprintf( stderr, "CRUD: extraction write() failed, error=%s\n", strerror(errno) );
+        free( buf );
         return( -1 );
     }
     close( fhandle );
+    free( buf );
 
     // Return successfully
 	return( 0 );
@@ -0,0 +1,1074 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : crud_standin.c
+//  Description   : This is a stand-in for the CRUD server.  It speaks the
+//                  same wire protocol as the reference server (crud_server)
+//                  and keeps the object store in memory, saving it to disk
+//                  on CRUD_CLOSE.  It exists so the client extensions to the
+//                  protocol have a server side that can be built and tested
+//                  in-tree.
+//
+//  Author        : Patrick McDaniel
+//  Last Modified : Fri Oct 16 09:12:44 EDT 2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+// Project Include Files
+#include <crud_driver.h>
+#include <crud_network.h>
+#include <crud_compress.h>
+#include <crud_shm.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Defines
+#define CRUD_STANDIN_ARGUMENTS "hvl:p:U:m:s:"
+#define CRUD_STANDIN_STORE "crud_standin.crd"
+#define CRUD_STANDIN_INITIAL_OBJECTS 1024
+#define CRUD_STANDIN_CAPABILITIES (CRUD_CAP_READ_RANGE|CRUD_CAP_BATCH|CRUD_CAP_COMPRESS|CRUD_CAP_WRITE_RANGE|\
+		CRUD_CAP_PIPELINE)
+#define CRUD_STANDIN_REPLY_HEAD (sizeof(CrudResponse) + CRUD_TAG_SIZE) // Room left ahead of reply bytes
+#define USAGE \
+	"USAGE: crud_standin [-h] [-v] [-l <logfile>] [-p <port>] [-U <socket>] [-m <region>] [-s <store>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -p - port number to listen on.\n" \
+	"    -U - unix domain socket to listen on as well, for clients on this host.\n" \
+	"    -m - shared memory region to serve as well, for a client on this host.\n" \
+	"    -s - file to save the object store to on CRUD_CLOSE.\n" \
+	"\n" \
+
+// This is a single object in the store
+typedef struct {
+	uint8_t  *data;   // The object contents
+	uint32_t  length; // The length of the object
+	uint8_t   used;   // Flag indicating the object exists
+} CrudStandinObject;
+
+// This is a request read as part of a batch
+typedef struct {
+	CrudRequest  request; // The request (host byte order)
+	uint32_t     offset;  // The offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+	uint8_t     *payload; // The bytes of a CRUD_CREATE/CRUD_UPDATE/CRUD_WRITE_RANGE
+} CrudStandinBatchOp;
+
+//
+// Global Data
+int            crud_network_shutdown = 0;    // Flag indicating shutdown
+unsigned char *crud_network_address = NULL;  // Address of CRUD server
+unsigned short crud_network_port = 0;        // Port of CRUD server
+char          *crud_network_path = NULL;     // Unix domain socket of CRUD server (NULL for none)
+char          *crud_network_shm = NULL;      // Shared memory region of CRUD server (NULL for none)
+
+CrudStandinObject *standin_objects = NULL; // The object array (index is OID)
+uint32_t standin_object_slots = 0;         // Number of slots in the array
+CrudStandinObject standin_priority;        // The priority object
+char *standin_store = CRUD_STANDIN_STORE;  // Where the store is saved
+pthread_mutex_t standin_store_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards the store (connections run in parallel)
+
+//
+// Functional Prototypes
+int standin_accept_connection(int server, int tcp);
+void *standin_connection_thread(void *arg);
+void *standin_shm_thread(void *arg);
+int standin_handle_connection(int sock);
+CrudResponse standin_bus_request(CrudRequest request, int sock, uint32_t tag);
+CrudResponse standin_batch_request(CrudRequest request, int sock, uint32_t tag);
+int standin_read_payload(CrudRequest request, int sock, uint32_t *offset, uint8_t **payload);
+CrudResponse standin_execute(CrudRequest request, uint32_t offset, uint8_t *payload, uint8_t **outBuf,
+		uint32_t *outLength);
+uint8_t *standin_compress_reply(CrudRequest request, CrudResponse *response, uint8_t *outBuf, uint32_t *outLength);
+int standin_read_bytes(int sock, void *buf, uint32_t length);
+int standin_send_bytes(int sock, void *buf, uint32_t length);
+CrudOID standin_allocate_object(void);
+void standin_grow_objects(uint32_t minimum);
+int standin_save_store(void);
+int standin_load_store(void);
+void standin_clear_store(void);
+void standin_signal_handler(int sig);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the CRUD stand-in server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+	// Local variables
+	int ch, verbose = 0, log_initialized = 0;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, CRUD_STANDIN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &crud_network_port) != 1 ) {
+				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'U': // Set the unix domain socket path
+			crud_network_path = optarg;
+			break;
+
+		case 'm': // Set the shared memory region name
+			crud_network_shm = optarg;
+			break;
+
+		case 's': // Set the store filename
+			standin_store = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+	if ( verbose ) {
+		enableLogLevels( LOG_INFO_LEVEL );
+	}
+
+	// Load any saved store, then run the server
+	standin_load_store();
+	signal( SIGINT, standin_signal_handler );
+	signal( SIGTERM, standin_signal_handler );
+	signal( SIGPIPE, SIG_IGN );
+	if ( crud_server() ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in server failed.\n\n" );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crud_server
+// Description  : Listen for client connections (on the TCP port, and on the
+//                unix domain socket if there is one) and service each in its
+//                own thread until shutdown, so a client can keep several
+//                connections busy at once.  A shared memory region, if there
+//                is one, gets a thread of its own too.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int crud_server( void ) {
+	// Local variables
+	int server, local = -1, optval = 1, ret = 0;
+	struct sockaddr_in saddr;
+	struct sockaddr_un uaddr;
+	struct pollfd listeners[2];
+	CrudShmRegion *region;
+	pthread_t thread;
+
+	// Create the listening socket
+	server = socket(PF_INET, SOCK_STREAM, 0);
+	if ( server == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in socket() failed [%s]", strerror(errno) );
+		return( -1 );
+	}
+	setsockopt( server, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval) );
+	memset( &saddr, 0x0, sizeof(saddr) );
+	saddr.sin_family = AF_INET;
+	saddr.sin_port = htons( (crud_network_port == 0) ? CRUD_DEFAULT_PORT : crud_network_port );
+	saddr.sin_addr.s_addr = htonl( INADDR_ANY );
+	if ( (bind(server, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) ||
+		 (listen(server, CRUD_MAX_BACKLOG) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in bind/listen failed [%s]", strerror(errno) );
+		close( server );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD stand-in listening on port %d", ntohs(saddr.sin_port) );
+
+	// Listen on the unix domain socket too (replacing one left behind by an earlier run)
+	if ( crud_network_path != NULL ) {
+		memset( &uaddr, 0x0, sizeof(uaddr) );
+		uaddr.sun_family = AF_UNIX;
+		if ( strlen(crud_network_path) >= sizeof(uaddr.sun_path) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in socket path too long [%s]", crud_network_path );
+			close( server );
+			return( -1 );
+		}
+		strcpy( uaddr.sun_path, crud_network_path );
+		unlink( crud_network_path );
+		if ( ((local = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) ||
+			 (bind(local, (struct sockaddr *)&uaddr, sizeof(uaddr)) == -1) ||
+			 (listen(local, CRUD_MAX_BACKLOG) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in bind/listen on [%s] failed [%s]", crud_network_path,
+					strerror(errno) );
+			if ( local != -1 ) {
+				close( local );
+			}
+			close( server );
+			return( -1 );
+		}
+		logMessage( LOG_INFO_LEVEL, "CRUD stand-in listening on [%s]", crud_network_path );
+	}
+
+	// Serve the shared memory region (it is only unlinked at shutdown, the thread keeps it mapped)
+	if ( crud_network_shm != NULL ) {
+		if ( ((region = crud_shm_create(crud_network_shm)) == NULL) ||
+			 (pthread_create(&thread, NULL, standin_shm_thread, region) != 0) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in failed to serve shared memory [%s]", crud_network_shm );
+			crud_shm_destroy( region, crud_network_shm );
+			if ( local != -1 ) {
+				close( local );
+				unlink( crud_network_path );
+			}
+			close( server );
+			return( -1 );
+		}
+		pthread_detach( thread );
+		logMessage( LOG_INFO_LEVEL, "CRUD stand-in serving shared memory [%s]", crud_network_shm );
+	}
+
+	// Service each client connection in its own thread (poll skips a socket of -1)
+	listeners[0].fd = server;
+	listeners[1].fd = local;
+	listeners[0].events = listeners[1].events = POLLIN;
+	while ( (! crud_network_shutdown) && (ret == 0) ) {
+		if ( poll(listeners, 2, -1) == -1 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in poll() failed [%s]", strerror(errno) );
+			break;
+		}
+		if ( listeners[0].revents & POLLIN ) {
+			ret = standin_accept_connection( server, 1 );
+		}
+		if ( (ret == 0) && (listeners[1].revents & POLLIN) ) {
+			ret = standin_accept_connection( local, 0 );
+		}
+	}
+
+	// Cleanup and return
+	close( server );
+	if ( local != -1 ) {
+		close( local );
+		unlink( crud_network_path );
+	}
+	if ( crud_network_shm != NULL ) {
+		crud_shm_destroy( NULL, crud_network_shm );
+	}
+	pthread_mutex_lock( &standin_store_mutex );
+	standin_clear_store();
+	pthread_mutex_unlock( &standin_store_mutex );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_accept_connection
+// Description  : Accept a client connection and start a thread to service it
+//
+// Inputs       : server - the listening socket (with a connection waiting)
+//                tcp - flag indicating it is the TCP socket
+// Outputs      : 0 if successful (or just interrupted), -1 if failure
+
+int standin_accept_connection(int server, int tcp) {
+	// Local variables
+	int client, optval = 1;
+	pthread_t thread;
+
+	client = accept( server, NULL, NULL );
+	if ( client == -1 ) {
+		if ( errno == EINTR ) {
+			return( 0 );
+		}
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in accept() failed [%s]", strerror(errno) );
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "CRUD stand-in accepted client connection%s.", tcp ? "" : " (unix domain)" );
+	if ( tcp ) {
+		setsockopt( client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval) );
+	}
+	if ( pthread_create(&thread, NULL, standin_connection_thread, (void *)(intptr_t)client) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in failed to start connection thread." );
+		close( client );
+		return( 0 );
+	}
+	pthread_detach( thread );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_connection_thread
+// Description  : Service one client connection, then close it
+//
+// Inputs       : arg - the connected client socket
+// Outputs      : NULL
+
+void *standin_connection_thread(void *arg) {
+	int sock = (int)(intptr_t)arg;
+
+	standin_handle_connection( sock );
+	close( sock );
+	logMessage( LOG_INFO_LEVEL, "CRUD stand-in client connection closed." );
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_shm_thread
+// Description  : Service the shared memory region: take each request off the
+//                request ring, copy the bytes the client left in the arena
+//                into a buffer the store keeps, run it, copy any bytes read
+//                into the arena and put the response on the response ring.
+//                Between requests the rings are emptied for each new claim
+//                of the region.  Runs until shutdown.
+//
+// Inputs       : arg - the region
+// Outputs      : NULL
+
+void *standin_shm_thread(void *arg) {
+	// Local variables
+	CrudShmRegion *region = arg;
+	CrudShmEntry entry;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, outLength;
+	uint8_t flags, res, *payload, *outBuf;
+	CrudResponse response;
+
+	while ( 1 ) {
+		// A new client wants the rings emptied (whatever its predecessor left
+		// is dropped), then wait for a request (or just the wake-up for a claim)
+		if ( __atomic_load_n(&region->reset, __ATOMIC_ACQUIRE) ) {
+			logMessage( LOG_INFO_LEVEL, "CRUD stand-in shm region claimed by client %d.",
+					(int)__atomic_load_n(&region->owner, __ATOMIC_ACQUIRE) );
+			crud_shm_reset( region );
+		}
+		if ( crud_shm_pop(&region->requests, &entry, 0) ) {
+			continue;
+		}
+		deconstruct_crud_request( entry.request, &oid, &req, &length, &flags, &res );
+		logMessage( LOG_INFO_LEVEL, "CRUD stand-in shm request [oid=%u, req=%d, len=%u, flags=%d]",
+				oid, req, length, flags );
+
+		// Refuse bytes outside the arena (batches and compression are what the rings replace)
+		if ( ((uint64_t)entry.data + crud_shm_span(entry.request) > CRUD_SHM_ARENA_SIZE) ||
+			 (req == CRUD_BATCH) || ((flags & CRUD_COMPRESSED) && (req != CRUD_INIT)) ) {
+			entry.request = construct_crud_request( oid, req, length, flags, 1 );
+			crud_shm_push( &region->responses, &entry );
+			continue;
+		}
+
+		// The store keeps its own copy of bytes written, as it does of those off a socket
+		payload = NULL;
+		if ( (req == CRUD_CREATE) || (req == CRUD_UPDATE) || (req == CRUD_WRITE_RANGE) ) {
+			payload = malloc( (length == 0) ? 1 : length );
+			memcpy( payload, &region->arena[entry.data], length );
+		}
+		pthread_mutex_lock( &standin_store_mutex );
+		response = standin_execute( entry.request, entry.offset, payload, &outBuf, &outLength );
+		memcpy( &region->arena[entry.data], outBuf, outLength );
+		pthread_mutex_unlock( &standin_store_mutex );
+
+		// Answer (the client never has more in flight than the ring holds)
+		entry.request = response;
+		if ( crud_shm_push(&region->responses, &entry) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in shm response ring overflowed." );
+		}
+	}
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_handle_connection
+// Description  : Process the requests from a single client until it closes
+//                the connection or sends CRUD_CLOSE.  Requests are run in
+//                the order they arrive, a tagged request's response carries
+//                its tag back.
+//
+// Inputs       : sock - the connected client socket
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_handle_connection(int sock) {
+	// Local variables
+	CrudRequest netReq, request;
+	CrudResponse response;
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, tag = 0;
+	uint8_t flags, res;
+
+	// Keep processing requests
+	while ( standin_read_bytes(sock, &netReq, sizeof(netReq)) == 0 ) {
+		request = ntohll64( netReq );
+		deconstruct_crud_request( request, &oid, &req, &length, &flags, &res );
+		logMessage( LOG_INFO_LEVEL, "CRUD stand-in request [oid=%u, req=%d, len=%u, flags=%d]",
+				oid, req, length, flags );
+		if ( (flags & CRUD_TAGGED) && standin_read_bytes(sock, &tag, CRUD_TAG_SIZE) ) {
+			return( -1 );
+		}
+
+		// Execute the request (the response and any payload are sent there)
+		response = standin_bus_request( request, sock, tag );
+		if ( response == (CrudResponse)-1 ) {
+			return( -1 );
+		}
+
+		// The client is done with the connection after a close
+		if ( req == CRUD_CLOSE ) {
+			return( 0 );
+		}
+	}
+
+	// Client went away
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_bus_request
+// Description  : Execute a single request against the object store, reading
+//                any request payload and sending the response and any
+//                response payload.
+//
+// Inputs       : request - the request (host byte order)
+//                sock - the client socket
+//                tag - the tag sent with the request (network byte order, if tagged)
+// Outputs      : the response sent, or (CrudResponse)-1 on socket failure
+
+CrudResponse standin_bus_request(CrudRequest request, int sock, uint32_t tag) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, offset = 0, outLength, head;
+	uint8_t flags, res, *payload = NULL, *outBuf, *packed;
+	CrudResponse response, netResp;
+
+	// Batches are read whole before any of it is run
+	deconstruct_crud_request( request, &oid, &req, &length, &flags, &res );
+	if ( req == CRUD_BATCH ) {
+		return( standin_batch_request(request, sock, tag) );
+	}
+	head = sizeof(netResp) + ((flags & CRUD_TAGGED) ? CRUD_TAG_SIZE : 0);
+
+	// Read any payload that comes with the request, then run it
+	if ( standin_read_payload(request, sock, &offset, &payload) ) {
+		return( (CrudResponse)-1 );
+	}
+	// (the bytes going back are copied out, so the store is not held while they are sent)
+	pthread_mutex_lock( &standin_store_mutex );
+	response = standin_execute( request, offset, payload, &outBuf, &outLength );
+	packed = standin_compress_reply( request, &response, outBuf, &outLength );
+	if ( packed == NULL ) {
+		packed = malloc( CRUD_STANDIN_REPLY_HEAD + outLength );
+		memcpy( &packed[CRUD_STANDIN_REPLY_HEAD], outBuf, outLength );
+	}
+	pthread_mutex_unlock( &standin_store_mutex );
+
+	// Send the response header (and tag) and any payload back to the client in one write
+	netResp = htonll64( response );
+	memcpy( &packed[CRUD_STANDIN_REPLY_HEAD - head], &netResp, sizeof(netResp) );
+	memcpy( &packed[sizeof(CrudResponse)], &tag, (flags & CRUD_TAGGED) ? CRUD_TAG_SIZE : 0 );
+	if ( standin_send_bytes(sock, &packed[CRUD_STANDIN_REPLY_HEAD - head], head + outLength) ) {
+		free( packed );
+		return( (CrudResponse)-1 );
+	}
+	free( packed );
+	return( response );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_batch_request
+// Description  : Execute a batch of requests.  Every request in the batch
+//                (and its payload) is read first, so the client can send the
+//                whole batch before reading anything, then they are run in
+//                order and the responses sent back together.
+//
+// Inputs       : request - the CRUD_BATCH request (length is the count)
+//                sock - the client socket
+//                tag - the tag sent with the batch (network byte order, if tagged)
+// Outputs      : the batch response sent, or (CrudResponse)-1 on failure
+
+CrudResponse standin_batch_request(CrudRequest request, int sock, uint32_t tag) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, count, i, outLength, head, replySize = 0, replyUsed = CRUD_STANDIN_REPLY_HEAD;
+	uint8_t flags, batchFlags, res, *outBuf, *reply = NULL, *grown, *packed;
+	CrudStandinBatchOp *ops;
+	CrudResponse response, netResp;
+	int failed = 0;
+
+	// Read every request in the batch
+	deconstruct_crud_request( request, &oid, &req, &count, &batchFlags, &res );
+	if ( (count == 0) || (count > CRUD_BATCH_MAX_OPS) ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in batch of %u requests refused.", count );
+		return( (CrudResponse)-1 );
+	}
+	ops = calloc( count, sizeof(CrudStandinBatchOp) );
+	for ( i=0; i<count; i++ ) {
+		if ( standin_read_bytes(sock, &netResp, sizeof(netResp)) ||
+			 standin_read_payload((ops[i].request = ntohll64(netResp)), sock, &ops[i].offset, &ops[i].payload) ) {
+			failed = 1;
+			break;
+		}
+	}
+
+	// Run them in order, collecting the responses and any bytes read
+	pthread_mutex_lock( &standin_store_mutex );
+	for ( i=0; (i<count) && !failed; i++ ) {
+		deconstruct_crud_request( ops[i].request, &oid, &req, &length, &flags, &res );
+		if ( (req == CRUD_CREATE) || (req == CRUD_READ) || (req == CRUD_UPDATE) ||
+			 (req == CRUD_DELETE) || (req == CRUD_READ_RANGE) || (req == CRUD_WRITE_RANGE) ) {
+			response = standin_execute( ops[i].request, ops[i].offset, ops[i].payload, &outBuf, &outLength );
+			if ( (packed = standin_compress_reply(ops[i].request, &response, outBuf, &outLength)) != NULL ) {
+				outBuf = &packed[CRUD_STANDIN_REPLY_HEAD];
+			}
+		} else {
+			free( ops[i].payload );
+			response = construct_crud_request( oid, req, length, flags & ~CRUD_COMPRESSED, 1 );
+			outLength = 0;
+			packed = NULL;
+		}
+		ops[i].payload = NULL;
+		if ( replyUsed + sizeof(netResp) + outLength > replySize ) {
+			replySize = (replySize == 0) ? 4096 : replySize; // (room left in front for the batch response)
+			while ( replyUsed + sizeof(netResp) + outLength > replySize ) {
+				replySize *= 2;
+			}
+			if ( (grown = realloc(reply, replySize)) == NULL ) {
+				free( packed );
+				failed = 1;
+				break;
+			}
+			reply = grown;
+		}
+		netResp = htonll64( response );
+		memcpy( &reply[replyUsed], &netResp, sizeof(netResp) );
+		memcpy( &reply[replyUsed + sizeof(netResp)], outBuf, outLength );
+		replyUsed += sizeof(netResp) + outLength;
+		free( packed );
+	}
+	pthread_mutex_unlock( &standin_store_mutex );
+
+	// Send the batch response, then every response in it, in one write
+	for ( i=0; i<count; i++ ) {
+		free( ops[i].payload );
+	}
+	free( ops );
+	if ( failed ) {
+		free( reply );
+		return( (CrudResponse)-1 );
+	}
+	response = construct_crud_request( 0, CRUD_BATCH, count, batchFlags & CRUD_TAGGED, 0 );
+	netResp = htonll64( response );
+	head = sizeof(netResp) + ((batchFlags & CRUD_TAGGED) ? CRUD_TAG_SIZE : 0);
+	memcpy( &reply[CRUD_STANDIN_REPLY_HEAD - head], &netResp, sizeof(netResp) );
+	memcpy( &reply[sizeof(CrudResponse)], &tag, (batchFlags & CRUD_TAGGED) ? CRUD_TAG_SIZE : 0 );
+	if ( standin_send_bytes(sock, &reply[CRUD_STANDIN_REPLY_HEAD - head], head + replyUsed - CRUD_STANDIN_REPLY_HEAD) ) {
+		free( reply );
+		return( (CrudResponse)-1 );
+	}
+	free( reply );
+	return( response );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_read_payload
+// Description  : Read whatever follows a request header on the wire
+//
+// Inputs       : request - the request (host byte order)
+//                sock - the client socket
+//                offset - set to the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+//                payload - set to the bytes of a CRUD_CREATE/CRUD_UPDATE/CRUD_WRITE_RANGE
+//                          (malloced, NULL if none)
+// Outputs      : 0 if successful, -1 on socket failure
+
+int standin_read_payload(CrudRequest request, int sock, uint32_t *offset, uint8_t **payload) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+
+	deconstruct_crud_request( request, &oid, &req, &length, &flags, &res );
+	*payload = NULL;
+	if ( ((req == CRUD_CREATE) || (req == CRUD_UPDATE)) && (flags & CRUD_COMPRESSED) ) {
+		// Compressed, read the size and the bytes then expand them
+		uint32_t size;
+		uint8_t *packed;
+		if ( standin_read_bytes(sock, &size, CRUD_COMPRESS_SIZE_HEADER) ||
+			 ((size = ntohl(size)) > length) ) {
+			return( -1 );
+		}
+		packed = malloc( (size == 0) ? 1 : size );
+		*payload = malloc( (length == 0) ? 1 : length );
+		if ( standin_read_bytes(sock, packed, size) || crud_decompress(packed, size, *payload, length) ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in failed to read compressed payload." );
+			free( packed );
+			free( *payload );
+			*payload = NULL;
+			return( -1 );
+		}
+		free( packed );
+	} else if ( (req == CRUD_CREATE) || (req == CRUD_UPDATE) ) {
+		*payload = malloc( (length == 0) ? 1 : length );
+		if ( standin_read_bytes(sock, *payload, length) ) {
+			free( *payload );
+			*payload = NULL;
+			return( -1 );
+		}
+	} else if ( (req == CRUD_READ_RANGE) || (req == CRUD_WRITE_RANGE) ) {
+		if ( standin_read_bytes(sock, offset, CRUD_RANGE_HEADER_SIZE) ) {
+			return( -1 );
+		}
+		*offset = ntohl( *offset );
+		if ( req == CRUD_WRITE_RANGE ) {
+			*payload = malloc( (length == 0) ? 1 : length );
+			if ( standin_read_bytes(sock, *payload, length) ) {
+				free( *payload );
+				*payload = NULL;
+				return( -1 );
+			}
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_execute
+// Description  : Run a single request against the object store
+//
+// Inputs       : request - the request (host byte order)
+//                offset - the offset of a CRUD_READ_RANGE/CRUD_WRITE_RANGE
+//                payload - the bytes of a CRUD_CREATE/CRUD_UPDATE/CRUD_WRITE_RANGE (taken over)
+//                outBuf - set to the bytes to send back
+//                outLength - set to the number of bytes to send back
+// Outputs      : the response
+
+CrudResponse standin_execute(CrudRequest request, uint32_t offset, uint8_t *payload, uint8_t **outBuf,
+		uint32_t *outLength) {
+	// Local variables
+	CrudOID oid, newOid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length;
+	uint8_t flags, res;
+	CrudStandinObject *obj = NULL;
+	int failed = 0;
+
+	// Pull the request apart
+	deconstruct_crud_request( request, &oid, &req, &length, &flags, &res );
+	*outBuf = NULL;
+	*outLength = 0;
+
+	// Find the object being referenced
+	if ( flags & CRUD_PRIORITY_OBJECT ) {
+		obj = (standin_priority.used) ? &standin_priority : NULL;
+	} else if ( (oid != CRUD_NO_OBJECT) && (oid < standin_object_slots) &&
+			standin_objects[oid].used ) {
+		obj = &standin_objects[oid];
+	}
+
+	// Now execute the request
+	switch ( req ) {
+
+	case CRUD_INIT: // Grant every protocol extension we know, if asked
+		length = (flags & CRUD_NEGOTIATE) ? (CRUD_STANDIN_CAPABILITIES | CRUD_CAP_ACK) : 0;
+		break;
+
+	case CRUD_FORMAT: // Remove every object
+		standin_clear_store();
+		break;
+
+	case CRUD_CREATE: // Create a new object from the payload
+		if ( flags & CRUD_PRIORITY_OBJECT ) {
+			if ( standin_priority.used ) {
+				failed = 1;
+				break;
+			}
+			obj = &standin_priority;
+			oid = 0;
+		} else {
+			newOid = standin_allocate_object();
+			obj = &standin_objects[newOid];
+			oid = newOid;
+		}
+		obj->data = payload;
+		obj->length = length;
+		obj->used = 1;
+		payload = NULL;
+		break;
+
+	case CRUD_READ: // Read the object contents back to the client
+		if ( (obj == NULL) || (length < obj->length) ) {
+			failed = 1;
+			break;
+		}
+		*outBuf = obj->data;
+		*outLength = length = obj->length;
+		break;
+
+	case CRUD_READ_RANGE: // Read part of the object back to the client
+		if ( (obj == NULL) || (offset > obj->length) ) {
+			failed = 1;
+			break;
+		}
+		if ( length > obj->length - offset ) {
+			length = obj->length - offset;
+		}
+		*outBuf = &obj->data[offset];
+		*outLength = length;
+		break;
+
+	case CRUD_WRITE_RANGE: // Replace part of the object contents
+		if ( (obj == NULL) || (offset > obj->length) || (length > obj->length - offset) ) {
+			failed = 1;
+			break;
+		}
+		memcpy( &obj->data[offset], payload, length );
+		break;
+
+	case CRUD_UPDATE: // Replace the object contents (same size only)
+		if ( (obj == NULL) || (length != obj->length) ) {
+			failed = 1;
+			break;
+		}
+		free( obj->data );
+		obj->data = payload;
+		payload = NULL;
+		break;
+
+	case CRUD_DELETE: // Remove the object
+		if ( obj == NULL ) {
+			failed = 1;
+			break;
+		}
+		free( obj->data );
+		memset( obj, 0x0, sizeof(CrudStandinObject) );
+		break;
+
+	case CRUD_CLOSE: // Save the store to disk
+		failed = ( standin_save_store() != 0 );
+		break;
+
+	default: // Unknown request
+		failed = 1;
+		break;
+	}
+
+	// Build the response
+	free( payload );
+	if ( failed ) {
+		*outLength = 0;
+	}
+	return( construct_crud_request(oid, req, length, flags, failed) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_compress_reply
+// Description  : Compress the bytes going back with a response if the client
+//                offered to take them that way and they shrink, setting the
+//                flag on the response only if they were.
+//
+// Inputs       : request - the request (host byte order)
+//                response - the response, flag updated
+//                outBuf - the bytes to send back
+//                outLength - the number of bytes, updated if compressed
+// Outputs      : the compressed bytes to send instead (malloced, after
+//                CRUD_STANDIN_REPLY_HEAD bytes of room for the response
+//                header and tag), or NULL
+
+uint8_t *standin_compress_reply(CrudRequest request, CrudResponse *response, uint8_t *outBuf, uint32_t *outLength) {
+	// Local variables
+	CrudOID oid;
+	CRUD_REQUEST_TYPES req;
+	uint32_t length, size;
+	uint8_t flags, res, *packed;
+
+	// Check the client asked for it on a read that is sending bytes back
+	deconstruct_crud_request( *response, &oid, &req, &length, &flags, &res );
+	*response = construct_crud_request( oid, req, length, flags & ~CRUD_COMPRESSED, res );
+	if ( !(flags & CRUD_COMPRESSED) || ((req != CRUD_READ) && (req != CRUD_READ_RANGE)) || (*outLength == 0) ) {
+		return( NULL );
+	}
+
+	// Send them raw unless they get smaller
+	packed = malloc( CRUD_STANDIN_REPLY_HEAD + CRUD_COMPRESS_SIZE_HEADER + *outLength );
+	size = crud_compress( outBuf, *outLength, &packed[CRUD_STANDIN_REPLY_HEAD + CRUD_COMPRESS_SIZE_HEADER],
+			*outLength - 1 );
+	if ( size == 0 ) {
+		free( packed );
+		return( NULL );
+	}
+	*(uint32_t *)&packed[CRUD_STANDIN_REPLY_HEAD] = htonl( size );
+	*outLength = CRUD_COMPRESS_SIZE_HEADER + size;
+	*response = construct_crud_request( oid, req, length, flags, res );
+	return( packed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_read_bytes
+// Description  : Read exactly length bytes from the socket
+//
+// Inputs       : sock - the socket to read from
+//                buf - the buffer to place the bytes in
+//                length - the number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_read_bytes(int sock, void *buf, uint32_t length) {
+	uint32_t done = 0;
+	ssize_t ret;
+
+	while ( done < length ) {
+		ret = read( sock, (char *)buf + done, length - done );
+		if ( ret <= 0 ) {
+			if ( (ret == -1) && (errno == EINTR) ) {
+				continue;
+			}
+			return( -1 );
+		}
+		done += ret;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_send_bytes
+// Description  : Send exactly length bytes on the socket
+//
+// Inputs       : sock - the socket to write to
+//                buf - the bytes to send
+//                length - the number of bytes to send
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_send_bytes(int sock, void *buf, uint32_t length) {
+	uint32_t done = 0;
+	ssize_t ret;
+
+	while ( done < length ) {
+		ret = write( sock, (char *)buf + done, length - done );
+		if ( ret <= 0 ) {
+			if ( (ret == -1) && (errno == EINTR) ) {
+				continue;
+			}
+			return( -1 );
+		}
+		done += ret;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_allocate_object
+// Description  : Find (or make room for) an unused object identifier
+//
+// Inputs       : none
+// Outputs      : the new object identifier
+
+CrudOID standin_allocate_object(void) {
+	uint32_t i;
+
+	// Look for a free slot (OID 0 is never handed out)
+	for ( i=1; i<standin_object_slots; i++ ) {
+		if ( ! standin_objects[i].used ) {
+			return( i );
+		}
+	}
+
+	// None free, grow the array
+	i = (standin_object_slots == 0) ? 1 : standin_object_slots;
+	standin_grow_objects( i+1 );
+	return( i );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_grow_objects
+// Description  : Grow the object array so it has at least the given slots
+//
+// Inputs       : minimum - the minimum number of slots needed
+// Outputs      : none
+
+void standin_grow_objects(uint32_t minimum) {
+	uint32_t slots = (standin_object_slots == 0) ? CRUD_STANDIN_INITIAL_OBJECTS : standin_object_slots;
+
+	while ( slots < minimum ) {
+		slots *= 2;
+	}
+	if ( slots == standin_object_slots ) {
+		return;
+	}
+	standin_objects = realloc( standin_objects, slots*sizeof(CrudStandinObject) );
+	memset( &standin_objects[standin_object_slots], 0x0,
+			(slots-standin_object_slots)*sizeof(CrudStandinObject) );
+	standin_object_slots = slots;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_save_store
+// Description  : Write the object store out to the store file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int standin_save_store(void) {
+	// Local variables
+	FILE *fhandle;
+	uint32_t i, hdr[2];
+
+	// Open the file, write each object as [oid, length, bytes]
+	if ( (fhandle = fopen(standin_store, "w")) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "CRUD stand-in save failed [%s]", strerror(errno) );
+		return( -1 );
+	}
+	if ( standin_priority.used ) {
+		hdr[0] = 0;
+		hdr[1] = standin_priority.length;
+		fwrite( hdr, sizeof(hdr), 1, fhandle );
+		fwrite( standin_priority.data, 1, standin_priority.length, fhandle );
+	}
+	for ( i=1; i<standin_object_slots; i++ ) {
+		if ( standin_objects[i].used ) {
+			hdr[0] = i;
+			hdr[1] = standin_objects[i].length;
+			fwrite( hdr, sizeof(hdr), 1, fhandle );
+			fwrite( standin_objects[i].data, 1, standin_objects[i].length, fhandle );
+		}
+	}
+	fclose( fhandle );
+	logMessage( LOG_INFO_LEVEL, "CRUD stand-in saved store to [%s]", standin_store );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_load_store
+// Description  : Read the object store back in from the store file
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure (no store is not a failure)
+
+int standin_load_store(void) {
+	// Local variables
+	FILE *fhandle;
+	uint32_t hdr[2];
+	CrudStandinObject *obj;
+
+	// Open the file if it exists, read back the objects
+	if ( (fhandle = fopen(standin_store, "r")) == NULL ) {
+		return( 0 );
+	}
+	while ( fread(hdr, sizeof(hdr), 1, fhandle) == 1 ) {
+		if ( hdr[0] == 0 ) {
+			obj = &standin_priority;
+		} else {
+			standin_grow_objects( hdr[0]+1 );
+			obj = &standin_objects[hdr[0]];
+		}
+		obj->data = malloc( (hdr[1] == 0) ? 1 : hdr[1] );
+		obj->length = hdr[1];
+		obj->used = 1;
+		if ( fread(obj->data, 1, hdr[1], fhandle) != hdr[1] ) {
+			logMessage( LOG_ERROR_LEVEL, "CRUD stand-in store [%s] truncated", standin_store );
+			fclose( fhandle );
+			return( -1 );
+		}
+	}
+	fclose( fhandle );
+	logMessage( LOG_INFO_LEVEL, "CRUD stand-in loaded store from [%s]", standin_store );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_clear_store
+// Description  : Remove every object from the store
+//
+// Inputs       : none
+// Outputs      : none
+
+void standin_clear_store(void) {
+	uint32_t i;
+
+	for ( i=0; i<standin_object_slots; i++ ) {
+		free( standin_objects[i].data );
+	}
+	free( standin_objects );
+	standin_objects = NULL;
+	standin_object_slots = 0;
+	free( standin_priority.data );
+	memset( &standin_priority, 0x0, sizeof(standin_priority) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : standin_signal_handler
+// Description  : Shut the server down on interrupt, die as before on a
+//                terminate.  The shared memory name goes either way (the
+//                signal may land on a thread other than the one that
+//                would unlink it at shutdown).
+//
+// Inputs       : sig - the signal received
+// Outputs      : none
+
+void standin_signal_handler(int sig) {
+	if ( crud_network_shm != NULL ) {
+		shm_unlink( crud_network_shm );
+	}
+	if ( sig == SIGTERM ) {
+		signal( SIGTERM, SIG_DFL );
+		raise( SIGTERM );
+	}
+	crud_network_shutdown = 1;
+}